@@ -0,0 +1,287 @@
+#include "GBinHits.h"
+
+//--- little-endian and varint helpers
+static inline void put32(unsigned char* p, uint32_t v) {
+ p[0]=v & 0xFF; p[1]=(v>>8) & 0xFF; p[2]=(v>>16) & 0xFF; p[3]=(v>>24) & 0xFF;
+}
+static inline uint32_t get32(const unsigned char* p) {
+ return ((uint32_t)p[0]) | ((uint32_t)p[1]<<8) |
+        ((uint32_t)p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+static inline void put64(unsigned char* p, uint64_t v) {
+ put32(p, (uint32_t)(v & 0xFFFFFFFF));
+ put32(p+4, (uint32_t)(v>>32));
+}
+static inline uint64_t get64(const unsigned char* p) {
+ return ((uint64_t)get32(p)) | (((uint64_t)get32(p+4))<<32);
+}
+
+static void writeVarint(FILE* f, uint32_t v) {
+ while (v>=0x80) {
+   putc((v & 0x7F) | 0x80, f);
+   v>>=7;
+   }
+ putc(v, f);
+}
+
+static bool readVarint(FILE* f, uint32_t& v) {
+ v=0;
+ for (int shift=0;shift<35;shift+=7) {
+   int c=getc(f);
+   if (c==EOF) return false;
+   v|=((uint32_t)(c & 0x7F))<<shift;
+   if ((c & 0x80)==0) return true;
+   }
+ return false; //malformed
+}
+
+static inline uint32_t zigzag(int v) { return (((uint32_t)v)<<1) ^ (uint32_t)(v>>31); }
+static inline int unzigzag(uint32_t v) { return (int)(v>>1) ^ -(int)(v & 1); }
+
+//fixed part of a hit record, after the type byte
+#define MGBH_HITLEN 50
+
+//parse a mgblast gap list like "12+3,45"
+bool parseGaps(char* s, GVec<int>& gpos, GVec<int>& glen) {
+ char* p=s;
+ while (*p!=0) {
+   int pos=0, len=1;
+   if (!parseInt(p, pos) || pos<=0) return false;
+   if (*p=='+') {
+     p++;
+     if (!parseInt(p, len) || len<=0) return false;
+     }
+   gpos.Add(pos);
+   glen.Add(len);
+   if (*p==',') p++;
+     else if (*p!=0) return false;
+   }
+ return true;
+}
+
+//--------------------- GBinHit
+bool GBinHit::parseLine(char* line, int& errfld) {
+ char* fields[14];
+ int fldno=0;
+ fields[0]=line;
+ for (char* p=line; *p!=0; p++) {
+   if (*p=='\t') {
+     *p=0;
+     if (fldno==13) break; //ignore any extra fields
+     fields[++fldno]=p+1;
+     }
+   }
+ clearGaps();
+ hasGaps=false;
+ errfld=fldno+1;
+ if (fldno<11) return false;
+ char* p;
+ int* ifld[6]={&qlen, &q5, &q3, &hlen, &h5, &h3};
+ int fmap[6]={1,2,3,5,6,7};
+ for (int i=0;i<6;i++) {
+   p=fields[fmap[i]];
+   errfld=fmap[i];
+   if (!parseInt(p, *ifld[i]) || *ifld[i]<=0) return false;
+   }
+ qname=fields[0];
+ hname=fields[4];
+ errfld=0;
+ if (*qname==0) return false;
+ errfld=4;
+ if (*hname==0) return false;
+ double v;
+ p=fields[8];errfld=8;
+ if (!parseNumber(p, v)) return false;
+ pid=(float)v;
+ p=fields[9];errfld=9;
+ if (!parseNumber(p, v)) return false;
+ score=(int)v;
+ p=fields[10];errfld=10;
+ if (!parseNumber(p, score2)) return false;
+ errfld=11;
+ strand=fields[11][0];
+ if (strand!='+' && strand!='-') return false;
+ if (fldno>=12) {
+   hasGaps=true;
+   errfld=12;
+   if (!parseGaps(fields[12], gpos[0], glen[0])) return false;
+   if (fldno>=13) {
+     errfld=13;
+     if (!parseGaps(fields[13], gpos[1], glen[1])) return false;
+     }
+   }
+ errfld=-1;
+ return true;
+}
+
+void GBinHit::gapStr(int idx, GStr& s) {
+ s="";
+ char buf[32];
+ for (int i=0;i<gpos[idx].Count();i++) {
+   int l=glen[idx][i];
+   if (l>1) sprintf(buf, "%s%d+%d", (i>0)?",":"", gpos[idx][i], l);
+       else sprintf(buf, "%s%d", (i>0)?",":"", gpos[idx][i]);
+   s+=buf;
+   }
+}
+
+void GBinHit::toLine(GStr& s) {
+ char buf[256];
+ s=qname;
+ sprintf(buf, "\t%d\t%d\t%d\t", qlen, q5, q3);
+ s+=buf;
+ s+=hname;
+ sprintf(buf, "\t%d\t%d\t%d\t%.7g\t%d\t%.15g\t%c", hlen, h5, h3,
+                                     pid, score, score2, strand);
+ s+=buf;
+ if (hasGaps) {
+   GStr g;
+   for (int i=0;i<2;i++) {
+     gapStr(i, g);
+     s+='\t';
+     s+=g;
+     }
+   }
+}
+
+//--------------------- GBinHitWriter
+GBinHitWriter::GBinHitWriter(FILE* fout):f(fout), ids(), numids(0) {
+ unsigned char hdr[8];
+ memcpy(hdr, MGBH_MAGIC, 4);
+ put32(hdr+4, MGBH_VERSION);
+ if (fwrite(hdr, 1, 8, f)!=8)
+   GError("Error writing binary hits header!\n");
+}
+
+uint32_t GBinHitWriter::nameId(const char* name) {
+ int* id=ids.Find(name);
+ if (id!=NULL) return (uint32_t)*id;
+ int len=strlen(name);
+ putc('N', f);
+ writeVarint(f, len);
+ fwrite(name, 1, len, f);
+ ids.Add(name, new int(numids));
+ return numids++;
+}
+
+void GBinHitWriter::write(GBinHit& h) {
+ //name records must precede the hit record referencing them
+ uint32_t qid=nameId(h.qname);
+ uint32_t hid=nameId(h.hname);
+ unsigned char rec[MGBH_HITLEN];
+ put32(rec, qid);
+ put32(rec+4, h.qlen);
+ put32(rec+8, h.q5);
+ put32(rec+12, h.q3);
+ put32(rec+16, hid);
+ put32(rec+20, h.hlen);
+ put32(rec+24, h.h5);
+ put32(rec+28, h.h3);
+ uint32_t fv;
+ memcpy(&fv, &h.pid, 4);
+ put32(rec+32, fv);
+ put32(rec+36, h.score);
+ uint64_t dv;
+ memcpy(&dv, &h.score2, 8);
+ put64(rec+40, dv);
+ rec[48]=h.strand;
+ rec[49]=h.hasGaps ? MGBH_GAPS : 0;
+ putc('H', f);
+ fwrite(rec, 1, MGBH_HITLEN, f);
+ if (h.hasGaps) {
+   for (int i=0;i<2;i++) {
+     writeVarint(f, h.gpos[i].Count());
+     int prev=0;
+     for (int j=0;j<h.gpos[i].Count();j++) {
+       writeVarint(f, zigzag(h.gpos[i][j]-prev));
+       writeVarint(f, h.glen[i][j]);
+       prev=h.gpos[i][j];
+       }
+     }
+   }
+}
+
+//--------------------- GBinHitReader
+bool GBinHitReader::isBinary(FILE* f) {
+ int c=getc(f);
+ if (c==EOF) return false;
+ ungetc(c, f);
+ return (c==(unsigned char)MGBH_MAGIC[0]);
+}
+
+GBinHitReader::GBinHitReader(FILE* fin):f(fin), names(1024), hit(), numHits(0) {
+ unsigned char hdr[8];
+ if (fread(hdr, 1, 8, f)!=8 || memcmp(hdr, MGBH_MAGIC, 4)!=0)
+   GError("Error: invalid binary hits file header!\n");
+ uint32_t ver=get32(hdr+4);
+ if (ver!=MGBH_VERSION)
+   GError("Error: unsupported binary hits format version (%u)!\n", ver);
+}
+
+GBinHitReader::~GBinHitReader() {
+ for (int i=0;i<names.Count();i++) GFREE(names[i]);
+}
+
+char* GBinHitReader::readName() {
+ uint32_t len;
+ char* name=NULL;
+ if (!readVarint(f, len) || len==0) return NULL;
+ GMALLOC(name, len+1);
+ if (fread(name, 1, len, f)!=len) { GFREE(name); return NULL; }
+ name[len]=0;
+ return name;
+}
+
+bool GBinHitReader::next() {
+ int c;
+ while ((c=getc(f))=='N') {
+   char* name=readName();
+   if (name==NULL)
+     GError("Error: truncated name record in binary hits file!\n");
+   names.Add(name);
+   }
+ if (c==EOF) return false;
+ if (c!='H')
+   GError("Error: invalid record type in binary hits file (after hit #%d)!\n",
+               numHits);
+ unsigned char rec[MGBH_HITLEN];
+ if (fread(rec, 1, MGBH_HITLEN, f)!=MGBH_HITLEN)
+   GError("Error: truncated hit record #%d in binary hits file!\n", numHits+1);
+ uint32_t qid=get32(rec);
+ uint32_t hid=get32(rec+16);
+ if (qid>=(uint32_t)names.Count() || hid>=(uint32_t)names.Count())
+   GError("Error: undefined read ID in hit record #%d!\n", numHits+1);
+ hit.qname=names[qid];
+ hit.qlen=(int)get32(rec+4);
+ hit.q5=(int)get32(rec+8);
+ hit.q3=(int)get32(rec+12);
+ hit.hname=names[hid];
+ hit.hlen=(int)get32(rec+20);
+ hit.h5=(int)get32(rec+24);
+ hit.h3=(int)get32(rec+28);
+ uint32_t fv=get32(rec+32);
+ memcpy(&hit.pid, &fv, 4);
+ hit.score=(int)get32(rec+36);
+ uint64_t dv=get64(rec+40);
+ memcpy(&hit.score2, &dv, 8);
+ hit.strand=rec[48];
+ hit.hasGaps=((rec[49] & MGBH_GAPS)!=0);
+ hit.clearGaps();
+ if (hit.hasGaps) {
+   for (int i=0;i<2;i++) {
+     uint32_t n, d, l;
+     if (!readVarint(f, n))
+       GError("Error: truncated gap list in hit record #%d!\n", numHits+1);
+     int pos=0;
+     for (uint32_t j=0;j<n;j++) {
+       if (!readVarint(f, d) || !readVarint(f, l))
+         GError("Error: truncated gap list in hit record #%d!\n", numHits+1);
+       pos+=unzigzag(d);
+       hit.gpos[i].Add(pos);
+       hit.glen[i].Add((int)l);
+       }
+     }
+   }
+ numHits++;
+ return true;
+}
@@ -0,0 +1,82 @@
+#ifndef _GBINHITS_H
+#define _GBINHITS_H
+#include "GBase.h"
+#include "GStr.h"
+#include "GHash.hh"
+#include "GVec.hh"
+
+/* Compact binary form of the mgblast tabulated hits, as written by mgbconv
+   and accepted as input by mblasm, nrcl, tclust and sclust.
+   File header: MGBH_MAGIC (4 bytes) followed by a uint32 format version.
+   Then a stream of records, each starting with a type byte:
+     'N' : varint name length, name bytes -- defines the next read ID (0,1,..)
+     'H' : uint32 qid, int32 qlen, q5, q3,
+           uint32 hid, int32 hlen, h5, h3,
+           float pid, int32 score, double score2, char strand ('+' or '-'),
+           uint8 flags (MGBH_GAPS: the two gap columns were present),
+           then, for each gap column (if present): varint gap count,
+           followed by (zigzag varint position delta, varint gap length) pairs
+   All fixed width values are stored little-endian.
+   The first magic byte is not printable, so a text hits file is never
+   mistaken for a binary one.
+*/
+#define MGBH_MAGIC "\x89MGH"
+#define MGBH_VERSION 1
+#define MGBH_GAPS 0x01
+
+//parse a mgblast gap list like "12+3,45" (1-based positions, lengths)
+bool parseGaps(char* s, GVec<int>& gpos, GVec<int>& glen);
+
+class GBinHit {
+ public:
+  char* qname;
+  int qlen, q5, q3;
+  char* hname;
+  int hlen, h5, h3;
+  float pid;
+  int score;
+  double score2;
+  char strand;
+  bool hasGaps; //gap columns were present (they may still be empty)
+  GVec<int> gpos[2]; //gap positions on query (0) and hit (1)
+  GVec<int> glen[2]; //corresponding gap lengths
+  GBinHit():qname(NULL),qlen(0),q5(0),q3(0),hname(NULL),hlen(0),h5(0),h3(0),
+     pid(0),score(0),score2(0),strand('+'),hasGaps(false) { }
+  void clearGaps() {
+    for (int i=0;i<2;i++) { gpos[i].Clear(); glen[i].Clear(); }
+    }
+  //parse a tabulated mgblast line in place (tabs are replaced by '\0'
+  //and qname/hname point into line); on failure errfld is the bad field
+  bool parseLine(char* line, int& errfld);
+  //rebuild the gap list of query (0) or hit (1) in mgblast notation
+  void gapStr(int idx, GStr& s);
+  //rebuild the whole tabulated line
+  void toLine(GStr& s);
+};
+
+class GBinHitWriter {
+  FILE* f;
+  GHash<int> ids;
+  uint32_t numids;
+  uint32_t nameId(const char* name);
+ public:
+  GBinHitWriter(FILE* fout);
+  ~GBinHitWriter() { ids.Clear(); }
+  void write(GBinHit& h);
+};
+
+class GBinHitReader {
+  FILE* f;
+  GVec<char*> names;
+  char* readName();
+ public:
+  GBinHit hit;
+  int numHits;
+  GBinHitReader(FILE* fin); //reads and checks the header
+  ~GBinHitReader();
+  bool next(); //load the next hit record; false at end of file
+  //check (without consuming anything) if f starts with MGBH_MAGIC
+  static bool isBinary(FILE* f);
+};
+
+#endif
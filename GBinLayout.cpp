@@ -0,0 +1,261 @@
+#include "GBinLayout.h"
+#include "GBinHits.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define GBLY_HDRLEN 24
+
+static void putVarint(GVec<unsigned char>& v, uint32_t x) {
+ unsigned char c;
+ while (x>=0x80) {
+   c=(x & 0x7F) | 0x80;
+   v.Add(c);
+   x>>=7;
+   }
+ c=x;
+ v.Add(c);
+}
+
+static bool getVarint(const unsigned char*& p, const unsigned char* pend, uint32_t& v) {
+ v=0;
+ for (int shift=0;shift<35 && p<pend;shift+=7) {
+   unsigned char c=*p++;
+   v|=((uint32_t)(c & 0x7F))<<shift;
+   if ((c & 0x80)==0) return true;
+   }
+ return false; //malformed
+}
+
+static inline uint32_t zigzag(int v) { return (((uint32_t)v)<<1) ^ (uint32_t)(v>>31); }
+static inline int unzigzag(uint32_t v) { return (int)(v>>1) ^ -(int)(v & 1); }
+
+//--------------------- GBinLayout
+bool GBinLayout::getGaps(int i, GVec<int>* gpos, GVec<int>* glen) {
+ const unsigned char* p=gaps+gapOfs[i];
+ const unsigned char* pend=gaps+gapOfs[i+1];
+ for (int k=0;k<2;k++) {
+   gpos[k].Clear();
+   glen[k].Clear();
+   uint32_t n, d, l;
+   if (!getVarint(p, pend, n)) return false;
+   int pos=0;
+   for (uint32_t j=0;j<n;j++) {
+     if (!getVarint(p, pend, d) || !getVarint(p, pend, l)) return false;
+     pos+=unzigzag(d);
+     gpos[k].Add(pos);
+     glen[k].Add((int)l);
+     }
+   }
+ return (p==pend);
+}
+
+//--------------------- GBinLayoutWriter
+GBinLayoutWriter::GBinLayoutWriter(const char* filename):f(NULL), fname(filename),
+    blocks(), fpos(0), lname(NULL), lseq(NULL) {
+ memset(&hdr, 0, sizeof(hdr));
+ f=fopen(filename, "wb");
+ if (f==NULL) GError("Error creating binary layout file %s!\n", filename);
+ //the actual header is written by close()
+ char buf[GBLY_HDRLEN];
+ memset(buf, 0, GBLY_HDRLEN);
+ writeData(buf, GBLY_HDRLEN);
+}
+
+GBinLayoutWriter::~GBinLayoutWriter() {
+ close();
+}
+
+void GBinLayoutWriter::writeData(const void* p, size_t len) {
+ if (len==0) return;
+ if (fwrite(p, 1, len, f)!=len)
+   GError("Error writing to binary layout file %s!\n", fname.chars());
+ fpos+=len;
+}
+
+void GBinLayoutWriter::beginLayout(const char* name, int lend, int rend, const char* seq) {
+ if (lname!=NULL) endLayout();
+ lname=Gstrdup(name);
+ lseq=(seq==NULL) ? NULL : Gstrdup(seq);
+ memset(&hdr, 0, sizeof(hdr));
+ hdr.lend=lend;
+ hdr.rend=rend;
+ for (int k=0;k<4;k++) rdata[k].Clear();
+ nameOfs.Clear();
+ gapOfs.Clear();
+ strand.Clear();
+ pool.Clear();
+ gpool.Clear();
+ uint32_t z=0;
+ gapOfs.Add(z);
+}
+
+void GBinLayoutWriter::putGaps(char* gstr, int gidx) {
+ gpos[gidx].Clear();
+ glen[gidx].Clear();
+ if (gstr!=NULL && !parseGaps(gstr, gpos[gidx], glen[gidx]))
+   GError("Error: invalid gap list (%s) in layout %s!\n", gstr, lname);
+ putVarint(gpool, gpos[gidx].Count());
+ int prev=0;
+ for (int j=0;j<gpos[gidx].Count();j++) {
+   putVarint(gpool, zigzag(gpos[gidx][j]-prev));
+   putVarint(gpool, glen[gidx][j]);
+   prev=gpos[gidx][j];
+   }
+}
+
+void GBinLayoutWriter::addRead(const char* name, char rstrand, int len, int start,
+                int clipL, int clipR, char* gaps, char* refgaps) {
+ if (lname==NULL)
+   GError("Error: GBinLayoutWriter::addRead() called outside of a layout!\n");
+ int32_t v[4]={start, len, clipL, clipR};
+ for (int k=0;k<4;k++) rdata[k].Add(v[k]);
+ uint32_t nofs=pool.Count();
+ nameOfs.Add(nofs);
+ for (const char* p=name;;p++) {
+   pool.Add(*p);
+   if (*p==0) break; //name pool entries are '\0' terminated
+   }
+ strand.Add(rstrand);
+ putGaps(gaps, 0);
+ putGaps(refgaps, 1);
+ uint32_t gofs=gpool.Count();
+ gapOfs.Add(gofs);
+}
+
+void GBinLayoutWriter::endLayout() {
+ if (lname==NULL) return;
+ int n=rdata[0].Count();
+ hdr.numReads=n;
+ hdr.nameLen=strlen(lname);
+ hdr.seqLen=(lseq==NULL) ? 0 : strlen(lseq);
+ hdr.poolLen=pool.Count();
+ hdr.gapLen=gpool.Count();
+ blocks.Add(fpos);
+ writeData(&hdr, sizeof(hdr));
+ if (n>0) {
+   for (int k=0;k<4;k++) writeData(&(rdata[k][0]), n*sizeof(int32_t));
+   writeData(&(nameOfs[0]), n*sizeof(uint32_t));
+   }
+ writeData(&(gapOfs[0]), (n+1)*sizeof(uint32_t));
+ char pad[8];
+ memset(pad, 0, 8);
+ if (n>0) writeData(&(strand[0]), n);
+ writeData(pad, (4-n%4)%4);
+ writeData(lname, hdr.nameLen+1);
+ if (hdr.seqLen>0) writeData(lseq, hdr.seqLen+1);
+ if (hdr.poolLen>0) writeData(&(pool[0]), hdr.poolLen);
+ if (hdr.gapLen>0) writeData(&(gpool[0]), hdr.gapLen);
+ writeData(pad, (8-fpos%8)%8);
+ GFREE(lname);
+ GFREE(lseq);
+}
+
+void GBinLayoutWriter::close() {
+ if (f==NULL) return;
+ endLayout();
+ int64_t tofs=fpos;
+ if (blocks.Count()>0)
+   writeData(&(blocks[0]), blocks.Count()*sizeof(int64_t));
+ char buf[GBLY_HDRLEN];
+ memcpy(buf, GBLY_MAGIC, 4);
+ uint32_t v[3]={GBLY_VERSION, GBLY_BYTEORDER, (uint32_t)blocks.Count()};
+ memcpy(buf+4, v, 12);
+ memcpy(buf+16, &tofs, 8);
+ if (fseeko(f, 0, SEEK_SET)!=0 || fwrite(buf, 1, GBLY_HDRLEN, f)!=GBLY_HDRLEN)
+   GError("Error writing the header of binary layout file %s!\n", fname.chars());
+ if (fclose(f)!=0)
+   GError("Error closing binary layout file %s!\n", fname.chars());
+ f=NULL;
+ blocks.Clear();
+}
+
+//--------------------- GBinLayoutReader
+bool GBinLayoutReader::isBinary(const char* filename) {
+ FILE* f=fopen(filename, "rb");
+ if (f==NULL) return false;
+ char buf[4];
+ bool r=(fread(buf, 1, 4, f)==4 && memcmp(buf, GBLY_MAGIC, 4)==0);
+ fclose(f);
+ return r;
+}
+
+GBinLayoutReader::GBinLayoutReader(const char* filename):fname(filename), fd(-1),
+    map(NULL), mapLen(0), table(NULL), numLayouts(0) {
+ fd=open(filename, O_RDONLY);
+ if (fd<0) GError("Error: cannot open binary layout file %s!\n", filename);
+ struct stat st;
+ if (fstat(fd, &st)!=0 || st.st_size<GBLY_HDRLEN)
+   GError("Error: invalid binary layout file %s!\n", filename);
+ mapLen=st.st_size;
+ void* m=mmap(NULL, mapLen, PROT_READ, MAP_PRIVATE, fd, 0);
+ if (m==MAP_FAILED) GError("Error: cannot map binary layout file %s!\n", filename);
+ map=(char*)m;
+ if (memcmp(map, GBLY_MAGIC, 4)!=0)
+   GError("Error: invalid binary layout file header (%s)!\n", filename);
+ const uint32_t* h=(const uint32_t*)(map+4);
+ if (h[1]!=GBLY_BYTEORDER)
+   GError("Error: binary layout file %s was written on a system with a "
+          "different byte order!\n", filename);
+ if (h[0]!=GBLY_VERSION)
+   GError("Error: unsupported binary layout format version (%u)!\n", h[0]);
+ numLayouts=h[2];
+ uint64_t tofs=*(const uint64_t*)(map+16);
+ if (tofs<GBLY_HDRLEN || tofs%8!=0 || tofs+numLayouts*sizeof(uint64_t)>mapLen)
+   GError("Error: binary layout file %s is truncated!\n", filename);
+ table=(const uint64_t*)(map+tofs);
+}
+
+GBinLayoutReader::~GBinLayoutReader() {
+ if (map!=NULL) munmap(map, mapLen);
+ if (fd>=0) ::close(fd);
+}
+
+void GBinLayoutReader::getLayout(int i, GBinLayout& l) {
+ if (i<0 || i>=numLayouts)
+   GError("Error: invalid layout index (%d) for %s!\n", i, fname.chars());
+ uint64_t bofs=table[i];
+ uint64_t tofs=(const char*)table-map;
+ if (bofs<GBLY_HDRLEN || bofs%8!=0 || bofs+sizeof(GBinLayoutHdr)>tofs)
+   GError("Error: invalid layout offset in %s!\n", fname.chars());
+ const GBinLayoutHdr* h=(const GBinLayoutHdr*)(map+bofs);
+ uint64_t n=h->numReads;
+ uint64_t blen=sizeof(GBinLayoutHdr)+n*5*sizeof(int32_t)+(n+1)*sizeof(uint32_t)+
+     ((n+3)&~(uint64_t)3)+h->nameLen+1+(h->seqLen>0 ? h->seqLen+1 : 0)+
+     h->poolLen+h->gapLen;
+ if (bofs+blen>tofs)
+   GError("Error: layout #%d extends beyond its block in %s!\n", i+1, fname.chars());
+ const char* p=map+bofs+sizeof(GBinLayoutHdr);
+ l.numReads=n;
+ l.lend=h->lend;
+ l.rend=h->rend;
+ l.start=(const int32_t*)p;
+ p+=n*sizeof(int32_t);
+ l.len=(const int32_t*)p;
+ p+=n*sizeof(int32_t);
+ l.clipL=(const int32_t*)p;
+ p+=n*sizeof(int32_t);
+ l.clipR=(const int32_t*)p;
+ p+=n*sizeof(int32_t);
+ l.nameOfs=(const uint32_t*)p;
+ p+=n*sizeof(uint32_t);
+ l.gapOfs=(const uint32_t*)p;
+ p+=(n+1)*sizeof(uint32_t);
+ l.strand=p;
+ p+=(n+3)&~(uint64_t)3;
+ l.name=p;
+ p+=h->nameLen+1;
+ l.seq=NULL;
+ if (h->seqLen>0) {
+   l.seq=p;
+   p+=h->seqLen+1;
+   }
+ l.names=p;
+ p+=h->poolLen;
+ l.gaps=(const unsigned char*)p;
+ if (l.name[h->nameLen]!=0 || (h->poolLen>0 && l.names[h->poolLen-1]!=0) ||
+        l.gapOfs[n]!=h->gapLen)
+   GError("Error: invalid data in layout #%d of %s!\n", i+1, fname.chars());
+}
@@ -0,0 +1,115 @@
+#ifndef _GBINLAYOUT_H
+#define _GBINLAYOUT_H
+#include "GBase.h"
+#include "GStr.h"
+#include "GVec.hh"
+
+/* Binary columnar form of the layout (.lyt) files, as written by nrcl
+   (-y <file.lytb>) and accepted as input by mblaor.
+   The file is memory mapped by the reader and its arrays are used in
+   place, so all the values are in native byte order (the header has
+   a byte order mark, checked by the reader).
+   File header (24 bytes): GBLY_MAGIC, uint32 version, uint32 byte order
+   mark, uint32 number of layouts, uint64 offset of the layout table.
+   Each layout is a block starting at an 8-byte aligned offset, with a
+   GBinLayoutHdr followed by these arrays (one value for each read):
+     int32 start[], len[], clipL[], clipR[]  -- as the .lyt fields
+     uint32 nameOfs[] -- offset of each read name in the name pool
+     uint32 gapOfs[numReads+1] -- each read's gap data in the gap pool
+     char strand[] ('+' or '-'), padded to 4 bytes
+   then the layout name, the reference sequence (if any) and the name
+   pool, all '\0' terminated, then the gap pool: for each read, the gaps
+   in the read and then the gaps in the reference, each as a varint
+   count followed by (zigzag varint position delta, varint length) pairs.
+   The layout table at the end of the file has the uint64 offset of each
+   layout block, so layouts can be accessed (e.g. by different threads)
+   independently.
+*/
+#define GBLY_MAGIC "\x89LYB"
+#define GBLY_VERSION 1
+#define GBLY_BYTEORDER 0x01020304
+
+struct GBinLayoutHdr {
+  uint32_t numReads;
+  int32_t lend; //layout start and end coordinates
+  int32_t rend;
+  uint32_t nameLen; //layout name length
+  uint32_t seqLen; //reference sequence length (0 if not given)
+  uint32_t poolLen; //size of the read name pool
+  uint32_t gapLen; //size of the gap pool
+  uint32_t reserved;
+};
+
+//a layout in a mapped file; all the pointers are into the mapping
+class GBinLayout {
+ public:
+  const char* name;
+  const char* seq; //reference sequence, NULL if not given
+  int numReads;
+  int lend;
+  int rend;
+  const int32_t* start; //1-based, as in the .lyt read lines
+  const int32_t* len;
+  const int32_t* clipL;
+  const int32_t* clipR;
+  const uint32_t* nameOfs;
+  const uint32_t* gapOfs;
+  const char* strand;
+  const char* names;
+  const unsigned char* gaps;
+  GBinLayout():name(NULL), seq(NULL), numReads(0), lend(0), rend(0),
+    start(NULL), len(NULL), clipL(NULL), clipR(NULL), nameOfs(NULL),
+    gapOfs(NULL), strand(NULL), names(NULL), gaps(NULL) { }
+  const char* readName(int i) { return names+nameOfs[i]; }
+  //decode the gaps of read i: gpos/glen[0] for the read, [1] for the
+  //reference; positions are 1-based, as in the mgblast gap lists
+  bool getGaps(int i, GVec<int>* gpos, GVec<int>* glen);
+};
+
+class GBinLayoutWriter {
+  FILE* f;
+  GStr fname;
+  GVec<int64_t> blocks; //layout offsets
+  int64_t fpos;
+  //current layout
+  GBinLayoutHdr hdr;
+  char* lname;
+  char* lseq;
+  GVec<int32_t> rdata[4]; //start, len, clipL, clipR
+  GVec<uint32_t> nameOfs;
+  GVec<uint32_t> gapOfs;
+  GVec<char> strand;
+  GVec<char> pool;
+  GVec<unsigned char> gpool;
+  GVec<int> gpos[2];
+  GVec<int> glen[2];
+  void putGaps(char* gstr, int gidx);
+  void writeData(const void* p, size_t len);
+ public:
+  GBinLayoutWriter(const char* filename);
+  ~GBinLayoutWriter();
+  void beginLayout(const char* name, int lend, int rend, const char* seq=NULL);
+  //gaps and refgaps are mgblast gap lists (e.g. "12+3,45"), or NULL
+  void addRead(const char* name, char strand, int len, int start,
+                int clipL, int clipR, char* gaps=NULL, char* refgaps=NULL);
+  void endLayout();
+  void close(); //write the layout table and update the header
+};
+
+class GBinLayoutReader {
+  GStr fname;
+  int fd;
+  char* map;
+  size_t mapLen;
+  const uint64_t* table;
+ public:
+  int numLayouts;
+  GBinLayoutReader(const char* filename); //maps the file, checks the header
+  ~GBinLayoutReader();
+  //set l to the i-th layout (0-based); safe to call from multiple threads
+  void getLayout(int i, GBinLayout& l);
+  //check if the file starts with GBLY_MAGIC
+  static bool isBinary(const char* filename);
+};
+
+#endif
@@ -0,0 +1,437 @@
+#include "GCompress.h"
+#include "GThreads.h"
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define ZF_BUFSIZE 262144
+#define BGZF_BLOCK 0xff00 //uncompressed data per BGZF block
+#define BGZF_MAXBLOCK 65536 //maximum size of a compressed BGZF block
+#define BGZF_HDRLEN 18
+#define BGZF_MAXTHREADS 8
+
+enum ZFormat { zfPlain=0, zfGzip, zfZstd };
+
+//a helper thread attached to a public FILE*
+struct ZStream {
+  FILE* pub; //handle given to the caller
+  FILE* file; //the compressed file on the other side
+  int fd; //our end of the pipe
+  ZFormat fmt;
+  unsigned char magic[2]; //bytes consumed by the format detection
+  int nthreads;
+  GThread* thread;
+  ZStream* next;
+};
+
+static ZStream* zstreams=NULL;
+static GFastMutex zstreamsMutex;
+
+static void zfRegister(ZStream* z) {
+  GLockGuard<GFastMutex> lock(zstreamsMutex);
+  z->next=zstreams;
+  zstreams=z;
+}
+
+static ZStream* zfUnregister(FILE* f) {
+  GLockGuard<GFastMutex> lock(zstreamsMutex);
+  ZStream* prev=NULL;
+  for (ZStream* z=zstreams;z!=NULL;z=z->next) {
+    if (z->pub==f) {
+      if (prev==NULL) zstreams=z->next;
+                 else prev->next=z->next;
+      return z;
+      }
+    prev=z;
+    }
+  return NULL;
+}
+
+bool zfIsCompressed(FILE* f) {
+  GLockGuard<GFastMutex> lock(zstreamsMutex);
+  for (ZStream* z=zstreams;z!=NULL;z=z->next)
+    if (z->pub==f) return (z->fmt!=zfPlain);
+  return false;
+}
+
+//write all of buf to fd; false if the other end went away
+static bool writeAll(int fd, const char* buf, size_t len) {
+  while (len>0) {
+    ssize_t w=write(fd, buf, len);
+    if (w<0) {
+      if (errno==EINTR) continue;
+      return false;
+      }
+    buf+=w;
+    len-=w;
+    }
+  return true;
+}
+
+//read up to len bytes, unless EOF comes first
+static size_t readFull(int fd, char* buf, size_t len) {
+  size_t n=0;
+  while (n<len) {
+    ssize_t r=read(fd, buf+n, len-n);
+    if (r<0) {
+      if (errno==EINTR) continue;
+      GError("Error reading from the compression pipe!\n");
+      }
+    if (r==0) break;
+    n+=r;
+    }
+  return n;
+}
+
+//---------------------- decompression
+static void inflateThread(void* p) {
+  ZStream* z=(ZStream*)p;
+  unsigned char* inbuf=NULL;
+  unsigned char* outbuf=NULL;
+  GMALLOC(inbuf, ZF_BUFSIZE);
+  GMALLOC(outbuf, ZF_BUFSIZE);
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, 15+32)!=Z_OK) //gzip or zlib header
+    GError("Error initializing zlib decompression!\n");
+  bool open=true; //reader still there
+  bool streamEnd=false;
+  memcpy(inbuf, z->magic, 2);
+  zs.next_in=inbuf;
+  zs.avail_in=2+fread(inbuf+2, 1, ZF_BUFSIZE-2, z->file);
+  while (open) {
+    if (zs.avail_in==0) {
+      zs.avail_in=fread(inbuf, 1, ZF_BUFSIZE, z->file);
+      zs.next_in=inbuf;
+      if (zs.avail_in==0) break;
+      }
+    if (streamEnd) { //another gzip member follows (e.g. BGZF)
+      inflateReset(&zs);
+      streamEnd=false;
+      }
+    zs.next_out=outbuf;
+    zs.avail_out=ZF_BUFSIZE;
+    int r=inflate(&zs, Z_NO_FLUSH);
+    if (r!=Z_OK && r!=Z_STREAM_END && r!=Z_BUF_ERROR)
+      GError("Error decompressing gzip data (%s)!\n", zs.msg ? zs.msg : "corrupt input");
+    if (r==Z_STREAM_END) streamEnd=true;
+    open=writeAll(z->fd, (const char*)outbuf, ZF_BUFSIZE-zs.avail_out);
+    }
+  if (open && !streamEnd && zs.total_in>0)
+    GError("Error: truncated gzip input!\n");
+  inflateEnd(&zs);
+  GFREE(inbuf);
+  GFREE(outbuf);
+  close(z->fd);
+}
+
+#ifdef HAVE_ZSTD
+static void zstdThread(void* p) {
+  ZStream* z=(ZStream*)p;
+  size_t inlen=ZSTD_DStreamInSize();
+  size_t outlen=ZSTD_DStreamOutSize();
+  char* inbuf=NULL;
+  char* outbuf=NULL;
+  GMALLOC(inbuf, inlen);
+  GMALLOC(outbuf, outlen);
+  ZSTD_DStream* zds=ZSTD_createDStream();
+  ZSTD_initDStream(zds);
+  bool open=true;
+  size_t r=0;
+  memcpy(inbuf, z->magic, 2);
+  size_t n=2+fread(inbuf+2, 1, inlen-2, z->file);
+  while (open && n>0) {
+    ZSTD_inBuffer in={ inbuf, n, 0 };
+    while (open && in.pos<in.size) {
+      ZSTD_outBuffer out={ outbuf, outlen, 0 };
+      r=ZSTD_decompressStream(zds, &out, &in);
+      if (ZSTD_isError(r))
+        GError("Error decompressing zstd data (%s)!\n", ZSTD_getErrorName(r));
+      open=writeAll(z->fd, outbuf, out.pos);
+      }
+    n=fread(inbuf, 1, inlen, z->file);
+    }
+  ZSTD_freeDStream(zds);
+  GFREE(inbuf);
+  GFREE(outbuf);
+  close(z->fd);
+}
+#endif
+
+//check the magic bytes; for compressed data they are consumed (into magic)
+static ZFormat detectFormat(FILE* f, unsigned char* magic) {
+  int c1=getc(f);
+  if (c1==EOF) return zfPlain;
+  if (c1!=0x1f && c1!=0x28) {
+    ungetc(c1, f);
+    return zfPlain;
+    }
+  int c2=getc(f);
+  magic[0]=c1;
+  magic[1]=c2;
+  if (c1==0x1f && c2==0x8b) return zfGzip;
+  if (c1==0x28 && c2==0xb5) return zfZstd; //the rest is checked by zstd
+  //not compressed after all; glibc can push back both chars
+  if (c2!=EOF) ungetc(c2, f);
+  if (ungetc(c1, f)==EOF)
+    GError("Error: cannot peek at the input stream!\n");
+  return zfPlain;
+}
+
+FILE* zfwrapRead(FILE* f) {
+  if (f==NULL) return NULL;
+  unsigned char magic[2];
+  ZFormat fmt=detectFormat(f, magic);
+  if (fmt==zfPlain) return f;
+#ifndef HAVE_ZSTD
+  if (fmt==zfZstd)
+    GError("Error: zstd compressed input found but zstd support was not built in!\n");
+#endif
+  int pfd[2];
+  if (pipe(pfd)!=0) GError("Error creating decompression pipe!\n");
+  signal(SIGPIPE, SIG_IGN); //the reader may stop early
+  ZStream* z=new ZStream;
+  z->file=f;
+  z->fd=pfd[1];
+  z->fmt=fmt;
+  memcpy(z->magic, magic, 2);
+  z->nthreads=1;
+  z->pub=fdopen(pfd[0], "r");
+  if (z->pub==NULL) GError("Error opening decompression pipe!\n");
+  zfRegister(z);
+#ifdef HAVE_ZSTD
+  if (fmt==zfZstd) z->thread=new GThread(zstdThread, z);
+  else
+#endif
+  z->thread=new GThread(inflateThread, z);
+  return z->pub;
+}
+
+FILE* zfopenRead(const char* fname) {
+  FILE* f=fopen(fname, "rb");
+  if (f==NULL) return NULL;
+  return zfwrapRead(f);
+}
+
+//---------------------- BGZF compression
+static inline void put16le(unsigned char* p, uint v) {
+  p[0]=v & 0xFF; p[1]=(v>>8) & 0xFF;
+}
+static inline void put32le(unsigned char* p, uint v) {
+  p[0]=v & 0xFF; p[1]=(v>>8) & 0xFF; p[2]=(v>>16) & 0xFF; p[3]=(v>>24) & 0xFF;
+}
+
+static const unsigned char bgzfEOF[28]={
+  0x1f,0x8b,0x08,0x04,0,0,0,0,0,0xff,0x06,0,0x42,0x43,0x02,0,
+  0x1b,0,0x03,0,0,0,0,0,0,0,0,0 };
+
+enum BGZFStatus { bgzfFree=0, bgzfFilled, bgzfDone };
+
+struct BGZFBlock {
+  char* data;
+  int len; //uncompressed data length
+  unsigned char* out;
+  int outlen;
+  BGZFStatus status;
+};
+
+/* The compression of a BGZF stream: the helper thread (deflateThread())
+   reads the data into a ring of 2*nthreads blocks, block k going into
+   slot k % numSlots once that slot is free again; the worker threads take
+   the blocks in order, compress them, and whichever worker completes the
+   next block to be written also writes it (and any completed ones after
+   it), so reading, compressing and writing all overlap.
+*/
+struct BGZFPool {
+  ZStream* z;
+  BGZFBlock* slots;
+  int numSlots;
+  int64 numFilled; //blocks read so far
+  int64 nextTake; //next block to be compressed
+  int64 nextOut; //next block to be written
+  bool more; //more blocks may come
+  GFastMutex mutex; //for the counters above and the block status
+  GConditionVar haveWork; //signals filled blocks or the end of input
+  GConditionVar haveFree; //signals written (free) slots
+  GFastMutex writeMutex; //for writing (and advancing nextOut)
+};
+
+//compress one block into a complete BGZF member
+static void bgzfCompress(BGZFBlock& b) {
+  int level=Z_DEFAULT_COMPRESSION;
+  for (;;) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+      GError("Error initializing zlib compression!\n");
+    zs.next_in=(Bytef*)b.data;
+    zs.avail_in=b.len;
+    zs.next_out=b.out+BGZF_HDRLEN;
+    zs.avail_out=BGZF_MAXBLOCK-BGZF_HDRLEN-8;
+    int r=deflate(&zs, Z_FINISH);
+    int clen=zs.total_out;
+    deflateEnd(&zs);
+    if (r!=Z_STREAM_END) {
+      //incompressible data; stored blocks always fit
+      if (level==Z_NO_COMPRESSION) GError("Error compressing BGZF block!\n");
+      level=Z_NO_COMPRESSION;
+      continue;
+      }
+    unsigned char* h=b.out;
+    h[0]=0x1f; h[1]=0x8b; h[2]=8; h[3]=4; //gzip, FEXTRA
+    put32le(h+4, 0); //mtime
+    h[8]=0; h[9]=0xff; //xfl, OS
+    put16le(h+10, 6); //XLEN
+    h[12]='B'; h[13]='C';
+    put16le(h+14, 2);
+    b.outlen=BGZF_HDRLEN+clen+8;
+    put16le(h+16, b.outlen-1);
+    uLong crc=crc32(crc32(0L, Z_NULL, 0), (Bytef*)b.data, b.len);
+    put32le(b.out+BGZF_HDRLEN+clen, crc);
+    put32le(b.out+BGZF_HDRLEN+clen+4, b.len);
+    return;
+    }
+}
+
+//write the completed blocks which are next in order, freeing their slots
+static void bgzfFlush(BGZFPool& bp) {
+  GLockGuard<GFastMutex> wlock(bp.writeMutex);
+  while (true) {
+    bp.mutex.lock();
+    BGZFBlock& b=bp.slots[bp.nextOut % bp.numSlots];
+    bool ready=(b.status==bgzfDone);
+    bp.mutex.unlock();
+    if (!ready) break;
+    if (fwrite(b.out, 1, b.outlen, bp.z->file)!=(size_t)b.outlen)
+      GError("Error writing compressed output!\n");
+    bp.mutex.lock();
+    b.status=bgzfFree;
+    bp.nextOut++;
+    bp.mutex.unlock();
+    bp.haveFree.notify_one();
+    }
+}
+
+static void bgzfWorker(void* p) {
+  BGZFPool& bp=*(BGZFPool*)p;
+  while (true) {
+    bp.mutex.lock();
+    while (bp.nextTake==bp.numFilled && bp.more)
+      bp.haveWork.wait(bp.mutex);
+    if (bp.nextTake==bp.numFilled) { //no more blocks
+      bp.mutex.unlock();
+      break;
+      }
+    BGZFBlock& b=bp.slots[bp.nextTake % bp.numSlots];
+    bp.nextTake++;
+    bp.mutex.unlock();
+    bgzfCompress(b);
+    bp.mutex.lock();
+    b.status=bgzfDone;
+    bp.mutex.unlock();
+    bgzfFlush(bp);
+    }
+}
+
+static void deflateThread(void* p) {
+  ZStream* z=(ZStream*)p;
+  BGZFPool* bp=new BGZFPool;
+  bp->z=z;
+  bp->numSlots=2*z->nthreads;
+  bp->numFilled=0;
+  bp->nextTake=0;
+  bp->nextOut=0;
+  bp->more=true;
+  GMALLOC(bp->slots, bp->numSlots*sizeof(BGZFBlock));
+  for (int i=0;i<bp->numSlots;i++) {
+    GMALLOC(bp->slots[i].data, BGZF_BLOCK);
+    GMALLOC(bp->slots[i].out, BGZF_MAXBLOCK);
+    bp->slots[i].status=bgzfFree;
+    }
+  GThread** workers=NULL;
+  GMALLOC(workers, z->nthreads*sizeof(GThread*));
+  for (int i=0;i<z->nthreads;i++)
+    workers[i]=new GThread(bgzfWorker, bp);
+  for (int64 k=0;;k++) {
+    BGZFBlock& b=bp->slots[k % bp->numSlots];
+    bp->mutex.lock();
+    while (b.status!=bgzfFree)
+      bp->haveFree.wait(bp->mutex);
+    bp->mutex.unlock();
+    //only this thread uses a free slot
+    int len=readFull(z->fd, b.data, BGZF_BLOCK);
+    if (len>0) {
+      b.len=len;
+      bp->mutex.lock();
+      b.status=bgzfFilled;
+      bp->numFilled++;
+      bp->mutex.unlock();
+      bp->haveWork.notify_one();
+      }
+    if (len<BGZF_BLOCK) break;
+    }
+  bp->mutex.lock();
+  bp->more=false;
+  bp->mutex.unlock();
+  bp->haveWork.notify_all();
+  for (int i=0;i<z->nthreads;i++) {
+    workers[i]->join();
+    delete workers[i];
+    }
+  GFREE(workers);
+  //all the blocks were written by the workers
+  if (fwrite(bgzfEOF, 1, 28, z->file)!=28 || fclose(z->file)!=0)
+    GError("Error writing compressed output!\n");
+  z->file=NULL;
+  for (int i=0;i<bp->numSlots;i++) {
+    GFREE(bp->slots[i].data);
+    GFREE(bp->slots[i].out);
+    }
+  GFREE(bp->slots);
+  delete bp;
+  close(z->fd);
+}
+
+FILE* zfopenWrite(const char* fname, int threads) {
+  if (!endsWith(fname, ".gz") && !endsWith(fname, ".bgz"))
+    return fopen(fname, "w");
+  return zfopenBGZF(fname, threads);
+}
+
+FILE* zfopenBGZF(const char* fname, int threads) {
+  FILE* f=fopen(fname, "wb");
+  if (f==NULL) return NULL;
+  if (threads<=0) {
+    threads=GThread::hardware_concurrency();
+    if (threads<1) threads=1;
+    if (threads>BGZF_MAXTHREADS) threads=BGZF_MAXTHREADS;
+    }
+  int pfd[2];
+  if (pipe(pfd)!=0) GError("Error creating compression pipe!\n");
+  ZStream* z=new ZStream;
+  z->file=f;
+  z->fd=pfd[0];
+  z->fmt=zfGzip;
+  z->nthreads=threads;
+  z->pub=fdopen(pfd[1], "w");
+  if (z->pub==NULL) GError("Error opening compression pipe!\n");
+  zfRegister(z);
+  z->thread=new GThread(deflateThread, z);
+  return z->pub;
+}
+
+int zfclose(FILE* f) {
+  if (f==NULL) return EOF;
+  ZStream* z=zfUnregister(f);
+  if (z==NULL) return fclose(f);
+  int r=fclose(f); //the helper thread sees EOF (or EPIPE) now
+  z->thread->join();
+  delete z->thread;
+  if (z->file!=NULL && z->file!=stdin) fclose(z->file);
+  delete z;
+  return r;
+}
@@ -0,0 +1,32 @@
+#ifndef _GCOMPRESS_H
+#define _GCOMPRESS_H
+#include "GBase.h"
+
+/* Transparent compressed streams, as plain FILE* handles.
+   Input: gzip (incl. BGZF and multi-member files) and, when built with
+   HAVE_ZSTD, zstd compressed data are recognized by their magic bytes and
+   decompressed by a separate thread into a pipe, so the returned FILE* can
+   be read with GLineReader, fgetline(), fgets() etc.; uncompressed input
+   is returned as is.
+   Output: files named *.gz or *.bgz are written as BGZF (blocked gzip,
+   readable by zcat/gzip and seekable by bgzip-aware tools); the data
+   written to the returned FILE* is compressed in 64K blocks by a pool of
+   threads and written in order.
+   Such streams must be closed with zfclose() so the helper thread can
+   finish; zfclose() is a plain fclose() for any other FILE*.
+*/
+
+//open a file for reading, decompressing it if needed
+FILE* zfopenRead(const char* fname);
+//wrap an already open input (e.g. stdin), if it turns out compressed
+FILE* zfwrapRead(FILE* f);
+//create a file for writing, BGZF compressed if its name ends in .gz/.bgz;
+//threads<=0 means one per CPU, at most 8
+FILE* zfopenWrite(const char* fname, int threads=0);
+//create a BGZF compressed file regardless of its name (e.g. for BAM output)
+FILE* zfopenBGZF(const char* fname, int threads=0);
+//true if f was returned by zfopenRead/zfwrapRead for compressed data
+bool zfIsCompressed(FILE* f);
+int zfclose(FILE* f);
+
+#endif
@@ -0,0 +1,122 @@
+#include "GDepthCap.h"
+
+//FNV-1a of the name, finalized with the seed (splitmix64)
+static uint64 readPriority(const char* name, uint64 seed) {
+ uint64 h=14695981039346656037ULL;
+ for (const char* p=name;*p!=0;p++) {
+   h^=(unsigned char)*p;
+   h*=1099511628211ULL;
+   }
+ h+=seed+0x9E3779B97F4A7C15ULL;
+ h=(h^(h>>30))*0xBF58476D1CE4E5B9ULL;
+ h=(h^(h>>27))*0x94D049BB133111EBULL;
+ return h^(h>>31);
+}
+
+static int cmpDepthSpans(const void* p1, const void* p2) {
+ const GDepthSpan* s1=(const GDepthSpan*)p1;
+ const GDepthSpan* s2=(const GDepthSpan*)p2;
+ if (s1->prio!=s2->prio) return (s1->prio<s2->prio) ? -1 : 1;
+ return (s1->idx<s2->idx) ? -1 : ((s1->idx>s2->idx) ? 1 : 0);
+}
+
+void GDepthCap::add(const char* name, int start, int end) {
+ GDepthSpan s;
+ s.prio=readPriority(name, seed);
+ s.start=start;
+ s.end=end;
+ s.idx=spans.Count();
+ if (s.idx==0 || start<minpos) minpos=start;
+ if (s.idx==0 || end>maxpos) maxpos=end;
+ spans.Add(s);
+}
+
+int GDepthCap::spanMax(int node, int l, int r, int qs, int qe) {
+ if (qe<l || qs>r) return 0;
+ if (qs<=l && r<=qe) return tmax[node];
+ int m=(l+r)/2;
+ int a=spanMax(2*node, l, m, qs, qe);
+ int b=spanMax(2*node+1, m+1, r, qs, qe);
+ return tadd[node]+GMAX(a,b);
+}
+
+void GDepthCap::spanAdd(int node, int l, int r, int qs, int qe) {
+ if (qe<l || qs>r) return;
+ if (qs<=l && r<=qe) {
+   tadd[node]++;
+   tmax[node]++;
+   return;
+   }
+ int m=(l+r)/2;
+ spanAdd(2*node, l, m, qs, qe);
+ spanAdd(2*node+1, m+1, r, qs, qe);
+ tmax[node]=tadd[node]+GMAX(tmax[2*node], tmax[2*node+1]);
+}
+
+int GDepthCap::select(GVec<bool>& keep) {
+ int n=spans.Count();
+ keep.Clear();
+ for (int i=0;i<n;i++) keep.Add(true);
+ if (maxDepth<=0 || n<=maxDepth) return 0;
+ //quick check of the actual peak depth first
+ int len=maxpos-minpos+1;
+ int* diff=NULL;
+ GCALLOC(diff, (len+1)*sizeof(int));
+ for (int i=0;i<n;i++) {
+   diff[spans[i].start-minpos]++;
+   diff[spans[i].end-minpos+1]--;
+   }
+ int d=0, peak=0;
+ for (int i=0;i<len;i++) {
+   d+=diff[i];
+   if (d>peak) peak=d;
+   }
+ GFREE(diff);
+ if (peak<=maxDepth) return 0;
+ GDepthSpan* sorted=NULL;
+ GMALLOC(sorted, n*sizeof(GDepthSpan));
+ memcpy(sorted, &(spans[0]), n*sizeof(GDepthSpan));
+ qsort(sorted, n, sizeof(GDepthSpan), cmpDepthSpans);
+ tsize=1;
+ while (tsize<len) tsize<<=1;
+ GFREE(tmax);
+ GFREE(tadd);
+ GCALLOC(tmax, 2*tsize*sizeof(int));
+ GCALLOC(tadd, 2*tsize*sizeof(int));
+ int dropped=0;
+ for (int i=0;i<n;i++) {
+   int s=sorted[i].start-minpos;
+   int e=sorted[i].end-minpos;
+   if (spanMax(1, 0, tsize-1, s, e)<maxDepth)
+     spanAdd(1, 0, tsize-1, s, e);
+   else {
+     keep[sorted[i].idx]=false;
+     dropped++;
+     }
+   }
+ GFREE(tmax);
+ GFREE(tadd);
+ if (dropped>0) { //take back the reads needed to avoid coverage holes
+   int* cov=NULL;
+   GCALLOC(cov, len*sizeof(int));
+   for (int i=0;i<n;i++) {
+     if (!keep[spans[i].idx]) continue;
+     for (int p=spans[i].start-minpos;p<=spans[i].end-minpos;p++) cov[p]++;
+     }
+   for (int i=0;i<n;i++) {
+     if (keep[sorted[i].idx]) continue;
+     int s=sorted[i].start-minpos;
+     int e=sorted[i].end-minpos;
+     bool hole=false;
+     for (int p=s;p<=e;p++)
+       if (cov[p]==0) { hole=true; break; }
+     if (!hole) continue;
+     for (int p=s;p<=e;p++) cov[p]++;
+     keep[sorted[i].idx]=true;
+     dropped--;
+     }
+   GFREE(cov);
+   }
+ GFREE(sorted);
+ return dropped;
+}
@@ -0,0 +1,46 @@
+#ifndef _GDEPTHCAP_H
+#define _GDEPTHCAP_H
+#include "GBase.h"
+#include "GVec.hh"
+
+/* Deterministic depth capping for ultra-deep regions: given the spans of
+   a set of reads (e.g. a bundle, or a layout), selects a subset such that
+   at most maxDepth of them cover any position.
+   Each read gets a pseudo-random priority from a hash of its name and a
+   seed, and reads are accepted in priority order as long as they do not
+   push the depth of any position in their span over maxDepth. Dropped
+   reads which would be the only ones covering some positions are then
+   taken back (in the same order), so a contiguous layout stays contiguous.
+   The result only depends on the read names, spans and seed (not on the
+   input order, or on the number of threads).
+*/
+
+struct GDepthSpan {
+  uint64 prio;
+  int start; //1-based, inclusive
+  int end;
+  int idx; //order of addition
+};
+
+class GDepthCap {
+  GVec<GDepthSpan> spans;
+  int minpos, maxpos;
+  int* tmax; //segment tree: max depth in each node's range
+  int* tadd; //pending depth added to each node's range
+  int tsize;
+  int spanMax(int node, int l, int r, int qs, int qe);
+  void spanAdd(int node, int l, int r, int qs, int qe);
+ public:
+  int maxDepth;
+  uint64 seed;
+  GDepthCap(int maxdepth=0, uint64 hseed=0):spans(), minpos(0), maxpos(0),
+      tmax(NULL), tadd(NULL), tsize(0), maxDepth(maxdepth), seed(hseed) { }
+  ~GDepthCap() { GFREE(tmax); GFREE(tadd); }
+  void add(const char* name, int start, int end);
+  int count() { return spans.Count(); }
+  //keep[i] is set for the i-th read added; returns the number of reads dropped
+  int select(GVec<bool>& keep);
+  void clear() { spans.Clear(); minpos=0; maxpos=0; }
+};
+
+#endif
@@ -0,0 +1,390 @@
+#include "GHitSort.h"
+#include "GThreads.h"
+#include "GCompress.h"
+#include <unistd.h>
+#include <fcntl.h>
+
+#define HITSCAN_BLOCK 4194304 //input scanning block size
+#define HITRUN_BUF 8192 //keys buffered for each run during the merge
+
+bool hitLineScore(const char* line, int len, int& score) {
+ const char* p=line;
+ const char* pend=line+len;
+ int tabs=0;
+ while (p<pend && tabs<9) {
+   if (*p=='\t') tabs++;
+   p++;
+   }
+ if (tabs<9 || p>=pend) return false;
+ char* endp=NULL;
+ double v=strtod(p, &endp);
+ if (endp==p) return false;
+ score=(int)v;
+ return true;
+}
+
+//descending score, then input order
+static int cmpHitKeys(const void* p1, const void* p2) {
+ const GHitKey* k1=(const GHitKey*)p1;
+ const GHitKey* k2=(const GHitKey*)p2;
+ if (k1->score!=k2->score) return (k1->score>k2->score) ? -1 : 1;
+ if (k1->fidx!=k2->fidx) return (k1->fidx<k2->fidx) ? -1 : 1;
+ if (k1->fpos!=k2->fpos) return (k1->fpos<k2->fpos) ? -1 : 1;
+ return 0;
+}
+
+static FILE* tmpRunFile() {
+ const char* tdir=getenv("TMPDIR");
+ if (tdir==NULL || *tdir==0) tdir="/tmp";
+ GStr fname(tdir);
+ fname+="/mblhits.XXXXXX";
+ char* tname=Gstrdup(fname.chars());
+ int fd=mkstemp(tname);
+ if (fd<0) GError("Error creating temporary file %s!\n", tname);
+ unlink(tname); //gone as soon as it is closed
+ GFREE(tname);
+ FILE* f=fdopen(fd, "w+b");
+ if (f==NULL) GError("Error opening temporary sort file!\n");
+ return f;
+}
+
+//a sorted batch of keys, either kept in memory or spilled to a temp file
+class GHitRun {
+ public:
+  FILE* f;
+  GHitKey* keys;
+  int count; //keys currently loaded
+  int pos;
+  GHitRun(GHitKey* k, int n, bool spill):f(NULL), keys(k), count(n), pos(0) {
+    if (spill) f=tmpRunFile();
+    }
+  ~GHitRun() {
+    GFREE(keys);
+    if (f!=NULL) fclose(f);
+    }
+  void sortKeys() {
+    qsort(keys, count, sizeof(GHitKey), cmpHitKeys);
+    if (f==NULL) return;
+    if ((int)fwrite(keys, sizeof(GHitKey), count, f)!=count)
+      GError("Error writing temporary sort file!\n");
+    fflush(f);
+    rewind(f);
+    //only a small buffer is kept for the merge
+    GFREE(keys);
+    GMALLOC(keys, HITRUN_BUF*sizeof(GHitKey));
+    count=0;
+    load();
+    }
+  bool load() {
+    pos=0;
+    count=0;
+    if (f!=NULL)
+      count=fread(keys, sizeof(GHitKey), HITRUN_BUF, f);
+    return (count>0);
+    }
+  GHitKey* current() { return (pos<count) ? &keys[pos] : NULL; }
+  bool advance() {
+    pos++;
+    if (pos<count) return true;
+    return load();
+    }
+};
+
+struct GHitSortJob {
+  GHitRun* run;
+  GThread* thread;
+};
+
+static void sortRunThread(void* p) {
+ ((GHitSortJob*)p)->run->sortKeys();
+}
+
+//------------------------------------------------
+GHitSorter::GHitSorter(int threads, int memMB):fnames(), fds(), numThreads(threads),
+      maxKeys(0), runs(), heap(), lbuf(NULL), lcap(0), numLines(0) {
+ if (numThreads<1) numThreads=1;
+ if (memMB<1) memMB=1;
+ //one batch is being filled while the others are sorted
+ int64 nk=((int64)memMB*1048576)/((int64)sizeof(GHitKey)*(numThreads+1));
+ maxKeys=(nk>INT_MAX) ? INT_MAX : (int)nk;
+ if (maxKeys<1024) maxKeys=1024;
+ lcap=1024;
+ GMALLOC(lbuf, lcap);
+}
+
+GHitSorter::~GHitSorter() {
+ for (int i=0;i<runs.Count();i++) delete runs[i];
+ for (int i=0;i<fds.Count();i++) close(fds[i]);
+ for (int i=0;i<fnames.Count();i++) GFREE(fnames[i]);
+ GFREE(lbuf);
+}
+
+void GHitSorter::addFile(const char* fname) {
+ FILE* f=zfopenRead(fname);
+ if (f==NULL) GError("Cannot open input file %s!\n", fname);
+ int fd;
+ if (zfIsCompressed(f)) {
+   //lines are read back by offset, so decompress into a temporary file
+   FILE* t=tmpRunFile();
+   char* buf=NULL;
+   GMALLOC(buf, HITSCAN_BLOCK);
+   size_t n;
+   while ((n=fread(buf, 1, HITSCAN_BLOCK, f))>0)
+     if (fwrite(buf, 1, n, t)!=n) GError("Error writing temporary sort file!\n");
+   GFREE(buf);
+   fflush(t);
+   fd=dup(fileno(t));
+   fclose(t);
+   lseek(fd, 0, SEEK_SET);
+   }
+ else {
+   fd=open(fname, O_RDONLY);
+   if (fd<0) GError("Cannot open input file %s!\n", fname);
+   }
+ zfclose(f);
+ fnames.Add(Gstrdup(fname));
+ fds.Add(fd);
+}
+
+void GHitSorter::flushKeys(GHitKey*& keys, int& nkeys, GVec<void*>& jobs, bool last) {
+ if (nkeys==0) return;
+ //the last batch is merged directly from memory
+ GHitRun* run=new GHitRun(keys, nkeys, !last);
+ runs.Add(run);
+ keys=NULL;
+ nkeys=0;
+ if (last || numThreads==1) {
+   run->sortKeys();
+   return;
+   }
+ if (jobs.Count()>=numThreads) { //wait for the oldest batch
+   GHitSortJob* job=(GHitSortJob*)jobs[0];
+   job->thread->join();
+   delete job->thread;
+   delete job;
+   jobs.Delete(0);
+   }
+ GHitSortJob* job=new GHitSortJob;
+ job->run=run;
+ job->thread=new GThread(sortRunThread, job);
+ jobs.Add((void*)job);
+}
+
+void GHitSorter::scanFile(int fidx, GHitKey*& keys, int& nkeys, GVec<void*>& jobs) {
+ int fd=fds[fidx];
+ int bcap=HITSCAN_BLOCK;
+ char* buf=NULL;
+ GMALLOC(buf, bcap+1);
+ int blen=0; //bytes in buf
+ int64 bstart=0; //file offset of buf[0]
+ int lineno=0;
+ bool eof=false;
+ while (!eof) {
+   if (blen==bcap) { //a single line longer than the whole block
+     bcap*=2;
+     GREALLOC(buf, bcap+1);
+     }
+   ssize_t r=read(fd, buf+blen, bcap-blen);
+   if (r<0) GError("Error reading file %s!\n", fnames[fidx]);
+   if (r==0) eof=true;
+   blen+=r;
+   buf[blen]=0;
+   int lstart=0;
+   while (lstart<blen) {
+     char* nl=(char*)memchr(buf+lstart, '\n', blen-lstart);
+     if (nl==NULL && !eof) break; //incomplete line
+     int lend=(nl==NULL) ? blen : (int)(nl-buf);
+     int len=lend-lstart;
+     const char* line=buf+lstart;
+     lineno++;
+     if (len>0 && line[len-1]=='\r') len--;
+     if (len>=4 && line[0]!='#') {
+       int score;
+       if (!hitLineScore(line, len, score))
+         GError("Error parsing the score field at line %d of %s!\n",
+                      lineno, fnames[fidx]);
+       if (keys==NULL) GMALLOC(keys, maxKeys*sizeof(GHitKey));
+       GHitKey& k=keys[nkeys];
+       k.fpos=bstart+lstart;
+       k.score=score;
+       k.len=len;
+       k.fidx=fidx;
+       nkeys++;
+       numLines++;
+       if (nkeys==maxKeys) flushKeys(keys, nkeys, jobs, false);
+       }
+     lstart=lend+1;
+     }
+   if (lstart>blen) lstart=blen;
+   //move the incomplete line at the beginning of the buffer
+   if (lstart>0) {
+     memmove(buf, buf+lstart, blen-lstart);
+     blen-=lstart;
+     bstart+=lstart;
+     }
+   }
+ GFREE(buf);
+}
+
+void GHitSorter::sort() {
+ GHitKey* keys=NULL;
+ int nkeys=0;
+ GVec<void*> jobs;
+ for (int i=0;i<fds.Count();i++)
+   scanFile(i, keys, nkeys, jobs);
+ flushKeys(keys, nkeys, jobs, true);
+ GFREE(keys);
+ for (int i=0;i<jobs.Count();i++) {
+   GHitSortJob* job=(GHitSortJob*)jobs[i];
+   job->thread->join();
+   delete job->thread;
+   delete job;
+   }
+ //build the merge heap
+ heap.Clear();
+ for (int i=0;i<runs.Count();i++)
+   if (runs[i]->current()!=NULL) heap.Add(i);
+ for (int i=heap.Count()/2-1;i>=0;i--) siftDown(i);
+}
+
+bool GHitSorter::heapLess(int a, int b) {
+ return (cmpHitKeys(runs[heap[a]]->current(), runs[heap[b]]->current())<0);
+}
+
+void GHitSorter::siftDown(int i) {
+ int n=heap.Count();
+ for (;;) {
+   int m=i;
+   int l=2*i+1;
+   int r=l+1;
+   if (l<n && heapLess(l, m)) m=l;
+   if (r<n && heapLess(r, m)) m=r;
+   if (m==i) return;
+   heap.Exchange(i, m);
+   i=m;
+   }
+}
+
+char* GHitSorter::nextLine(int& len) {
+ if (heap.Count()==0) return NULL;
+ GHitRun* run=runs[heap[0]];
+ GHitKey* k=run->current();
+ len=k->len;
+ if (len+1>lcap) {
+   lcap=len+1;
+   GREALLOC(lbuf, lcap);
+   }
+ if (pread(fds[k->fidx], lbuf, len, k->fpos)!=len)
+   GError("Error reading back a hit line from %s!\n", fnames[k->fidx]);
+ lbuf[len]=0;
+ if (!run->advance()) {
+   heap[0]=heap.Last();
+   heap.Delete(heap.Count()-1);
+   }
+ if (heap.Count()>0) siftDown(0);
+ return lbuf;
+}
+
+//------------------------------------------------
+//buffered reader of a score-sorted hits file
+class GHitFileReader {
+ public:
+  FILE* f;
+  char* fname;
+  int fidx;
+  char* buf;
+  int bufcap;
+  int len; //current line length
+  int score; //current line score
+  int lineno;
+  int numHits;
+  GHitFileReader(const char* name, int idx):f(NULL), fname(Gstrdup(name)),
+        fidx(idx), buf(NULL), bufcap(1024), len(0), score(0), lineno(0), numHits(0) {
+    if ((f=fopen(name, "r"))==NULL)
+      GError("Cannot open input file %s!\n", name);
+    setvbuf(f, NULL, _IOFBF, 1048576);
+    f=zfwrapRead(f);
+    GMALLOC(buf, bufcap);
+    }
+  ~GHitFileReader() {
+    if (f!=NULL) zfclose(f);
+    GFREE(fname);
+    GFREE(buf);
+    }
+  //load the next hit line, checking the score order
+  bool next() {
+    char* line;
+    while ((line=fgetline(buf, bufcap, f, NULL, &len))!=NULL) {
+      lineno++;
+      if (len>0 && line[len-1]=='\r') line[--len]=0;
+      if (len<4 || line[0]=='#') continue;
+      int prevscore=score;
+      if (!hitLineScore(line, len, score))
+        GError("Error parsing the score field at line %d of %s!\n",
+                     lineno, fname);
+      if (numHits>0 && score>prevscore)
+        GError("Error: %s is not sorted by score (line %d)!\n", fname, lineno);
+      numHits++;
+      return true;
+      }
+    return false;
+    }
+};
+
+GHitMerger::~GHitMerger() {
+ for (int i=0;i<readers.Count();i++) delete readers[i];
+}
+
+void GHitMerger::addFile(const char* fname) {
+ GHitFileReader* r=new GHitFileReader(fname, readers.Count());
+ readers.Add(r);
+ if (r->next()) {
+   heap.Add(readers.Count()-1);
+   //sift up the new reader
+   int i=heap.Count()-1;
+   while (i>0 && heapLess(i, (i-1)/2)) {
+     heap.Exchange(i, (i-1)/2);
+     i=(i-1)/2;
+     }
+   }
+}
+
+//higher score first, then by file order
+bool GHitMerger::heapLess(int a, int b) {
+ GHitFileReader* ra=readers[heap[a]];
+ GHitFileReader* rb=readers[heap[b]];
+ if (ra->score!=rb->score) return (ra->score>rb->score);
+ return (ra->fidx<rb->fidx);
+}
+
+void GHitMerger::siftDown(int i) {
+ int n=heap.Count();
+ for (;;) {
+   int m=i;
+   int l=2*i+1;
+   int r=l+1;
+   if (l<n && heapLess(l, m)) m=l;
+   if (r<n && heapLess(r, m)) m=r;
+   if (m==i) return;
+   heap.Exchange(i, m);
+   i=m;
+   }
+}
+
+char* GHitMerger::nextLine(int& len) {
+ //the previously returned line is only replaced now
+ if (pending>=0) {
+   if (!readers[pending]->next()) {
+     heap[0]=heap.Last();
+     heap.Delete(heap.Count()-1);
+     }
+   if (heap.Count()>0) siftDown(0);
+   pending=-1;
+   }
+ if (heap.Count()==0) return NULL;
+ pending=heap[0];
+ GHitFileReader* r=readers[pending];
+ len=r->len;
+ numLines++;
+ return r->buf;
+}
@@ -0,0 +1,77 @@
+#ifndef _GHITSORT_H
+#define _GHITSORT_H
+#include "GBase.h"
+#include "GStr.h"
+#include "GVec.hh"
+
+/* Score ordering of mgblast tabulated hits (descending by the score field,
+   the 10th column), as required by mblasm and sclust.
+   GHitSorter is an external sort: it only keeps a small key for each line
+   (score, file, offset, length); fixed size batches of keys are sorted in
+   parallel and spilled as "runs" into temporary files, then a k-way merge
+   of the runs returns the lines, read back from their input files.
+   Lines with the same score keep their input order.
+   GHitMerger streams the lines of several files which are already sorted
+   by score (e.g. from sharded mgblast jobs), in global score order.
+   Compressed inputs are accepted by both (see GCompress.h).
+*/
+
+//a source of score-ordered hit lines
+class GHitSource {
+ public:
+  virtual ~GHitSource() { }
+  //next line (without the line terminator), or NULL when done
+  virtual char* nextLine(int& len)=0;
+};
+
+struct GHitKey {
+  int64 fpos; //offset of the line in its file
+  int score;
+  int len; //line length, without the line terminator
+  int fidx; //input file index
+};
+
+class GHitRun;
+
+class GHitSorter: public GHitSource {
+  GVec<char*> fnames;
+  GVec<int> fds;
+  int numThreads;
+  int maxKeys; //keys held by each batch
+  GVec<GHitRun*> runs;
+  GVec<int> heap; //indexes in runs
+  char* lbuf;
+  int lcap;
+  void scanFile(int fidx, GHitKey*& keys, int& nkeys, GVec<void*>& jobs);
+  void flushKeys(GHitKey*& keys, int& nkeys, GVec<void*>& jobs, bool last);
+  bool heapLess(int a, int b);
+  void siftDown(int i);
+ public:
+  int numLines;
+  GHitSorter(int threads=1, int memMB=1024);
+  ~GHitSorter();
+  void addFile(const char* fname);
+  void sort(); //scan all the files and prepare the sorted runs
+  char* nextLine(int& len);
+};
+
+class GHitFileReader;
+
+class GHitMerger: public GHitSource {
+  GVec<GHitFileReader*> readers;
+  GVec<int> heap; //indexes in readers
+  int pending; //reader whose line was returned last
+  bool heapLess(int a, int b);
+  void siftDown(int i);
+ public:
+  int numLines;
+  GHitMerger():readers(), heap(), pending(-1), numLines(0) { }
+  ~GHitMerger();
+  void addFile(const char* fname);
+  char* nextLine(int& len);
+};
+
+//parse the score field of a tabulated hit line
+bool hitLineScore(const char* line, int len, int& score);
+
+#endif
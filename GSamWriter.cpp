@@ -0,0 +1,370 @@
+#include "GSamWriter.h"
+#include "GCompress.h"
+#include <unistd.h>
+
+#define SAM_COPYBUF 65536
+
+static const char* samCigarOps="MIDNSHP=X";
+enum { CIG_M=0, CIG_I, CIG_D, CIG_N, CIG_S };
+
+static inline void put16le(unsigned char* p, uint v) {
+ p[0]=v & 0xFF; p[1]=(v>>8) & 0xFF;
+}
+static inline void put32le(unsigned char* p, uint v) {
+ p[0]=v & 0xFF; p[1]=(v>>8) & 0xFF; p[2]=(v>>16) & 0xFF; p[3]=(v>>24) & 0xFF;
+}
+static inline uint get16le(const unsigned char* p) {
+ return (uint)p[0] | ((uint)p[1]<<8);
+}
+static inline uint get32le(const unsigned char* p) {
+ return (uint)p[0] | ((uint)p[1]<<8) | ((uint)p[2]<<16) | ((uint)p[3]<<24);
+}
+
+//BAM index bin of a 0-based, end-exclusive range (from the SAM specification)
+static int reg2bin(int beg, int end) {
+ --end;
+ if (beg>>14 == end>>14) return ((1<<15)-1)/7 + (beg>>14);
+ if (beg>>17 == end>>17) return ((1<<12)-1)/7 + (beg>>17);
+ if (beg>>20 == end>>20) return ((1<<9)-1)/7 + (beg>>20);
+ if (beg>>23 == end>>23) return ((1<<6)-1)/7 + (beg>>23);
+ if (beg>>26 == end>>26) return ((1<<3)-1)/7 + (beg>>26);
+ return 0;
+}
+
+static const char* nt16="=ACMGRSVTWYHKDBN";
+
+static inline int nt16code(char c) {
+ const char* p=strchr(nt16, toupper(c));
+ return (p==NULL || c==0) ? 15 : (int)(p-nt16);
+}
+
+static void addCigarOp(GVec<uint32_t>& cigar, int op) {
+ int n=cigar.Count();
+ if (n>0 && (int)(cigar[n-1] & 0xf)==op) {
+   cigar[n-1]+=(1<<4);
+   return;
+   }
+ uint32_t c=(1<<4) | op;
+ cigar.Add(c);
+}
+
+void GSamBatch::addData(const void* p, int len) {
+ if (dlen+len>dcap) {
+   dcap=GMAX(dcap*2, dlen+len+4096);
+   GREALLOC(data, dcap);
+   }
+ memcpy(data+dlen, p, len);
+ dlen+=len;
+}
+
+void GSamBatch::clear() {
+ for (int i=0;i<names.Count();i++) {
+   GFREE(names[i]);
+   GFREE(seqs[i]);
+   }
+ names.Clear();
+ seqs.Clear();
+ lens.Clear();
+ dlen=0;
+}
+
+struct SamRecPos {
+ int pos;
+ int idx;
+ int dofs; //offset and length in the record buffer
+ int dlen;
+};
+
+static int cmpSamRecPos(const void* p1, const void* p2) {
+ const SamRecPos* r1=(const SamRecPos*)p1;
+ const SamRecPos* r2=(const SamRecPos*)p2;
+ if (r1->pos!=r2->pos) return (r1->pos<r2->pos) ? -1 : 1;
+ return (r1->idx<r2->idx) ? -1 : ((r1->idx>r2->idx) ? 1 : 0);
+}
+
+void GSamBatch::addContig(GSeqAlign* aln, const char* name) {
+ if (aln->consensus==NULL || aln->msacolumns==NULL)
+   GError("Error: cannot write contig %s before its MSA is refined!\n", name);
+ int clen=aln->consensus_len;
+ //position of each consensus column on the contig sequence (-1 for gaps)
+ int* cpos=NULL;
+ GMALLOC(cpos, (clen+1)*sizeof(int));
+ char* rseq=NULL;
+ GMALLOC(rseq, clen+1);
+ int rlen=0;
+ for (int c=0;c<clen;c++) {
+   char b=aln->consensus[c];
+   if (b=='*' || b=='-') { cpos[c]=-1; continue; }
+   cpos[c]=rlen;
+   rseq[rlen++]=(char)toupper(b);
+   }
+ rseq[rlen]=0;
+ if (rlen==0) {
+   GMessage("Warning: contig %s has no consensus, not written.\n", name);
+   GFREE(cpos);
+   GFREE(rseq);
+   return;
+   }
+ int refid=names.Count();
+ names.Add(Gstrdup(name));
+ seqs.Add(rseq);
+ lens.Add(rlen);
+ int cstart=aln->minOfs()+aln->msacolumns->mincol; //layout offset of the consensus
+ int nseqs=aln->Count();
+ SamRecPos* rpos=NULL;
+ GMALLOC(rpos, nseqs*sizeof(SamRecPos));
+ GSamBatch recs; //records in layout order
+ GVec<uint32_t> cigar;
+ char* bases=NULL;
+ int bcap=0;
+ unsigned char* buf=NULL;
+ int bufcap=0;
+ for (int k=0;k<nseqs;k++) {
+   GASeq* s=aln->Get(k);
+   if (s->len!=s->seqlen)
+     GError("Error: sequence %s is not loaded for SAM output!\n", s->id);
+   int clipL=(s->revcompl!=0) ? s->clp3 : s->clp5;
+   int clipR=(s->revcompl!=0) ? s->clp5 : s->clp3;
+   if (s->seqlen+1>bcap) {
+     bcap=s->seqlen+1;
+     GREALLOC(bases, bcap);
+     }
+   cigar.Clear();
+   int nb=0;
+   int pos=-1; //first aligned position on the contig
+   int rend=0; //end of the aligned range (exclusive)
+   int col=s->offset-cstart; //consensus column of the first gapped position
+   for (int i=0;i<s->seqlen;i++) {
+     int g=s->gap(i);
+     if (g<0) continue; //base removed from the alignment
+     bool clipped=(i<clipL || i>=s->seqlen-clipR);
+     if (!clipped && pos>=0) {
+       for (int j=0;j<g;j++) {
+         int c=col+j;
+         //read gap on a consensus gap column is just padding
+         if (c>=0 && c<clen && cpos[c]>=0) {
+           addCigarOp(cigar, CIG_D);
+           rend++;
+           }
+         }
+       }
+     col+=g;
+     bases[nb++]=s->seq[i];
+     if (clipped) addCigarOp(cigar, CIG_S);
+     else if (col>=0 && col<clen && cpos[col]>=0) {
+       if (pos<0) {
+         pos=cpos[col];
+         rend=pos;
+         }
+       addCigarOp(cigar, CIG_M);
+       rend++;
+       }
+     else addCigarOp(cigar, CIG_I);
+     col++;
+     }
+   int flag=(s->revcompl!=0) ? 0x10 : 0;
+   if (pos<0) { //no base aligned to the consensus
+     flag|=0x4;
+     pos=0;
+     rend=1;
+     cigar.Clear();
+     }
+   int l_name=strlen(s->id)+1;
+   if (l_name>255) l_name=255;
+   int ncig=cigar.Count();
+   int blen=32+l_name+4*ncig+(nb+1)/2+nb;
+   if (4+blen>bufcap) {
+     bufcap=4+blen;
+     GREALLOC(buf, bufcap);
+     }
+   unsigned char* r=buf;
+   put32le(r, blen);
+   put32le(r+4, refid);
+   put32le(r+8, pos);
+   r[12]=l_name;
+   r[13]=255; //MAPQ not available
+   put16le(r+14, reg2bin(pos, rend));
+   put16le(r+16, ncig);
+   put16le(r+18, flag);
+   put32le(r+20, nb);
+   put32le(r+24, (uint)-1); //no mate
+   put32le(r+28, (uint)-1);
+   put32le(r+32, 0);
+   r+=36;
+   memcpy(r, s->id, l_name-1);
+   r[l_name-1]=0;
+   r+=l_name;
+   for (int i=0;i<ncig;i++, r+=4) put32le(r, cigar[i]);
+   for (int i=0;i<nb;i+=2) {
+     int c=nt16code(bases[i])<<4;
+     if (i+1<nb) c|=nt16code(bases[i+1]);
+     *r++=c;
+     }
+   memset(r, 0xff, nb); //no base qualities
+   rpos[k].pos=pos;
+   rpos[k].idx=k;
+   rpos[k].dofs=recs.dlen;
+   rpos[k].dlen=4+blen;
+   recs.addData(buf, 4+blen);
+   }
+ qsort(rpos, nseqs, sizeof(SamRecPos), cmpSamRecPos);
+ for (int k=0;k<nseqs;k++)
+   addData(recs.data+rpos[k].dofs, rpos[k].dlen);
+ GFREE(buf);
+ GFREE(bases);
+ GFREE(rpos);
+ GFREE(cpos);
+}
+
+//-------------------- GSamWriter
+
+static FILE* tmpRecFile() {
+ const char* tdir=getenv("TMPDIR");
+ if (tdir==NULL || *tdir==0) tdir="/tmp";
+ GStr fname(tdir);
+ fname+="/mblsam.XXXXXX";
+ char* tname=Gstrdup(fname.chars());
+ int fd=mkstemp(tname);
+ if (fd<0) GError("Error creating temporary file %s!\n", tname);
+ unlink(tname); //gone as soon as it is closed
+ GFREE(tname);
+ FILE* f=fdopen(fd, "w+b");
+ if (f==NULL) GError("Error opening temporary SAM records file!\n");
+ return f;
+}
+
+GSamWriter::GSamWriter(const char* outfile, int bgzfThreads):fname(outfile),
+    bam(false), threads(bgzfThreads), fout(NULL), frec(NULL), ffa(NULL),
+    names(), lens(), batch(), numRecords(0) {
+ bam=endsWith(outfile, ".bam");
+ fout=bam ? zfopenBGZF(outfile, threads) : zfopenWrite(outfile, threads);
+ if (fout==NULL)
+   GError("Error creating file %s!\n", outfile);
+ GStr faname(outfile);
+ if (endsWith(faname.chars(), ".gz")) faname.cut(faname.length()-3);
+ if (endsWith(faname.chars(), ".bam") || endsWith(faname.chars(), ".sam"))
+   faname.cut(faname.length()-4);
+ faname+=".fa";
+ ffa=fopen(faname.chars(), "w");
+ if (ffa==NULL)
+   GError("Error creating file %s!\n", faname.chars());
+ frec=tmpRecFile();
+}
+
+GSamWriter::~GSamWriter() {
+ close();
+}
+
+void GSamWriter::write(GSamBatch& b) {
+ int base=names.Count();
+ for (int p=0;p<b.dlen;) {
+   unsigned char* r=(unsigned char*)(b.data+p);
+   put32le(r+4, get32le(r+4)+base);
+   p+=4+get32le(r);
+   numRecords++;
+   }
+ if (b.dlen>0 && fwrite(b.data, 1, b.dlen, frec)!=(size_t)b.dlen)
+   GError("Error writing temporary SAM records file!\n");
+ for (int i=0;i<b.names.Count();i++) {
+   fprintf(ffa, ">%s\n", b.names[i]);
+   const char* seq=b.seqs[i];
+   for (int j=0;j<b.lens[i];j+=60)
+     fprintf(ffa, "%.*s\n", GMIN(60, b.lens[i]-j), seq+j);
+   names.Add(b.names[i]);
+   lens.Add(b.lens[i]);
+   GFREE(b.seqs[i]);
+   }
+ b.names.Clear(); //now owned by this writer
+ b.seqs.Clear();
+ b.lens.Clear();
+ b.dlen=0;
+}
+
+void GSamWriter::writeHeader(FILE* f) {
+ GStr hdr("@HD\tVN:1.6\tSO:coordinate\n");
+ for (int i=0;i<names.Count();i++)
+   hdr.appendfmt("@SQ\tSN:%s\tLN:%d\n", names[i], lens[i]);
+ if (!bam) {
+   fputs(hdr.chars(), f);
+   return;
+   }
+ unsigned char b[4];
+ fwrite("BAM\1", 1, 4, f);
+ put32le(b, hdr.length());
+ fwrite(b, 1, 4, f);
+ fwrite(hdr.chars(), 1, hdr.length(), f);
+ put32le(b, names.Count());
+ fwrite(b, 1, 4, f);
+ for (int i=0;i<names.Count();i++) {
+   int l=strlen(names[i])+1;
+   put32le(b, l);
+   fwrite(b, 1, 4, f);
+   fwrite(names[i], 1, l, f);
+   put32le(b, lens[i]);
+   fwrite(b, 1, 4, f);
+   }
+}
+
+//r is a BAM record without its block_size
+void GSamWriter::writeSamRecord(FILE* f, const unsigned char* r, int rlen) {
+ int refid=(int)get32le(r);
+ int pos=(int)get32le(r+4);
+ int l_name=r[8];
+ int ncig=get16le(r+12);
+ int flag=get16le(r+14);
+ int l_seq=(int)get32le(r+16);
+ const unsigned char* p=r+32;
+ if (32+l_name+4*ncig+(l_seq+1)/2+l_seq>rlen)
+   GError("Error: invalid SAM record in temporary file!\n");
+ fprintf(f, "%s\t%d\t%s\t%d\t255\t", (const char*)p, flag, names[refid], pos+1);
+ p+=l_name;
+ if (ncig==0) fputc('*', f);
+ for (int i=0;i<ncig;i++, p+=4) {
+   uint c=get32le(p);
+   fprintf(f, "%u%c", c>>4, samCigarOps[c & 0xf]);
+   }
+ fputs("\t*\t0\t0\t", f);
+ for (int i=0;i<l_seq;i++)
+   fputc(nt16[(p[i>>1]>>((~i & 1)<<2)) & 0xf], f);
+ fputs("\t*\n", f);
+}
+
+void GSamWriter::close() {
+ if (frec==NULL) return;
+ writeHeader(fout);
+ fflush(frec);
+ rewind(frec);
+ char* buf=NULL;
+ GMALLOC(buf, SAM_COPYBUF);
+ if (bam) {
+   size_t n;
+   while ((n=fread(buf, 1, SAM_COPYBUF, frec))>0)
+     if (fwrite(buf, 1, n, fout)!=n)
+       GError("Error writing BAM file %s!\n", fname.chars());
+   }
+ else {
+   int bufcap=SAM_COPYBUF;
+   unsigned char b[4];
+   while (fread(b, 1, 4, frec)==4) {
+     int rlen=get32le(b);
+     if (rlen>bufcap) {
+       bufcap=rlen;
+       GREALLOC(buf, bufcap);
+       }
+     if (fread(buf, 1, rlen, frec)!=(size_t)rlen)
+       GError("Error reading temporary SAM records file!\n");
+     writeSamRecord(fout, (unsigned char*)buf, rlen);
+     }
+   }
+ GFREE(buf);
+ fclose(frec);
+ frec=NULL;
+ if (zfclose(fout)!=0)
+   GError("Error writing file %s!\n", fname.chars());
+ fout=NULL;
+ fclose(ffa);
+ ffa=NULL;
+ for (int i=0;i<names.Count();i++) GFREE(names[i]);
+ names.Clear();
+ lens.Clear();
+}
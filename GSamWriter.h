@@ -0,0 +1,71 @@
+#ifndef _GSAMWRITER_H
+#define _GSAMWRITER_H
+#include "GBase.h"
+#include "GStr.h"
+#include "GVec.hh"
+#include "GapAssem.h"
+
+/* SAM/BAM output of assembled contigs, as an alternative to ACE files.
+   Each contig is written as a reference sequence (its consensus, without
+   the consensus gap columns) and each of its reads as an alignment record
+   on it, with the CIGAR built from the read gaps (ofs[]) and its clipping
+   (soft clips); reversed reads have the 0x10 flag set. The records of a
+   contig are sorted by position, so the BAM output can be indexed by
+   samtools right away. The consensus sequences are also written into a
+   FASTA file (the output name with the .bam/.sam extension replaced
+   by .fa), to be used as the reference for viewing the alignments.
+   The output format is given by the file name: *.bam is BAM (BGZF
+   compressed by a pool of threads), anything else is SAM text (*.gz
+   names are BGZF compressed, see GCompress.h).
+   As the SAM header must list all the contigs, the records are kept in
+   a temporary file until close().
+*/
+
+//the records of one or more contigs, collected independently (e.g. by a
+//worker thread) and added to the GSamWriter later, in output order
+class GSamBatch {
+  friend class GSamWriter;
+  GVec<char*> names; //contig names
+  GVec<char*> seqs; //their consensus sequences, without gaps
+  GVec<int> lens;
+  char* data; //BAM records, with reference IDs relative to this batch
+  int dlen;
+  int dcap;
+  void addData(const void* p, int len);
+ public:
+  GSamBatch():names(), seqs(), lens(), data(NULL), dlen(0), dcap(0) { }
+  ~GSamBatch() { clear(); GFREE(data); }
+  //aln must be refined already (refineMSA(), writeACE()) and still have
+  //its sequence data loaded (i.e. before freeMSA())
+  void addContig(GSeqAlign* aln, const char* name);
+  void clear();
+  int count() { return names.Count(); }
+};
+
+class GSamWriter {
+  GStr fname;
+  bool bam;
+  int threads; //for BGZF compression
+  FILE* fout;
+  FILE* frec; //temporary file with all the BAM records
+  FILE* ffa; //consensus sequences
+  GVec<char*> names;
+  GVec<int> lens;
+  GSamBatch batch; //for write(aln, name)
+  void writeHeader(FILE* f);
+  void writeSamRecord(FILE* f, const unsigned char* r, int rlen);
+ public:
+  int numRecords;
+  GSamWriter(const char* outfile, int bgzfThreads=0);
+  ~GSamWriter();
+  //append the contigs of b (then cleared)
+  void write(GSamBatch& b);
+  void write(GSeqAlign* aln, const char* name) {
+    batch.addContig(aln, name);
+    write(batch);
+    }
+  //write the final output file
+  void close();
+};
+
+#endif
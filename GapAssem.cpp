@@ -559,6 +559,7 @@ GSeqAlign::GSeqAlign(GASeq* s1, GASeq* s2) :
 	s1->msa = this;
 	s2->msa = this;
 	refinedMSA = false;
+	tryPileup = false;
 	consensus = NULL;
 	consensus_len = 0;
 	consensus_cap = 0;
@@ -1022,22 +1023,26 @@ void GAlnColumn::remove() {
 	    "Warning: column remove() couldn't find a sequence at that position!\n");
 }
 
+void GSeqAlign::checkTrimming(GASeq* seq, int idx) {
+	seq->msaidx = idx; // GSeqAlign is sorted by offset
+	                   // this will speed up some later adjustments
+	if (seq->seqlen - seq->clp3 - seq->clp5 < 1) {
+		fprintf(stderr,
+		    "Warning: sequence %s (length %d) was trimmed too badly (%d,%d)"
+				    " -- should remove it from MSA w/ %s!\n", seq->id, seq->seqlen,
+		    seq->clp5, seq->clp3, Get(0)->id);
+		seq->setFlag(GA_flag_BAD_ALIGN); //bad-align flag!
+		badseqs++;
+	}
+}
+
 void GSeqAlign::buildMSA(bool refWeighDown) {
 	if (msacolumns != NULL)
 		GError("Error: cannot call buildMSA() twice!\n");
 	msacolumns = new MSAColumns(length, minoffset);
 	for (int i = 0; i < Count(); i++) {
 		GASeq* seq = Get(i);
-		seq->msaidx = i; // GSeqAlign is sorted by offset
-		                 // this will speed up some later adjustments
-		if (seq->seqlen - seq->clp3 - seq->clp5 < 1) {
-			fprintf(stderr,
-			    "Warning: sequence %s (length %d) was trimmed too badly (%d,%d)"
-					    " -- should remove it from MSA w/ %s!\n", seq->id, seq->seqlen,
-			    seq->clp5, seq->clp3, Get(0)->id);
-			seq->setFlag(GA_flag_BAD_ALIGN); //bad-align flag!
-			badseqs++;
-		}
+		checkTrimming(seq, i);
 		int incVal=1;
 		if (refWeighDown && !seq->hasFlag(GA_flag_IS_REF)) {
 			incVal = 10;
@@ -1047,6 +1052,144 @@ void GSeqAlign::buildMSA(bool refWeighDown) {
 	//this->Pack();
 }
 
+//-- pileup consensus: walks all the sequences column by column, keeping
+// only the nucleotide counts of the current column (no GAlnColumn/NucOri
+// allocations). Same result as buildMSA() and the consensus loop of
+// refineMSA(), as long as no consensus gap column has to be removed
+// (which only a full MSA can do): returns false in that case.
+struct PileupCursor {
+	GASeq* seq;
+	int pos; //current base
+	int gap; //gap columns already walked before base pos
+	int clipL;
+	int clipR;
+	int nucValue;
+};
+
+static int cmpSeqOffset(const void* p1, const void* p2) {
+	int o1 = (*(GASeq**) p1)->offset;
+	int o2 = (*(GASeq**) p2)->offset;
+	return (o1 < o2) ? -1 : ((o1 > o2) ? 1 : 0);
+}
+
+//same choice as GAlnColumn::bestChar() for counts of A,C,G,T,N,-
+static char pileupBest(int* counts) {
+	static const char nucs[6] = { 'A', 'C', 'G', 'T', 'N', '-' };
+	int ord[6] = { 0, 1, 2, 3, 4, 5 };
+	for (int i = 1; i < 6; i++) { //stable, descending by count
+		int v = ord[i];
+		int j = i;
+		for (; j > 0 && counts[ord[j - 1]] < counts[v]; j--)
+			ord[j] = ord[j - 1];
+		ord[j] = v;
+	}
+	int r = 0;
+	char best = nucs[ord[0]];
+	while ((best == '-' || best == 'N') && r < 5
+	    && counts[ord[r]] == counts[ord[r + 1]]) {
+		r++;
+		best = nucs[ord[r]];
+	}
+	return best;
+}
+
+bool GSeqAlign::pileupMSA(bool refWeighDown) {
+	int cnt = Count();
+	if (cnt == 0 || length <= 0)
+		return false;
+	GASeq** seqs = NULL;
+	GMALLOC(seqs, cnt * sizeof(GASeq*));
+	for (int i = 0; i < cnt; i++) {
+		GASeq* seq = Get(i);
+		if (seq->len == 0 || seq->len != seq->seqlen)
+			GError(
+			    "GSeqAlign::pileupMSA Error: invalid sequence data '%s' (len=%d, seqlen=%d)\n",
+			    seq->id, seq->len, seq->seqlen);
+		seqs[i] = seq;
+	}
+	qsort(seqs, cnt, sizeof(GASeq*), cmpSeqOffset);
+	PileupCursor* cur = NULL; //sequences overlapping the current column
+	GMALLOC(cur, cnt * sizeof(PileupCursor));
+	char* colc = NULL; //best char of each column, 0 if not covered
+	GMALLOC(colc, length);
+	int ncur = 0;
+	int next = 0;
+	int mincol = INT_MAX;
+	int maxcol = 0;
+	for (int col = 0; col < length; col++) {
+		while (next < cnt && seqs[next]->offset - minoffset <= col) {
+			GASeq* seq = seqs[next];
+			PileupCursor& c = cur[ncur];
+			c.seq = seq;
+			c.pos = 0;
+			c.gap = 0;
+			c.clipL = (seq->revcompl != 0) ? seq->clp3 : seq->clp5;
+			c.clipR = (seq->revcompl != 0) ? seq->clp5 : seq->clp3;
+			c.nucValue = (refWeighDown && !seq->hasFlag(GA_flag_IS_REF)) ? 10 : 1;
+			ncur++;
+			next++;
+		}
+		int counts[6] = { 0, 0, 0, 0, 0, 0 };
+		int layers = 0;
+		for (int i = 0; i < ncur;) {
+			PileupCursor& c = cur[i];
+			GASeq* seq = c.seq;
+			bool clipped = (c.pos < c.clipL || c.pos >= seq->seqlen - c.clipR);
+			if (!clipped && c.gap == 0 && mincol == INT_MAX)
+				mincol = col;
+			if (c.gap < seq->ofs[c.pos]) { //gap column before this base
+				if (!clipped) {
+					counts[5] += c.nucValue;
+					layers++;
+				}
+				c.gap++;
+				i++;
+				continue;
+			}
+			if (!clipped) {
+				int n;
+				switch (toupper(seq->seq[c.pos])) {
+					case 'A': n = 0; break;
+					case 'C': n = 1; break;
+					case 'G': n = 2; break;
+					case 'T': n = 3; break;
+					case '-':
+					case '*': n = 5; break;
+					default: n = 4;
+				}
+				counts[n] += c.nucValue;
+				layers++;
+				maxcol = col;
+			}
+			c.pos++;
+			c.gap = 0;
+			if (c.pos >= seq->seqlen)
+				cur[i] = cur[--ncur]; //done with this sequence
+			else
+				i++;
+		}
+		colc[col] = (layers > 0) ? pileupBest(counts) : 0;
+	}
+	GFREE(cur);
+	GFREE(seqs);
+	bool ok = (mincol <= maxcol);
+	for (int col = mincol; ok && col <= maxcol; col++) {
+		if (colc[col] == 0 || (colc[col] == '-' && MSAColumns::removeConsGaps))
+			ok = false;
+	}
+	if (ok) {
+		for (int col = mincol; col <= maxcol; col++)
+			extendConsensus(colc[col] == '-' ? '*' : colc[col]);
+		for (int i = 0; i < cnt; i++)
+			checkTrimming(Get(i), i);
+		//no columns are stored, only the consensus range
+		msacolumns = new MSAColumns(0, minoffset);
+		msacolumns->updateMinMax(mincol, maxcol);
+	}
+	GFREE(colc);
+	return ok;
+}
+
 void GSeqAlign::freeMSA() {
 	if (msacolumns != NULL) {
 		delete msacolumns;
@@ -1079,6 +1222,10 @@ void GSeqAlign::refineMSA(bool refWeighDown, bool redo_ends) {
 		//and recompute the trimming accordingly
 	} else { //freeze end trimming
 		//if (msacolumns==NULL)
+		if (tryPileup && pileupMSA(refWeighDown)) {
+			refineEnds();
+			return;
+		}
 		buildMSA(refWeighDown); //populate MSAColumns only based on existing trimming
 	}
 	//==> remove columns and build consensus
@@ -1102,6 +1249,10 @@ void GSeqAlign::refineMSA(bool refWeighDown, bool redo_ends) {
 		}
 		extendConsensus(c);
 	}
+	refineEnds();
+}
+
+void GSeqAlign::refineEnds() {
 	//-- refine clipping and remove gaps propagated in the clipping regions
 	for (int i = 0; i < Count(); i++) {
 		GASeq* seq = Get(i);
@@ -1139,10 +1290,14 @@ void GSeqAlign::extendConsensus(char c) {
 	consensus_len++;
 }
 
-void GSeqAlign::writeACE(FILE* f, const char* name, bool refWeighDown) {
+void GSeqAlign::writeACE(FILE* f, const char* name, bool refWeighDown,
+		GAceIndex* aidx) {
 	//--build a consensus sequence
 	if (!refinedMSA)
 		refineMSA(refWeighDown);
+	int64 fstart = 0;
+	if (aidx != NULL && (fstart = ftello(f)) < 0)
+		GError("Error: cannot index ACE output for %s (not a regular file)!\n", name);
 
 	//FastaSeq conseq((char*)name);
 	//conseq.setSeqPtr(consensus, consensus_len, consensus_cap);
@@ -1200,7 +1355,39 @@ void GSeqAlign::writeACE(FILE* f, const char* name, bool refWeighDown) {
 		}
 		fprintf(f, "\nQA %d %d %d %d\nDS \n\n", seql, seqr, seql, seqr);
 	}
+	if (aidx != NULL)
+		aidx->add(name, fstart, ftello(f) - fstart, Count(), consensus_len);
+}
 
+//--------------- ACE index
+void GAceIndex::add(const char* name, int64 ofs, int64 len, int numreads,
+    int conslen) {
+	if (f != NULL) {
+		fprintf(f, "%s\t%lld\t%lld\t%d\t%d\n", name, (long long) ofs,
+		    (long long) len, numreads, conslen);
+		return;
+	}
+	Entry e;
+	e.name = Gstrdup(name);
+	e.ofs = ofs;
+	e.len = len;
+	e.numreads = numreads;
+	e.conslen = conslen;
+	entries.Add(e);
+}
+
+void GAceIndex::writeTo(GAceIndex& dest, int64 base) {
+	for (int i = 0; i < entries.Count(); i++) {
+		Entry& e = entries[i];
+		dest.add(e.name, base + e.ofs, e.len, e.numreads, e.conslen);
+	}
+	clear();
+}
+
+void GAceIndex::clear() {
+	for (int i = 0; i < entries.Count(); i++)
+		GFREE(entries[i].name);
+	entries.Clear();
 }
 
 void GSeqAlign::writeInfo(FILE* f, const char* name, bool refWeighDown) {
@@ -1307,3 +1494,95 @@ void GSeqAlign::writeInfo(FILE* f, const char* name, bool refWeighDown) {
 	}
 	redundancy /= (float) consensus_len;
 }
+
+//--------------- layout state dump/restore (checkpointing) -----------------
+static bool stWrite(FILE* f, const void* p, size_t n) {
+	return (fwrite(p, 1, n, f) == n);
+}
+
+static bool stRead(FILE* f, void* p, size_t n) {
+	return (fread(p, 1, n, f) == n);
+}
+
+bool GSeqAlign::writeState(FILE* f) {
+	int32_t hdr[6] = { length, minoffset, ng_len, ng_minofs, badseqs, Count() };
+	uint32_t ord = ordnum;
+	if (!stWrite(f, &ord, sizeof(ord)) || !stWrite(f, hdr, sizeof(hdr)))
+		return false;
+	for (int i = 0; i < Count(); i++) {
+		GASeq* s = Get(i);
+		int32_t idlen = strlen(s->id);
+		int32_t nofs = 0; //only non-zero gap entries are stored
+		for (int j = 0; j < s->seqlen; j++)
+			if (s->ofs[j] != 0)
+				nofs++;
+		int32_t sdata[9] = { idlen, s->seqlen, s->offset, s->ng_ofs, s->ext5,
+		    s->ext3, s->clp5, s->clp3, nofs };
+		unsigned char sflags[2] = { (unsigned char) s->revcompl, s->flags };
+		if (!stWrite(f, sdata, sizeof(sdata)) || !stWrite(f, s->id, idlen)
+		    || !stWrite(f, sflags, 2))
+			return false;
+		for (int j = 0; j < s->seqlen; j++) {
+			if (s->ofs[j] == 0)
+				continue;
+			int32_t pos = j;
+			if (!stWrite(f, &pos, sizeof(pos))
+			    || !stWrite(f, &(s->ofs[j]), sizeof(short)))
+				return false;
+		}
+	}
+	return true;
+}
+
+GSeqAlign* GSeqAlign::readState(FILE* f) {
+	uint32_t ord = 0;
+	int32_t hdr[6];
+	if (!stRead(f, &ord, sizeof(ord)) || !stRead(f, hdr, sizeof(hdr)))
+		return NULL;
+	GSeqAlign* aln = new GSeqAlign();
+	aln->ordnum = ord;
+	aln->length = hdr[0];
+	aln->minoffset = hdr[1];
+	aln->ng_len = hdr[2];
+	aln->ng_minofs = hdr[3];
+	aln->badseqs = hdr[4];
+	for (int i = 0; i < hdr[5]; i++) {
+		int32_t sdata[9];
+		unsigned char sflags[2];
+		if (!stRead(f, sdata, sizeof(sdata)) || sdata[0] <= 0 || sdata[1] <= 0) {
+			delete aln;
+			return NULL;
+		}
+		char* id = NULL;
+		GMALLOC(id, sdata[0] + 1);
+		if (!stRead(f, id, sdata[0]) || !stRead(f, sflags, 2)) {
+			GFREE(id);
+			delete aln;
+			return NULL;
+		}
+		id[sdata[0]] = 0;
+		GASeq* s = new GASeq(id, sdata[2], sdata[1], sdata[6], sdata[7],
+		    (char) sflags[0]);
+		GFREE(id);
+		s->ng_ofs = sdata[3];
+		s->ext5 = sdata[4];
+		s->ext3 = sdata[5];
+		s->flags = sflags[1];
+		for (int j = 0; j < sdata[8]; j++) {
+			int32_t pos;
+			short g;
+			if (!stRead(f, &pos, sizeof(pos)) || !stRead(f, &g, sizeof(g))
+			    || pos < 0 || pos >= s->seqlen) {
+				delete s;
+				delete aln;
+				return NULL;
+			}
+			s->setGap(pos, g);
+		}
+		s->msa = aln;
+		//the dump is already in list order: append it as such, so that
+		//sequences sharing the same offset keep their original order
+		aln->GPVec<GASeq>::Add(s);
+	}
+	return aln;
+}
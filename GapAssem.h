@@ -9,6 +9,28 @@
 class GSeqAlign;
 class MSAColumns;
 
+//sidecar index of an ACE file (see acefetch): one line for each contig,
+//with its name, byte offset and length in the ACE file, number of reads
+//and consensus length, tab delimited
+class GAceIndex {
+  struct Entry {
+    char* name;
+    int64 ofs;
+    int64 len;
+    int numreads;
+    int conslen;
+    };
+  GVec<Entry> entries; //kept until writeTo(), if there is no index file
+  FILE* f;
+ public:
+  GAceIndex(FILE* fidx=NULL):entries(), f(fidx) { }
+  ~GAceIndex() { clear(); }
+  void add(const char* name, int64 ofs, int64 len, int numreads, int conslen);
+  //write the kept entries to another index, with base added to their offsets
+  void writeTo(GAceIndex& dest, int64 base);
+  void clear();
+};
+
 extern const unsigned char GA_flag_IS_REF;
 extern const unsigned char GA_flag_HAS_PARENT;
 extern const unsigned char GA_flag_BAD_ALIGN;
@@ -362,9 +384,14 @@ class GSeqAlign :public GList<GASeq> {
    int minoffset;
    int consensus_cap;
    void buildMSA(bool refWeighDown=false);
+   bool pileupMSA(bool refWeighDown=false);
+   void checkTrimming(GASeq* seq, int idx);
+   void refineEnds(); //refine clipping against the consensus
    void ErrZeroCov(int col);
  public:
     bool refinedMSA; //if refineMSA() was applied
+    bool tryPileup; //no insertions relative to the reference: refineMSA()
+                    //can try to get the consensus from a plain pileup
     MSAColumns* msacolumns;
     unsigned int ordnum; //order number -- when it was created
               // the lower the better (earlier=higher score)
@@ -385,13 +412,13 @@ class GSeqAlign :public GList<GASeq> {
      }
   //--
   GSeqAlign():GList<GASeq>(true,true,false), length(0), minoffset(0),
-  		consensus_cap(0), refinedMSA(false), msacolumns(NULL), ordnum(0),
+  		consensus_cap(0), refinedMSA(false), tryPileup(false), msacolumns(NULL), ordnum(0),
   		ng_len(0),ng_minofs(0), badseqs(0), consensus(NULL), consensus_len(0) {
     //default is: sorted by GASeq offset, free nodes, non-unique
     }
   GSeqAlign(bool sorted, bool free_elements=true, bool beUnique=false)
      :GList<GASeq>(sorted,free_elements,beUnique), length(0), minoffset(0),
-  		consensus_cap(0), refinedMSA(false), msacolumns(NULL), ordnum(0),
+  		consensus_cap(0), refinedMSA(false), tryPileup(false), msacolumns(NULL), ordnum(0),
   		ng_len(0),ng_minofs(0), badseqs(0), consensus(NULL), consensus_len(0) {
     }
   void incOrd() { ordnum = ++counter; }
@@ -406,6 +433,7 @@ class GSeqAlign :public GList<GASeq> {
     if (consensus!=NULL) GFREE(consensus);
     }
   int len() { return length; }
+  int minOfs() { return minoffset; }
 
   void revComplement();
   void addSeq(GASeq* s, int soffs, int ngofs);
@@ -433,8 +461,15 @@ class GSeqAlign :public GList<GASeq> {
   void freeMSA();
   void refineMSA(bool refWeighDown=false, bool redo_ends=false);
       // find consensus, refine clipping, remove gap-columns
-  void writeACE(FILE* f, const char* name, bool refWeighDown=false);
+  //f must be seekable (ftello()) if aidx is given
+  void writeACE(FILE* f, const char* name, bool refWeighDown=false, GAceIndex* aidx=NULL);
   void writeInfo(FILE* f, const char* name, bool refWeighDown=false);
+  //binary dump/restore of the layout state (no sequence data or MSA columns),
+  //used for checkpointing; native byte order, not meant as an exchange format
+  bool writeState(FILE* f);
+  static GSeqAlign* readState(FILE* f); //returns NULL on a short/bad read
+  static unsigned int getCounter() { return counter; }
+  static void setCounter(unsigned int c) { counter=c; }
 };
 
 int compareOrdnum(void* p1, void* p2);
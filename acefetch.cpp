@@ -0,0 +1,130 @@
+#include "GBase.h"
+#include "GArgs.h"
+#include "GStr.h"
+#include "GVec.hh"
+#include "GHash.hh"
+
+#define USAGE "Usage:\n\
+ acefetch [-x <ace_index>] [-o <outfile>] <file.ace> <contig> [<contig> ..]\n\
+ acefetch [-x <ace_index>] [-o <outfile>] <file.ace> -f <contig_list>\n\
+ Extracts the given contigs from a large ACE file, as written by mblasm,\n\
+ mblaor or bamcons with their -I option, by seeking directly to each of\n\
+ them through the ACE index (<file.ace>.idx).\n\
+ Options:\n\
+ -f extract the contigs listed in file <contig_list> (one name per line)\n\
+ -x use the index file <ace_index> instead of <file.ace>.idx\n\
+ -o write the contigs into <outfile> instead of stdout\n\
+"
+
+#define ACE_COPYBUF 65536
+
+struct AceIdxEntry {
+ int64 ofs;
+ int64 len;
+ AceIdxEntry(int64 o=0, int64 l=0):ofs(o), len(l) { }
+};
+
+//index lines: <contig>\t<offset>\t<length>\t<numreads>\t<conslen>
+int loadAceIndex(const char* fname, GHash<AceIdxEntry>& idx) {
+ FILE* f=fopen(fname, "r");
+ if (f==NULL) GError("Error: cannot open ACE index file %s!\n", fname);
+ GLineReader lr(f);
+ char* line;
+ int n=0;
+ while ((line=lr.getLine())!=NULL) {
+   char* p=strchr(line, '\t');
+   if (p==NULL) continue;
+   *p++=0;
+   char* endp=NULL;
+   int64 ofs=strtoll(p, &endp, 10);
+   if (endp==p || *endp!='\t')
+     GError("Error parsing ACE index line %d!\n", n+1);
+   p=endp+1;
+   int64 len=strtoll(p, &endp, 10);
+   if (endp==p)
+     GError("Error parsing ACE index line %d!\n", n+1);
+   idx.Add(line, new AceIdxEntry(ofs, len));
+   n++;
+   }
+ fclose(f);
+ return n;
+}
+
+bool fetchContig(FILE* acef, AceIdxEntry& e, FILE* outf, char* buf) {
+ if (fseeko(acef, e.ofs, SEEK_SET)!=0) return false;
+ int64 left=e.len;
+ while (left>0) {
+   size_t n=(left<ACE_COPYBUF) ? (size_t)left : ACE_COPYBUF;
+   if (fread(buf, 1, n, acef)!=n) return false;
+   fwrite(buf, 1, n, outf);
+   left-=n;
+   }
+ return true;
+}
+
+int main(int argc, char * const argv[]) {
+ GArgs args(argc, argv, "hf:x:o:");
+ int e;
+ if ((e=args.isError())>0)
+    GError("%s\nInvalid argument: %s\n", USAGE, argv[e]);
+ if (args.getOpt('h')!=NULL) GError("%s\n", USAGE);
+ GStr acefile;
+ GVec<GStr> ctgs;
+ if (args.startNonOpt()) {
+   acefile=args.nextNonOpt();
+   char* a;
+   while ((a=args.nextNonOpt())!=NULL) {
+     GStr s(a);
+     ctgs.Add(s);
+     }
+   }
+ if (acefile.is_empty()) GError("%s\nError: no ACE file given!\n", USAGE);
+ GStr s=args.getOpt('f');
+ if (!s.is_empty()) {
+   FILE* f=fopen(s.chars(), "r");
+   if (f==NULL) GError("Error: cannot open file %s!\n", s.chars());
+   GLineReader lr(f);
+   char* line;
+   while ((line=lr.getLine())!=NULL) {
+     GStr name(line);
+     name.trim();
+     if (!name.is_empty()) ctgs.Add(name);
+     }
+   fclose(f);
+   }
+ if (ctgs.Count()==0) GError("%s\nError: no contigs to extract!\n", USAGE);
+ GStr idxfile=args.getOpt('x');
+ if (idxfile.is_empty()) {
+   idxfile=acefile;
+   idxfile.append(".idx");
+   }
+ GHash<AceIdxEntry> idx(true);
+ loadAceIndex(idxfile.chars(), idx);
+ FILE* acef=fopen(acefile.chars(), "rb");
+ if (acef==NULL) GError("Error: cannot open ACE file %s!\n", acefile.chars());
+ FILE* outf=stdout;
+ GStr outfile=args.getOpt('o');
+ if (!outfile.is_empty()) {
+   outf=fopen(outfile.chars(), "w");
+   if (outf==NULL)
+     GError("Cannot open file %s for writing!\n",outfile.chars());
+   }
+ char* buf=NULL;
+ GMALLOC(buf, ACE_COPYBUF);
+ int missing=0;
+ for (int i=0;i<ctgs.Count();i++) {
+   AceIdxEntry* ie=idx.Find(ctgs[i].chars());
+   if (ie==NULL) {
+     GMessage("Warning: contig %s not found in the index!\n", ctgs[i].chars());
+     missing++;
+     continue;
+     }
+   if (!fetchContig(acef, *ie, outf, buf))
+     GError("Error reading contig %s from %s (truncated file?)\n",
+                    ctgs[i].chars(), acefile.chars());
+   }
+ GFREE(buf);
+ fclose(acef);
+ if (outf!=stdout) fclose(outf);
+ return (missing>0) ? 1 : 0;
+}
@@ -7,18 +7,46 @@
 #include "GFaSeqGet.h"
 #include "GFastaIndex.h"
 #include "GBam.h"
+#include "GThreads.h"
+#include "GDepthCap.h"
+#include "GSamWriter.h"
 #define USAGE "Usage:\n\
  bamcons <file.sorted.bam> [-r <genome.fa>] [-c <clipmax[%]>] \\ \n\
-    [-o <outfile.ace>]\n\
+    [-p <threads> [-R]] [-m <maxdepth> [-S <seed>] [-X <dropped.txt>]]\n\
+    [-a <min_avg_cov>] [-P <min_peak_cov>]\n\
+    [-o <outfile.ace>] [-b <outfile.bam>] [-I]\n\
    The input BAM file <file.sorted.bam> must be sorted by genomic location.\n\
+   Each cluster of overlapping reads is written as a contig named\n\
+   <chr>:<start>-<end>; secondary, supplementary and spliced alignments\n\
+   are ignored.\n\
    \n\
    -r <genome.fa> is a multi-fasta file with all the genomic sequences,\n\
-      preferably indexed with 'samtools faidx'\n\
+      preferably indexed with 'samtools faidx'; the genomic region of\n\
+      each contig is then included in its alignment as a reference\n\
    -c maximum clipping allowed for component sequences when\n\
       mapped onto a reference; if it ends with '%' then maximum\n\
       clipping is estimated for each read as <clipmax> percent\n\
       of its length\n\
    -o the output ACE file is written to <outfile.ace> instead of stdout\n\
+   -b also write the contigs as SAM/BAM alignments (BAM if <outfile.bam>\n\
+      ends in .bam), with the consensus sequences written into <outfile>.fa\n\
+   -I also write an index of the contigs in <outfile.ace> into\n\
+      <outfile.ace>.idx, for random access with acefetch\n\
+   -p number of threads building the contigs (default: 1); the output\n\
+      is the same for any number of threads\n\
+   -R split the genome into regions with no alignment crossing their\n\
+      boundaries, and let each of the -p threads read and process its own\n\
+      regions through the BAM index (<file.sorted.bam>.bai is required)\n\
+   -m cap the read depth of ultra-deep regions: reads are dropped, as\n\
+      chosen by a hash of their names, so that at most <maxdepth> reads\n\
+      cover any position (except where a dropped read would leave bases\n\
+      uncovered); the names of the dropped reads are written to the file\n\
+      given by -X (default: <outfile.ace>.dropped)\n\
+   -S seed for the read selection of -m (default: 0)\n\
+   -a discard the bundles (clusters of overlapping reads) with an average\n\
+      read coverage lower than <min_avg_cov>, as noise\n\
+   -P discard the bundles with a maximum read coverage lower than\n\
+      <min_peak_cov>, as noise\n\
    -G do not remove consensus gaps (default is to edit reads\n\
       by removing gap-dominated columns in the MSA)\n"
 
@@ -31,6 +59,10 @@ bool verbose = false;
 int rlineno = 0;
 
 static FILE* outf;
+static FILE* dropf=NULL; //list of reads dropped by -m
+static GSamWriter* samWriter=NULL; //-b output
+static FILE* idxf=NULL; //-I output
+static GAceIndex* aceIndex=NULL;
 //static GHash<GASeq> seqs(false);
 //static GList<GSeqAlign> alns(true, true, false);
 // sorted, free element, not unique
@@ -42,6 +74,12 @@ static const unsigned char flag_IS_REF = 0;
 static const unsigned char flag_HAS_PARENT = 1;
 
 float clipmax = 0;
+int maxDepth = 0; //-m: maximum read depth of a bundle
+uint64 depthSeed = 0; //-S: seed for choosing the reads kept by -m
+float readthr = 0; //-a: average read coverage per bundle bp to accept it; otherwise considered noise
+float peakthr = 0; //-P: peak read coverage to accept a bundle
+int noiseBundles = 0; //bundles discarded by -a/-P
+int noiseReads = 0; //reads of those bundles
 
 //genomic fasta sequence handling
 class GFastaHandler {
@@ -126,12 +164,61 @@ public:
 			return NULL;
 		}
 	}
+
+	//buffered access to a genomic sequence, which only loads the ranges
+	//requested from it; NULL if not found
+	GFaSeqGet* getSeqAccess(const char* gseqname) {
+		if (fastaPath == NULL || faIdx == NULL || gseqname == NULL)
+			return NULL;
+		GFastaRec* farec = faIdx->getRecord(gseqname);
+		if (farec == NULL) {
+			GMessage("Warning: couldn't find fasta record for '%s'!\n", gseqname);
+			return NULL;
+		}
+		return new GFaSeqGet(fastaPath, farec->seqlen, farec->fpos,
+		    farec->line_len, farec->line_blen);
+	}
+
 	~GFastaHandler() {
 		GFREE(fastaPath);
 		delete faIdx;
 	}
 };
 
+//genomic ranges for the bundles of a chromosome are read through a window
+//of this size, which slides forward with the bundles (the chromosome
+//sequence is never loaded as a whole)
+#define REF_WINDOW_SIZE 1048576
+
+class GRefWindow {
+	GFaSeqGet* faseq;
+	int seqlen;
+	int wstart, wend; //currently loaded window
+public:
+	GRefWindow():faseq(NULL), seqlen(0), wstart(0), wend(0) { }
+	~GRefWindow() { delete faseq; }
+	void setSeq(GFastaHandler* fa, const char* gseqname) {
+		delete faseq;
+		faseq=fa->getSeqAccess(gseqname);
+		seqlen=(faseq==NULL) ? 0 : faseq->getseqlen();
+		wstart=0;
+		wend=0;
+	}
+	//returns a copy of the range start..end (1-based) of the current
+	//sequence, or NULL if not available
+	char* copyRange(int start, int end) {
+		if (faseq==NULL || start<1 || end>seqlen) return NULL;
+		if (start<wstart || end>wend) { //slide the window
+			int clen=GMAX(end-start+1, REF_WINDOW_SIZE);
+			if (start+clen-1>seqlen) clen=seqlen-start+1;
+			if (faseq->loadsubseq(start, clen)==NULL) return NULL;
+			wstart=start;
+			wend=start+clen-1;
+		}
+		return faseq->copyRange(start, end, false, true);
+	}
+};
+
 //--------------------------------
 class RefAlign {
 	char* linecpy;
@@ -159,50 +246,121 @@ public:
 enum BundleStatus {
 	BUNDLE_STATUS_CLEAR=0, //available for loading/prepping
 	BUNDLE_STATUS_LOADING, //being prepared by the main thread (there can be only one)
-	BUNDLE_STATUS_READY //ready to be processed, or being processed
+	BUNDLE_STATUS_READY, //ready to be processed, or being processed
+	BUNDLE_STATUS_DONE //processed, its output waits to be written in order
 };
 
 
+//a read alignment collected for a bundle; its GASeq is only created when
+//the bundle is complete and accepted (placeReads()), as its gaps depend on
+//the insertions found in all the other reads
 struct CReadAln:public GSeg {
-	//DEBUG ONLY:
-	GStr name;
-	// 0: strand; 1: NH; 2: pair's no; 3: coords of read; 4: junctions
-	char strand; // 1, 0 (unkown), -1 (reverse)
-	short int nh;
-	//int pair_idx; //mate index alignment in CReadAln list
-	//GVec<GSeg> segs; //"exons"
-	GStr rname;
-
-	//DEBUG ONLY: (discard rname when no debugging needed)
-	CReadAln(char _strand=0, short int _nh=0,
-			int rstart=0, int rend=0 /*,  const char* rname=NULL */): GSeg(rstart, rend), //name(rname),
-					strand(_strand) { }
+	char* name;
+	char* sseq; //read sequence in reference orientation (until placed)
+	int seqlen;
+	char rev;
+	int clipL; //unaligned bases at the left end (soft clips, end insertions)
+	int clipR; //unaligned bases at the right end
+	GASeq* seq; //the placed read
+	GVec<uint32_t> cigar; //aligned part of the CIGAR (from first to last M)
+	CReadAln(const char* rname, int rstart=0, int rend=0): GSeg(rstart, rend),
+			name(Gstrdup(rname)), sseq(NULL), seqlen(0), rev(0), clipL(0), clipR(0),
+			seq(NULL), cigar() { }
+	~CReadAln() {
+		GFREE(name);
+		GFREE(sseq);
+		if (seq!=NULL && seq->msa==NULL) delete seq; //never placed
+	}
 };
 
 
+//the output of a bundle (or a region): either the actual output files,
+//or memory buffers to be written later in order (by the worker threads)
+struct BundleOutput {
+	FILE* f;
+	FILE* fdrop;
+	char* buf;
+	size_t len;
+	char* dropbuf;
+	size_t droplen;
+	GSamBatch* sam; //SAM records, when buffered
+	GAceIndex* aidx; //ACE index entries, with offsets in buf
+	BundleOutput(FILE* of=NULL, FILE* df=NULL):f(of), fdrop(df), buf(NULL), len(0),
+			dropbuf(NULL), droplen(0), sam(NULL), aidx(NULL) { }
+	void openBuffers() {
+		f=open_memstream(&buf, &len);
+		if (f==NULL) GError("Error: open_memstream() failed!\n");
+		if (samWriter!=NULL) sam=new GSamBatch();
+		if (aceIndex!=NULL) aidx=new GAceIndex();
+		if (dropf==NULL) return;
+		fdrop=open_memstream(&dropbuf, &droplen);
+		if (fdrop==NULL) GError("Error: open_memstream() failed!\n");
+	}
+	void closeBuffers() {
+		fclose(f);
+		f=NULL;
+		if (fdrop!=NULL) fclose(fdrop);
+		fdrop=NULL;
+	}
+	//write the buffers to the output files (writeMutex must be locked)
+	void flush() {
+		if (aidx!=NULL) {
+			aidx->writeTo(*aceIndex, ftello(outf));
+			delete aidx;
+			aidx=NULL;
+		}
+		if (len>0) fwrite(buf, 1, len, outf);
+		if (droplen>0) fwrite(dropbuf, 1, droplen, dropf);
+		if (sam!=NULL) {
+			samWriter->write(*sam);
+			delete sam;
+			sam=NULL;
+		}
+		free(buf); //allocated by open_memstream()
+		free(dropbuf);
+		buf=NULL;
+		dropbuf=NULL;
+		len=0;
+		droplen=0;
+	}
+};
+
 struct BundleData { //clustered (contiguous) read alignments
  BundleStatus status;
  int idx; //index in the main bundles array
  int start;
  int end;
  GStr refseq;
+ GList<CReadAln> reads;
  GList<GSeqAlign> alns;
- GHash<GASeq> seqs;
- GVec<float> bpcov;
+ GHash<CReadAln> seqs; //reads by name
+ GVec<float> bpcov; //read coverage of each bundle base
+ GVec<int> maxins; //longest read insertion before each bundle base
+ char* gseq; //genomic sequence of the bundle region (if available)
+ int outnum; //output order of this bundle
+ BundleOutput out; //rendered output, when processed by a worker thread
  BundleData():status(BUNDLE_STATUS_CLEAR), idx(0), start(0), end(0),
-		 refseq(), alns(false,true), seqs(false), bpcov(1024) { }
+		 refseq(), reads(false,true,false), alns(false,true), seqs(false),
+		 bpcov(1024), maxins(1024), gseq(NULL), outnum(0), out() { }
 
- void getReady(int currentstart, int currentend) {
+ //the bundle keeps its own copy of its genomic region, if available
+ void getReady(int currentstart, int currentend, GRefWindow* refwin=NULL) {
 	 start=currentstart;
 	 end=currentend;
+	 if (refwin!=NULL)
+		 gseq=refwin->copyRange(start, end);
 	 status=BUNDLE_STATUS_READY;
  }
 
  void Clear() {
+	reads.Clear(); //before alns, which own the placed reads
 	alns.Clear();
 	seqs.Clear();
 	bpcov.Clear();
 	bpcov.setCapacity(1024);
+	maxins.Clear();
+	maxins.setCapacity(1024);
+	GFREE(gseq);
 	start=0;
 	end=0;
 	status=BUNDLE_STATUS_CLEAR;
@@ -214,40 +372,581 @@ struct BundleData { //clustered (contiguous) read alignments
 };
 
 
-void processBundle(BundleData* bundle) {
+//adds a read's aligned bases to the bundle coverage and its insertions
+//to the bundle's maximum insertion lengths
+void addReadCoverage(BundleData& bdata, CReadAln& rd, int bstart) {
+	int refp=rd.start-bstart; //0-based position in the bundle
+	int blen=rd.end-bstart+1;
+	if (bdata.bpcov.Count()<blen) {
+		bdata.bpcov.Resize(blen, 0);
+		bdata.maxins.Resize(blen, 0);
+	}
+	for (int i=0;i<rd.cigar.Count();i++) {
+		int op=rd.cigar[i] & BAM_CIGAR_MASK;
+		int oplen=rd.cigar[i] >> BAM_CIGAR_SHIFT;
+		switch (op) {
+			case BAM_CMATCH:
+			case BAM_CEQUAL:
+			case BAM_CDIFF:
+				for (int j=0;j<oplen;j++) bdata.bpcov[refp+j]++;
+				refp+=oplen;
+				break;
+			case BAM_CINS:
+				if (oplen>bdata.maxins[refp]) bdata.maxins[refp]=oplen;
+				break;
+			case BAM_CDEL:
+				refp+=oplen;
+				break;
+		}
+	}
+}
+
+//a complete bundle with too little read coverage is considered noise (-a, -P)
+bool isNoiseBundle(BundleData* bundle, int bstart, int bend) {
+	if (readthr<=0 && peakthr<=0) return false;
+	double sum=0;
+	float peak=0;
+	for (int i=0;i<bundle->bpcov.Count();i++) {
+		sum+=bundle->bpcov[i];
+		if (bundle->bpcov[i]>peak) peak=bundle->bpcov[i];
+	}
+	return (sum/(bend-bstart+1)<readthr || peak<peakthr);
+}
+
+//drops reads from ultra-deep bundles (-m) so that at most maxDepth reads
+//cover any position; dropped reads are listed in fdrop
+void capBundleDepth(BundleData* bundle, FILE* fdrop) {
+	float peak=0;
+	for (int i=0;i<bundle->bpcov.Count();i++)
+		if (bundle->bpcov[i]>peak) peak=bundle->bpcov[i];
+	if (peak<=maxDepth) return;
+	GDepthCap cap(maxDepth, depthSeed);
+	for (int i=0;i<bundle->reads.Count();i++) {
+		CReadAln* rd=bundle->reads.Get(i);
+		cap.add(rd->name, rd->start, rd->end);
+	}
+	GVec<bool> keep;
+	int ndrop=cap.select(keep);
+	if (ndrop==0) return;
+	if (verbose)
+		GMessage("  bundle %s:%d-%d: %d reads dropped (peak coverage %d)\n",
+				bundle->refseq.chars(), bundle->start, bundle->end, ndrop, (int)peak);
+	for (int i=0;i<bundle->reads.Count();i++) {
+		if (keep[i]) continue;
+		fprintf(fdrop, "%s\t%s:%d-%d\n", bundle->reads.Get(i)->name,
+				bundle->refseq.chars(), bundle->start, bundle->end);
+	}
+	for (int i=bundle->reads.Count()-1;i>=0;i--) {
+		if (keep[i]) continue;
+		bundle->seqs.Remove(bundle->reads.Get(i)->name);
+		bundle->reads.Delete(i);
+	}
+	//only the kept reads may add insertion columns
+	int blen=bundle->bpcov.Count();
+	bundle->bpcov.Clear();
+	bundle->maxins.Clear();
+	bundle->bpcov.Resize(blen, 0);
+	bundle->maxins.Resize(blen, 0);
+	for (int i=0;i<bundle->reads.Count();i++)
+		addReadCoverage(*bundle, *(bundle->reads.Get(i)), bundle->start);
+}
+
+//builds the MSA of a complete bundle: the column of each reference base
+//is known once the longest insertion before it is known, so every read
+//is placed directly from its CIGAR (no pairwise merging needed)
+GSeqAlign* placeReads(BundleData* bundle) {
+	int blen=bundle->end-bundle->start+1;
+	bundle->maxins.Resize(blen, 0);
+	GVec<int> col(blen); //MSA column of each bundle base
+	int c=-1;
+	for (int p=0;p<blen;p++) {
+		c+=1+bundle->maxins[p];
+		col.Add(c);
+	}
+	GSeqAlign* aln=new GSeqAlign();
+	//no insertions: every column is a reference base, so the consensus
+	//can be taken from a simple pileup
+	aln->tryPileup=(c==blen-1);
+	if (bundle->gseq!=NULL) {
+		//the genomic region is added as a reference sequence
+		GStr refname;
+		refname.format("ref|%s:%d-%d", bundle->refseq.chars(), bundle->start, bundle->end);
+		GASeq* ref=new GASeq(refname.chars(), 0, blen, 0, 0, 0);
+		ref->setFlag(GA_flag_IS_REF);
+		for (int p=0;p<blen;p++)
+			if (bundle->maxins[p]>0) ref->setGap(p, bundle->maxins[p]);
+		ref->setSeqPtr(bundle->gseq, blen, blen+1);
+		bundle->gseq=NULL; //now owned by ref
+		ref->allupper();
+		aln->addSeq(ref, 0, 0);
+	}
+	for (int r=0;r<bundle->reads.Count();r++) {
+		CReadAln& rd=*(bundle->reads.Get(r));
+		//the clipping of a GASeq is given as 5' and 3' of the read
+		GASeq* s=new GASeq(rd.name, 0, rd.seqlen, rd.rev ? rd.clipR : rd.clipL,
+				rd.rev ? rd.clipL : rd.clipR, rd.rev);
+		s->setSeqPtr(rd.sseq, rd.seqlen);
+		rd.sseq=NULL; //now owned by s
+		rd.seq=s;
+		int refp=rd.start-bundle->start;
+		int i=rd.clipL; //left clipped bases are placed right before the first aligned base
+		int prevcol=col[refp]-1;
+		int soffs=col[refp]-rd.clipL;
+		int ngofs=refp-rd.clipL;
+		for (int k=0;k<rd.cigar.Count();k++) {
+			int op=rd.cigar[k] & BAM_CIGAR_MASK;
+			int oplen=rd.cigar[k] >> BAM_CIGAR_SHIFT;
+			switch (op) {
+				case BAM_CMATCH:
+				case BAM_CEQUAL:
+				case BAM_CDIFF:
+					for (int j=0;j<oplen;j++) {
+						c=col[refp];
+						if (c-prevcol>1) s->setGap(i, c-prevcol-1);
+						prevcol=c;
+						i++;
+						refp++;
+					}
+					break;
+				case BAM_CINS: //left justified in the insertion columns before refp
+					for (int j=0;j<oplen;j++) {
+						c=col[refp]-bundle->maxins[refp]+j;
+						if (c-prevcol>1) s->setGap(i, c-prevcol-1);
+						prevcol=c;
+						i++;
+					}
+					break;
+				case BAM_CDEL:
+					refp+=oplen;
+					break;
+			}
+		}
+		aln->addSeq(s, soffs, ngofs);
+	}
+	return aln;
+}
+
+//builds the bundle's MSA and writes it to out
+void processBundle(BundleData* bundle, BundleOutput& out) {
+	FILE* f=out.f;
 	if (verbose) {
 		//printTime(stderr);
 		GMessage(">bundle %s:%d-%d(%d) begins processing...\n",
-				bundle->refseq.chars(), bundle->start, bundle->end, bundle->alns.Count());
+				bundle->refseq.chars(), bundle->start, bundle->end, bundle->reads.Count());
 	}
-	//TODO: MSA processing and printing here
+	if (maxDepth>0)
+		capBundleDepth(bundle, out.fdrop);
+	bundle->alns.Add(placeReads(bundle));
 	for (int i = 0; i < bundle->alns.Count(); i++) {
 		GSeqAlign* a = bundle->alns.Get(i);
-		//loadAlnSeqs(a, refcdb); //,cdbyank, refcdb); //loading actual sequences for this cluster
 		if (debugMode) { //write plain text alignment file
-			fprintf(outf, ">Alignment%d (%d)\n", i + 1, a->Count());
-			a->print(outf, 'v');
+			fprintf(f, ">Alignment %s:%d-%d (%d)\n", bundle->refseq.chars(),
+					bundle->start, bundle->end, a->Count());
+			a->print(f, 'v');
 		} else { //write a real ACE file
-			//a->buildMSA();
 			GStr ctgname;
-			ctgname.format("AorContig%d", i + 1);
-			a->writeACE(outf, ctgname.chars());
+			ctgname.format("%s:%d-%d", bundle->refseq.chars(), bundle->start, bundle->end);
+			//weigh down the reference to favor consensus from reads
+			a->writeACE(f, ctgname.chars(), true, out.aidx!=NULL ? out.aidx : aceIndex);
+			if (out.sam!=NULL) out.sam->addContig(a, ctgname.chars());
+			else if (samWriter!=NULL) samWriter->write(a, ctgname.chars());
 			a->freeMSA(); //free MSA and seq memory
 		}
 	} // for each PMSA cluster
 	// oooooooooo D O N E oooooooooooo
-	//alns.Clear();
-	//seqs.Clear();
 
 	if (verbose) {
 	  //printTime(stderr);
 	  GMessage("^bundle %s:%d-%d(%d) done.\n",bundle->refseq.chars(),
-	  		bundle->start, bundle->end, bundle->alns.Count());
+	  		bundle->start, bundle->end, bundle->reads.Count());
 	}
 	bundle->Clear();
 }
 
+//-------- multi-threaded bundle processing (-p)
+// the main thread loads bundles from the pool, worker threads build and
+// render them into memory buffers, which are written in loading order
+int num_threads=1;
+BundleData* bundles=NULL; //the pool
+int poolSize=1;
+GVec<BundleData*> bundleQueue; //READY bundles waiting for a worker
+GVec<int> clearPool; //indexes of CLEAR bundles in the pool
+bool moreBundles=true;
+GFastMutex queueMutex; //for bundleQueue, clearPool and moreBundles
+GConditionVar haveBundles; //signals bundleQueue changes or the end of input
+GConditionVar haveClear; //signals clearPool changes
+int numBundles=0; //bundles loaded so far
+GFastMutex writeMutex; //for the output, doneBundles, nextOutNum and the noise counts
+GVec<BundleData*> doneBundles; //DONE bundles waiting for their turn
+int nextOutNum=0; //output order of the next bundle to write
+
+//writes all the processed bundles which are next in order
+//and returns them to the pool; writeMutex must be locked
+void flushBundles() {
+	int i=0;
+	while (i<doneBundles.Count()) {
+		BundleData* b=doneBundles[i];
+		if (b->outnum!=nextOutNum) { i++; continue; }
+		b->out.flush();
+		nextOutNum++;
+		doneBundles.Delete(i);
+		queueMutex.lock();
+		b->status=BUNDLE_STATUS_CLEAR;
+		clearPool.Add(b->idx);
+		queueMutex.unlock();
+		haveClear.notify_one();
+		i=0; //the next one may have been skipped
+	}
+}
+
+void bundleWorker(void*) {
+	while (true) {
+		queueMutex.lock();
+		while (bundleQueue.Count()==0 && moreBundles)
+			haveBundles.wait(queueMutex);
+		if (bundleQueue.Count()==0) { //no more bundles
+			queueMutex.unlock();
+			break;
+		}
+		BundleData* bundle=bundleQueue.Shift();
+		queueMutex.unlock();
+		bundle->out.openBuffers();
+		processBundle(bundle, bundle->out);
+		bundle->out.closeBuffers();
+		GLockGuard<GFastMutex> lock(writeMutex);
+		bundle->status=BUNDLE_STATUS_DONE;
+		doneBundles.Add(bundle);
+		flushBundles();
+	}
+}
+
+//queues a READY bundle for the workers and returns a CLEAR one for loading
+//(waiting for one to be written if the pool is exhausted)
+BundleData* pushBundle(BundleData* bundle) {
+	bundle->outnum=numBundles++;
+	queueMutex.lock();
+	bundleQueue.Add(bundle);
+	haveBundles.notify_one();
+	while (clearPool.Count()==0)
+		haveClear.wait(queueMutex);
+	BundleData* r=&(bundles[clearPool.Pop()]);
+	queueMutex.unlock();
+	r->status=BUNDLE_STATUS_LOADING;
+	return r;
+}
+
+void noMoreBundles() {
+	queueMutex.lock();
+	moreBundles=false;
+	queueMutex.unlock();
+	haveBundles.notify_all();
+}
+
+//collects a read alignment into the current bundle, returning the new bundle end
+int processRead(int currentstart, int currentend, BundleData& bdata, GBamRecord& brec) {
+	bam1_t* b=brec.get_b();
+	int seqlen=b->core.l_qseq;
+	if (seqlen==0) return currentend; //no sequence stored for this read
+	uint32_t* cigar=bam1_cigar(b);
+	int ncigar=b->core.n_cigar;
+	GStr rname(brec.name());
+	if (brec.isPaired()) //mates share the read name
+		rname.format("%s/%d", brec.name(), brec.pairOrder());
+	if (bdata.seqs.Find(rname.chars())) {
+		if (verbose)
+			GMessage("Warning: duplicate read alignment %s at %s:%d ignored.\n",
+					rname.chars(), bdata.refseq.chars(), brec.start);
+		return currentend;
+	}
+	int first=-1, last=-1; //first and last aligned CIGAR operation
+	for (int i=0;i<ncigar;i++) {
+		int op=cigar[i] & BAM_CIGAR_MASK;
+		if (op==BAM_CMATCH || op==BAM_CEQUAL || op==BAM_CDIFF) {
+			if (first<0) first=i;
+			last=i;
+		}
+		else if (op==BAM_CREF_SKIP) {
+			if (verbose)
+				GMessage("Warning: spliced alignment of %s at %s:%d ignored.\n",
+						rname.chars(), bdata.refseq.chars(), brec.start);
+			return currentend;
+		}
+	}
+	if (first<0) return currentend;
+	//soft clips and insertions at the ends are both taken as clipping
+	int clipL=0, clipR=0;
+	for (int i=0;i<ncigar;i++) {
+		if (i>=first && i<=last) continue;
+		int op=cigar[i] & BAM_CIGAR_MASK;
+		if (op==BAM_CSOFT_CLIP || op==BAM_CINS) {
+			if (i<first) clipL+=cigar[i] >> BAM_CIGAR_SHIFT;
+			        else clipR+=cigar[i] >> BAM_CIGAR_SHIFT;
+		}
+	}
+	if (clipmax>0) {
+		int maxovh=(clipmax<1.00)? iround(clipmax * (float)seqlen) : (int)clipmax;
+		if (clipL>maxovh || clipR>maxovh) {
+			if (verbose)
+				GMessage(LOG_MSG_CLIPMAX, rname.chars(), bdata.refseq.chars(), clipmax);
+			return currentend;
+		}
+	}
+	CReadAln* rd=new CReadAln(rname.chars(), brec.start, brec.end);
+	rd->clipL=clipL;
+	rd->clipR=clipR;
+	for (int i=first;i<=last;i++) {
+		int op=cigar[i] & BAM_CIGAR_MASK;
+		//skip padding, or clipping within the alignment
+		if (op==BAM_CMATCH || op==BAM_CEQUAL || op==BAM_CDIFF ||
+				op==BAM_CINS || op==BAM_CDEL)
+			rd->cigar.Add(cigar[i]);
+	}
+	addReadCoverage(bdata, *rd, currentstart);
+	//the BAM sequence is already in reference orientation
+	rd->rev=brec.revStrand() ? 1 : 0;
+	rd->sseq=brec.sequence();
+	rd->seqlen=seqlen;
+	bdata.seqs.Add(rd->name, rd);
+	bdata.reads.Add(rd);
+	return GMAX(currentend, (int)brec.end);
+}
+
+
+
+//source of the alignments for loadBundles()
+class GBamSource {
+public:
+	virtual ~GBamSource() { }
+	virtual GBamRecord* next()=0;
+};
+
+//all the alignments of a BAM file
+class GBamFileSource: public GBamSource {
+	GBamReader reader;
+public:
+	GBamFileSource(const char* fname): reader(fname) { }
+	~GBamFileSource() { reader.bclose(); }
+	GBamRecord* next() { return reader.next(); }
+};
+
+//alignments starting in a region of a sorted, indexed BAM file;
+//the file and the index are not owned
+class GBamRegionSource: public GBamSource {
+	bamFile bf;
+	bam_header_t* hdr;
+	bam_iter_t iter;
+	int rstart; //1-based region start
+public:
+	GBamRegionSource(bamFile f, bam_header_t* h, bam_index_t* idx, int tid, int start, int end):
+			bf(f), hdr(h), iter(NULL), rstart(start) {
+		iter=bam_iter_query(idx, tid, start-1, end);
+	}
+	~GBamRegionSource() { bam_iter_destroy(iter); }
+	GBamRecord* next() {
+		while (true) {
+			bam1_t* b=bam_init1();
+			if (bam_iter_read(bf, iter, b)<0) {
+				bam_destroy1(b);
+				return NULL;
+			}
+			//reads overlapping the region start belong to the previous region
+			if (b->core.pos+1>=rstart)
+				return new GBamRecord(b, hdr, true);
+			bam_destroy1(b);
+		}
+	}
+};
+
+uint bundledist=0;  // reads at what distance should be considered part of separate bundles
+
+//builds bundles from the alignments of src, loading them into the given
+//bundle; bundleDone() is called for each complete bundle and returns the
+//bundle to be loaded next
+void loadBundles(GBamSource& src, GFastaHandler* refcdb, BundleData* bundle,
+		BundleData* (*bundleDone)(BundleData*, void*), void* data) {
+	GStr lastref;
+	int currentstart=0, currentend=0;
+	GBamRecord* brec=NULL;
+	bool more_alns=true;
+	GRefWindow* refwin=NULL; //current genomic sequence, if -r was given
+	if (refcdb!=NULL) refwin=new GRefWindow();
+	int nbnoise=0, nrnoise=0;
+	while (more_alns) {
+		 bool chr_changed=false;
+		 int pos=0;
+		 const char* rname=NULL;
+		 bool new_bundle=false;
+		 delete brec;
+		 if ((brec=src.next())!=NULL) {
+			 if (brec->isUnmapped()) continue;
+			 //secondary and supplementary alignments would place a read twice
+			 if ((brec->get_b()->core.flag & (BAM_FSECONDARY|0x800))!=0) continue;
+			 rname=brec->refName();
+			 if (rname==NULL) GError("Error: cannot retrieve target seq name from BAM record!\n");
+			 pos=brec->start; //BAM is 0 based, but GBamRecord makes it 1-based
+			 chr_changed=(lastref.is_empty() || lastref!=rname);
+			 if (!chr_changed && currentend>0 && pos>currentend+(int)bundledist)
+				   new_bundle=true;
+		 }
+		 else { //no more alignments
+			 more_alns=false;
+			 new_bundle=true; //fake a new start (end of last bundle)
+		 }
+		 if (new_bundle || chr_changed) {
+			 if (bundle->reads.Count()>0 && isNoiseBundle(bundle, currentstart, currentend)) {
+				nbnoise++;
+				nrnoise+=bundle->reads.Count();
+				bundle->Clear();
+			 }
+			 else if (bundle->reads.Count()>0) { // process reads in previous bundle
+				bundle->getReady(currentstart, currentend, refwin);
+				bundle=bundleDone(bundle, data);
+			 } //have alignments to process
+			 else { //no read alignments in this bundle?
+				bundle->Clear();
+			 }
+			 if (chr_changed) {
+				 lastref=rname;
+				 currentend=0;
+				 if (refwin!=NULL)
+					 refwin->setSeq(refcdb, lastref.chars());
+			 }
+			 if (!more_alns) break;
+			currentstart=pos;
+			bundle->refseq=lastref;
+			bundle->start=currentstart;
+			bundle->end=currentend;
+		 } //<---- new bundle
+		 currentend=processRead(currentstart, currentend, *bundle, *brec);
+	} //for each read alignment
+	delete brec;
+	delete refwin;
+	if (nbnoise>0) {
+		GLockGuard<GFastMutex> lock(writeMutex);
+		noiseBundles+=nbnoise;
+		noiseReads+=nrnoise;
+	}
+}
+
+BundleData* writeBundle(BundleData* bundle, void* data) {
+	BundleOutput* o=(BundleOutput*)data;
+	processBundle(bundle, *o);
+	bundle->status=BUNDLE_STATUS_LOADING;
+	return bundle;
+}
+
+BundleData* queueBundle(BundleData* bundle, void*) {
+	return pushBundle(bundle);
+}
+
+//-------- region-parallel processing of an indexed BAM file (-R)
+// the genome is split into chunks at positions where no alignment
+// overlaps (so no bundle can span two chunks), and each chunk is read
+// through the index and processed by a worker thread
+#define CHUNK_MINLEN 1000000 //chunk length limits
+#define CHUNK_MAXLEN 8000000
+#define CHUNK_LOOKAHEAD 2 //chunks per thread which may be ahead of the output
+
+struct BamChunk {
+	int tid;
+	int start; //1-based, alignments starting in [start, end]
+	int end;
+	BundleOutput out;
+	bool done;
+	BamChunk(int t=0, int s=0, int e=0):tid(t), start(s), end(e),
+			out(), done(false) { }
+};
+
+GVec<BamChunk> bamChunks;
+int nextChunk=0; //next chunk to be processed (queueMutex)
+int nextOutChunk=0; //next chunk to be written (writeMutex)
+GConditionVar chunkWritten; //signals nextOutChunk changes
+const char* bamFileName=NULL;
+bam_header_t* bamHeader=NULL;
+bam_index_t* bamIndex=NULL;
+GFastaHandler* chunkRefs=NULL;
+
+//first alignment start at or after pos on target tid which is not
+//overlapped by any alignment starting before it (allowing for bundledist);
+//returns 0 if there is no such position on this target sequence
+int findChunkSplit(bamFile bf, int tid, int pos) {
+	int beg=pos-1-(int)bundledist;
+	if (beg<0) beg=0;
+	bam_iter_t iter=bam_iter_query(bamIndex, tid, beg, bamHeader->target_len[tid]);
+	bam1_t* b=bam_init1();
+	int maxend=0, split=0;
+	while (bam_iter_read(bf, iter, b)>=0) {
+		if (b->core.flag & BAM_FUNMAP) continue;
+		int rstart=b->core.pos+1;
+		if (rstart>=pos && maxend>0 && rstart>maxend+(int)bundledist) {
+			split=rstart;
+			break;
+		}
+		int rend=bam_calend(&b->core, bam1_cigar(b)); //1-based end
+		if (rend>maxend) maxend=rend;
+	}
+	bam_destroy1(b);
+	bam_iter_destroy(iter);
+	return split;
+}
+
+void prepareChunks(int chunklen) {
+	bamFile bf=bam_open(bamFileName, "r");
+	if (bf==NULL) GError("Error: cannot open BAM file %s!\n", bamFileName);
+	for (int tid=0;tid<bamHeader->n_targets;tid++) {
+		int tlen=bamHeader->target_len[tid];
+		int s=1;
+		while (s+chunklen<tlen) {
+			int split=findChunkSplit(bf, tid, s+chunklen);
+			if (split==0) break;
+			bamChunks.Add(BamChunk(tid, s, split-1));
+			s=split;
+		}
+		bamChunks.Add(BamChunk(tid, s, tlen));
+	}
+	bam_close(bf);
+}
 
+//writes the processed chunks which are next in order; writeMutex must be locked
+void flushChunks() {
+	while (nextOutChunk<bamChunks.Count() && bamChunks[nextOutChunk].done) {
+		bamChunks[nextOutChunk].out.flush();
+		nextOutChunk++;
+		chunkWritten.notify_all();
+	}
+}
+
+void chunkWorker(void*) {
+	bamFile bf=bam_open(bamFileName, "r");
+	if (bf==NULL) GError("Error: cannot open BAM file %s!\n", bamFileName);
+	BundleData bundle;
+	while (true) {
+		queueMutex.lock();
+		int ci=nextChunk++;
+		queueMutex.unlock();
+		if (ci>=bamChunks.Count()) break;
+		//bounded lookahead: the output of a chunk is kept in memory until all
+		//the chunks before it are written, so don't get too far ahead of them
+		writeMutex.lock();
+		while (ci-nextOutChunk>=CHUNK_LOOKAHEAD*num_threads)
+			chunkWritten.wait(writeMutex);
+		writeMutex.unlock();
+		BamChunk& c=bamChunks[ci];
+		if (verbose)
+			GMessage(" processing region %s:%d-%d\n", bamHeader->target_name[c.tid], c.start, c.end);
+		BundleOutput out;
+		out.openBuffers();
+		GBamRegionSource src(bf, bamHeader, bamIndex, c.tid, c.start, c.end);
+		bundle.status=BUNDLE_STATUS_LOADING;
+		loadBundles(src, chunkRefs, &bundle, writeBundle, &out);
+		out.closeBuffers();
+		GLockGuard<GFastMutex> lock(writeMutex);
+		c.out=out;
+		c.done=true;
+		flushChunks();
+	}
+	bam_close(bf);
+}
 
 //void loadAlnSeqs(GSeqAlign* aln, GFastaHandler* refcdb = NULL); //, GCdbYank* cdbynk, GCdbYank* refcdb=NULL);
 //void loadRefSeq(GSeqAlign* aln, GFastaHandler* refcdb);
@@ -277,7 +976,7 @@ char* endSpToken(char* str) {
 //========================================================
 int main(int argc, char * const argv[]) {
 	//GArgs args(argc, argv, "DGvd:o:c:");
-	GArgs args(argc, argv, "DGvr:o:c:");
+	GArgs args(argc, argv, "DGIRvr:o:b:c:p:m:S:X:a:P:");
 	GFastaHandler* refcdb = NULL;
 	int e;
 	if ((e = args.isError()) > 0)
@@ -339,6 +1038,35 @@ int main(int argc, char * const argv[]) {
 			GError("Cannot open file %s for writing!\n", outfile.chars());
 	} else
 		outf = stdout;
+	s = args.getOpt('b');
+	if (!s.is_empty())
+		samWriter = new GSamWriter(s.chars());
+	if (args.getOpt('I') != NULL) {
+		if (outfile.is_empty())
+			GError("Error: -I requires an ACE output file (-o)!\n");
+		s = outfile;
+		s.append(".idx");
+		if ((idxf = fopen(s.chars(), "w")) == NULL)
+			GError("Cannot create file %s for writing!\n", s.chars());
+		aceIndex = new GAceIndex(idxf);
+	}
+	s = args.getOpt('m');
+	if (!s.is_empty()) {
+		maxDepth = s.asInt();
+		if (maxDepth <= 0)
+			GError("Error: invalid -m <maxdepth> value (%s)!\n", s.chars());
+		s = args.getOpt('S');
+		if (!s.is_empty())
+			depthSeed = (uint64)strtoull(s.chars(), NULL, 10);
+		GStr dropfile = args.getOpt('X');
+		if (dropfile.is_empty()) {
+			dropfile = outfile.is_empty() ? "bamcons" : outfile.chars();
+			dropfile.append(".dropped");
+		}
+		dropf = fopen(dropfile.chars(), "w");
+		if (dropf == NULL)
+			GError("Cannot open file %s for writing!\n", dropfile.chars());
+	}
 	//************************************************
 
 	/*
@@ -352,80 +1080,100 @@ int main(int argc, char * const argv[]) {
 		refcdb = new GFastaHandler(s.chars());
 	}
 
-	GBamReader bamreader(infile.chars());
-	GStr lastref;
-	int currentstart=0, currentend=0;
-
-	BundleData bundles[1];
-	BundleData* bundle = &(bundles[0]);
-	int readthr=3;      // read coverage per bundle bp to accept it; otherwise considered noise
-	uint bundledist=0;  // reads at what distance should be considered part of separate bundles
-
-
-	GBamRecord* brec=NULL;
-	bool more_alns=true;
-	GASeq* refseq=NULL;
-	while (more_alns) {
-		 bool chr_changed=false;
-		 int pos=0;
-		 const char* rname=NULL;
-		 int nh=1;
-		 int hi=0;
-		 bool new_bundle=false;
-		 delete brec;
-		 if ((brec=bamreader.next())!=NULL) {
-			 if (brec->isUnmapped()) continue;
-			 rname=brec->refName();
-			 if (rname==NULL) GError("Error: cannot retrieve target seq name from BAM record!\n");
-			 pos=brec->start; //BAM is 0 based, but GBamRecord makes it 1-based
-			 chr_changed=(lastref.is_empty() || lastref!=rname);
-			 if (chr_changed) {
-				 //TODO: load chr sequence here
-				 refseq=new GASeq(lastref.chars(), 0, 0);
-				 refseq->setFlag(flag_IS_REF);
-			 }
-			 if (!chr_changed && currentend>0 && pos>currentend+(int)bundledist)
-				   new_bundle=true;
-		 }
-		 else { //no more alignments
-			 more_alns=false;
-			 new_bundle=true; //fake a new start (end of last bundle)
-		 }
-		 if (new_bundle || chr_changed) {
-			 //hashread.Clear();
-			 if (bundle->alns.Count()>0) { // process reads in previous bundle
-				// geneno=infer_transcripts(geneno, lastref, $label,\@readlist,$readthr,\@junction,$junctionthr,$mintranscriptlen,\@keepguides);
-				// (readthr, junctionthr, mintranscriptlen are globals)
-				bundle->getReady(currentstart, currentend);
-				//TODO: processBundle(bundle);
-			 } //have alignments to process
-			 else { //no read alignments in this bundle?
-				bundle->Clear();
-			 }
-			 if (chr_changed) {
-				 lastref=rname;
-				 currentend=0;
-			 }
-			 if (!more_alns) {
-					if (verbose) {
-						//printTime(stderr);
-						GMessage(" Done reading alignments.\n");
-					}
-				 //noMoreBundles();
-				 break;
-			 }
-			currentstart=pos;
-			bundle->refseq=lastref;
-			bundle->start=currentstart;
-			bundle->end=currentend;
-		 } //<---- new bundle
-		 //TODO:
-		 //currentend=processRead(currentstart, currentend, *bundle, *brec);
-	} //for each read alignment
-
-	 //cleaning up
-	 delete brec;
-	 bamreader.bclose();
+	s = args.getOpt('a');
+	if (!s.is_empty()) {
+		readthr = (float)atof(s.chars());
+		if (readthr <= 0)
+			GError("Error: invalid -a <min_avg_cov> value (%s)!\n", s.chars());
+	}
+	s = args.getOpt('P');
+	if (!s.is_empty()) {
+		peakthr = (float)atof(s.chars());
+		if (peakthr <= 0)
+			GError("Error: invalid -P <min_peak_cov> value (%s)!\n", s.chars());
+	}
+	s = args.getOpt('p');
+	if (!s.is_empty()) {
+		num_threads = s.asInt();
+		if (num_threads <= 0)
+			GError("Error: invalid -p <threads> value (%s)!\n", s.chars());
+	}
+	if (args.getOpt('R') != NULL) {
+		bamFileName = infile.chars();
+		bamFile bf = bam_open(bamFileName, "r");
+		if (bf == NULL)
+			GError("Error: cannot open BAM file %s!\n", bamFileName);
+		bamHeader = bam_header_read(bf);
+		bam_close(bf);
+		bamIndex = bam_index_load(bamFileName);
+		if (bamIndex == NULL)
+			GError("Error: -R requires a BAM index (%s.bai)!\n", bamFileName);
+		//several chunks per thread, to even out the load, but small enough
+		//that the buffered output of the lookahead chunks stays bounded
+		int64 glen = 0;
+		for (int i = 0; i < bamHeader->n_targets; i++)
+			glen += bamHeader->target_len[i];
+		int64 chunklen = glen / (num_threads * 8);
+		if (chunklen > CHUNK_MAXLEN) chunklen = CHUNK_MAXLEN;
+		if (chunklen < CHUNK_MINLEN) chunklen = CHUNK_MINLEN;
+		prepareChunks((int)chunklen);
+		if (verbose)
+			GMessage(" %d genomic regions to process.\n", bamChunks.Count());
+		chunkRefs = refcdb;
+		GThread** workers = NULL;
+		GMALLOC(workers, num_threads * sizeof(GThread*));
+		for (int i = 0; i < num_threads; i++)
+			workers[i] = new GThread(chunkWorker, NULL);
+		for (int i = 0; i < num_threads; i++) {
+			workers[i]->join();
+			delete workers[i];
+		}
+		GFREE(workers);
+		bam_index_destroy(bamIndex);
+		bam_header_destroy(bamHeader);
+	}
+	else {
+		//a few bundles per worker; a bundle only returns to the pool after
+		//its output was written, so this also bounds memory usage
+		if (num_threads > 1)
+			poolSize = num_threads * 2;
+		bundles = new BundleData[poolSize];
+		for (int i = 0; i < poolSize; i++) {
+			bundles[i].idx = i;
+			if (i > 0) clearPool.Add(i);
+		}
+		GThread** workers = NULL;
+		if (num_threads > 1) {
+			GMALLOC(workers, num_threads * sizeof(GThread*));
+			for (int i = 0; i < num_threads; i++)
+				workers[i] = new GThread(bundleWorker, NULL);
+		}
+		bundles[0].status = BUNDLE_STATUS_LOADING;
+		{
+			GBamFileSource bamsrc(infile.chars());
+			BundleOutput directOut(outf, dropf);
+			if (num_threads > 1)
+				loadBundles(bamsrc, refcdb, &(bundles[0]), queueBundle, NULL);
+			else
+				loadBundles(bamsrc, refcdb, &(bundles[0]), writeBundle, &directOut);
+		}
+		if (verbose) {
+			//printTime(stderr);
+			GMessage(" Done reading alignments.\n");
+		}
+		noMoreBundles();
+		if (num_threads > 1) {
+			for (int i = 0; i < num_threads; i++) {
+				workers[i]->join();
+				delete workers[i];
+			}
+			GFREE(workers);
+		}
+		delete[] bundles;
+	}
+	 if (noiseBundles > 0)
+	    GMessage(" %d bundles (%d reads) discarded as noise due to low coverage.\n",
+	        noiseBundles, noiseReads);
 	 if (verbose) {
 	    //printTime(stderr);
 	    GMessage(" Done.\n");
@@ -442,6 +1190,16 @@ int main(int argc, char * const argv[]) {
 	fflush(outf);
 	if (outf != stdout)
 		fclose(outf);
+	if (dropf != NULL)
+		fclose(dropf);
+	if (idxf != NULL) {
+		delete aceIndex;
+		fclose(idxf);
+	}
+	if (samWriter != NULL) {
+		samWriter->close();
+		delete samWriter;
+	}
 	delete refcdb;
 	GMessage("*** all done ***\n");
 #ifdef __WIN32__
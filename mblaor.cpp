@@ -7,12 +7,17 @@
 #include "GList.hh"
 #include "GCdbYank.h"
 #include "GapAssem.h"
+#include "GCompress.h"
+#include "GDepthCap.h"
+#include "GSamWriter.h"
+#include "GBinLayout.h"
 #define USAGE "Usage:\n\
  mblaor <nrcl_layouts_w_gapinfo> -d <fastadb.cidx> [-r <ref_db.cidx]\n\
-    [-o <outfile_ace>] [-c <clipmax[%]>] [-p <ref_prefix>]\n\
+    [-o <outfile_ace>] [-b <outfile.bam>] [-c <clipmax[%]>] [-p <ref_prefix>]\n\
+    [-m <maxdepth> [-S <seed>] [-X <dropped_file>]] [-I]\n\
     \n\
    <nrcl_layouts_w_gapinfo> is the .lyt file with alignment information\n\
-               as produced by nrcl\n\
+               as produced by nrcl (or its binary form, .lytb)\n\
    -d cdb index (created with cdbfasta) for a multi-fasta file containing\n\
       the actual nucleotide sequences of the components (required)\n\
    -r cdb index for a multi-fasta file with the reference sequences\n\
@@ -25,6 +30,15 @@
       clipping is estimated for each read as <clipmax> percent\n\
       of its length\n\
    -o the output acefile is written to <outfile.ace> instead of stdout\n\
+   -b also write the contigs as SAM/BAM alignments (BAM if <outfile.bam>\n\
+      ends in .bam), with the consensus sequences written into <outfile>.fa\n\
+   -I also write an index of the contigs in <outfile.ace> into\n\
+      <outfile.ace>.idx, for random access with acefetch\n\
+   -m downsample the reads of each layout so that no more than <maxdepth>\n\
+      reads cover any reference position; the selection is deterministic\n\
+      for a given <seed> (-S, default 0)\n\
+   -X the names of the reads dropped by -m are written into <dropped_file>\n\
+      along with their reference name (default: <outfile_ace>.dropped)\n\
    -G do not remove consensus gaps (default is to edit sequences\n\
       in order to remove gap-dominated columns in MSA)\n"
 
@@ -63,6 +77,8 @@ class RefAlign {
   ~RefAlign();
   int nextRefGap(int& pos);
   int nextSeqGap(int& pos);
+  //collect all the gaps: [0] in the read, [1] in the reference
+  void getGaps(GVec<int>* gpos, GVec<int>* glen);
  };
 
 void loadAlnSeqs(GSeqAlign* aln, GCdbYank* cdbynk, GCdbYank* refcdb=NULL);
@@ -80,6 +96,244 @@ char* endSpToken(char* str) {
  return p; // *p is '\0'
 }
 
+//-- depth capping (-m): the lines of each layout are read ahead, and the
+//   component lines of reads dropped from ultra-deep layouts are skipped,
+//   so no alignment is ever built for them
+int maxDepth=0;
+uint64 depthSeed=0;
+static FILE* dropf=NULL;
+
+class LytDepthReader {
+  GLineReader* lr;
+  GVec<char*> lines; //lines of the current layout
+  GVec<int> lens;
+  int lpos; //next line to return
+  char* nextref; //header line of the next layout, already read
+  int nextreflen;
+  int curlen;
+  void clearLines() {
+    for (int i=0;i<lines.Count();i++) GFREE(lines[i]);
+    lines.Clear();
+    lens.Clear();
+    lpos=0;
+    }
+  void loadLayout();
+ public:
+  LytDepthReader(FILE* f):lr(new GLineReader(f)), lines(), lens(), lpos(0),
+      nextref(NULL), nextreflen(0), curlen(0) { }
+  ~LytDepthReader() {
+    clearLines();
+    GFREE(nextref);
+    delete lr;
+    }
+  char* getLine() {
+    if (maxDepth<=0) return lr->getLine();
+    if (lpos>=lines.Count()) loadLayout();
+    if (lpos>=lines.Count()) return NULL;
+    curlen=lens[lpos];
+    return lines[lpos++];
+    }
+  int tlength() { return (maxDepth<=0) ? lr->tlength() : curlen; }
+  bool isEof() {
+    if (maxDepth<=0) return lr->isEof();
+    return (lpos>=lines.Count() && nextref==NULL && lr->isEof());
+    }
+};
+
+//reads the next layout and drops the reads exceeding maxDepth
+void LytDepthReader::loadLayout() {
+  clearLines();
+  if (nextref!=NULL) {
+    lines.Add(nextref);
+    lens.Add(nextreflen);
+    nextref=NULL;
+    }
+  char* line;
+  while ((line=lr->getLine())!=NULL) {
+    if (line[0]=='>' && lines.Count()>0) {
+      nextref=Gstrdup(line);
+      nextreflen=lr->tlength();
+      break;
+      }
+    lines.Add(Gstrdup(line));
+    lens.Add(lr->tlength());
+    }
+  if (lines.Count()==0 || lines[0][0]!='>') return;
+  char* refname=&(lines[0][1]);
+  char* re=endSpToken(refname);
+  int rnlen=re-refname;
+  GDepthCap cap(maxDepth, depthSeed);
+  GVec<int> lidx; //line index of each read added to cap
+  for (int i=1;i<lines.Count();i++) {
+    //<readName> <orientation> <read_length> <read_start_coord> ...
+    char* p=lines[i];
+    char* e=endSpToken(p);
+    if (e==NULL || *e==0) continue;
+    if (e-p==rnlen && strncmp(p, refname, rnlen)==0)
+      continue; //the reference itself, skipped later anyway
+    char* q=e;
+    skipSp(q);
+    q++;
+    int rlen=0, rstart=0;
+    if (!parseInt(q, rlen) || !parseInt(q, rstart) || rlen<=0) continue;
+    char c=*e;
+    *e=0;
+    cap.add(p, rstart, rstart+rlen-1);
+    *e=c;
+    lidx.Add(i);
+    }
+  GVec<bool> keep;
+  int ndrop=cap.select(keep);
+  if (ndrop==0) return;
+  char rc=*re;
+  *re=0;
+  if (verbose)
+    GMessage("Layout %s: %d reads dropped due to -m %d\n", refname, ndrop, maxDepth);
+  for (int k=lidx.Count()-1;k>=0;k--) {
+    if (keep[k]) continue;
+    int i=lidx[k];
+    char* e=endSpToken(lines[i]);
+    *e=0;
+    if (dropf!=NULL) fprintf(dropf, "%s\t%s\n", lines[i], refname);
+    GFREE(lines[i]);
+    lines.Delete(i);
+    lens.Delete(i);
+    }
+  *re=rc;
+}
+
+//start a new layout on reference ref_name, with the given coordinates
+//and (optional) nucleotide sequence
+GASeq* addRefSeq(const char* ref_name, int ref_lend, int ref_rend, const char* seq) {
+  if (seqs.Find(ref_name))
+     GError("Error (line %d): reference sequence %s is not unique in the input data\n",
+                          rlineno+1,ref_name);
+  int ref_len=ref_rend;
+  GASeq* refseq=new GASeq(ref_name, 0, ref_len,
+                    ref_lend-1, ref_len-ref_rend, 0);
+  refseq->setFlag(GA_flag_IS_REF);
+  seqs.Add(ref_name,refseq);
+  if (seq==NULL) return refseq;
+  for (const char* p=seq; *p!=0 && *p!='\n'; p++) {
+    if (*p!='\t' && *p!=' ') refseq->extendSeq(*p);
+    }
+  if (refseq->len>0) {
+     refseq->endSeq();
+     if (refseq->len!=refseq->seqlen)
+       GError("Error: reference sequence %s length mismatch "
+              "(declared %d, found %d)\n",
+               refseq->id, refseq->seqlen, refseq->len);
+     }
+  return refseq;
+}
+
+//add the alignment of a component sequence to its reference;
+//gpos/glen[0] are the gaps in the read, [1] the gaps in the reference
+//returns false if the read was rejected
+bool addComponent(GASeq* refseq, const char* name, int offset, int seqlen,
+          int clip5, int clip3, char reverse, GVec<int>* gpos, GVec<int>* glen) {
+  if (seqs.Find(name))
+     GError("Error (line %d): component sequence %s must be unique in the input data\n",
+                  rlineno+1,name);
+  if (clipmax>0) {
+    //check if any of the clipping involved is larger than clipmax
+    int maxovh=(clipmax<1.00)?
+           iround(clipmax * (float)seqlen) :
+           (int)clipmax;
+    if (clip3>maxovh || clip5>maxovh) {
+      if (verbose)
+        fprintf(stderr, LOG_MSG_CLIPMAX,
+                name, refseq->id, clipmax);
+      return false;
+      }// bad mismatching overhangs
+    }
+  GASeq* aseq=new GASeq(name,offset,seqlen,clip5,clip3,reverse);
+  GASeq* rseq;
+  if (refseq->msa==NULL) {
+    rseq=refseq;
+    }
+  else rseq=new GASeq(refseq->id,0,refseq->seqlen,
+                           refseq->clp5,refseq->clp3,0);
+  for (int i=0;i<gpos[1].Count();i++)
+       rseq->setGap(gpos[1][i]-1,glen[1][i]);
+  for (int i=0;i<gpos[0].Count();i++)
+       aseq->setGap(gpos[0][i]-1,glen[0][i]);
+  //for mgblast alignment, only the query can be reversed
+  if (aseq->revcompl==1)
+        aseq->reverseGaps(); //don't update offset & reverse flags
+
+  GSeqAlign *newaln=new GSeqAlign(rseq, aseq);
+  if (rseq==refseq) {//first alignment with refseq
+    newaln->incOrd();
+    alns.Add(newaln);
+    return true;
+    }
+  refseq->msa->addAlign(refseq,newaln,rseq);
+  delete newaln;
+  seqs.Add(aseq->name(),aseq);
+  return true;
+}
+
+//load all the layouts of a binary layout file (nrcl -y <file.lytb>);
+//the depth capping (-m) is applied to each layout here
+void loadBinLayouts(GBinLayoutReader& blr, GCdbYank* cdbyank, GCdbYank* refcdb) {
+  GBinLayout lyt;
+  GVec<int> gpos[2];
+  GVec<int> glen[2];
+  GVec<bool> rdrop; //reads dropped by -m
+  for (int l=0;l<blr.numLayouts;l++) {
+    blr.getLayout(l, lyt);
+    if (ref_prefix!=NULL && !startsWith(lyt.name, ref_prefix)) {
+      rlineno+=lyt.numReads+1;
+      continue;
+      }
+    GASeq* refseq=addRefSeq(lyt.name, lyt.lend, lyt.rend, lyt.seq);
+    rlineno++;
+    rdrop.Clear();
+    for (int i=0;i<lyt.numReads;i++) {
+      bool b=false;
+      rdrop.Add(b);
+      }
+    if (maxDepth>0) {
+      GDepthCap cap(maxDepth, depthSeed);
+      GVec<int> ridx; //read index of each read added to cap
+      for (int i=0;i<lyt.numReads;i++) {
+        if (lyt.len[i]<=0 || strcmp(lyt.readName(i), lyt.name)==0) continue;
+        cap.add(lyt.readName(i), lyt.start[i], lyt.start[i]+lyt.len[i]-1);
+        ridx.Add(i);
+        }
+      GVec<bool> keep;
+      int ndrop=cap.select(keep);
+      if (ndrop>0 && verbose)
+        GMessage("Layout %s: %d reads dropped due to -m %d\n", lyt.name, ndrop, maxDepth);
+      for (int k=ridx.Count()-1;k>=0 && ndrop>0;k--) {
+        if (keep[k]) continue;
+        rdrop[ridx[k]]=true;
+        if (dropf!=NULL) fprintf(dropf, "%s\t%s\n", lyt.readName(ridx[k]), lyt.name);
+        }
+      }
+    for (int i=0;i<lyt.numReads;i++) {
+      const char* rname=lyt.readName(i);
+      if (rdrop[i] || strcmp(rname, refseq->id)==0) {
+        rlineno++;
+        continue;
+        }
+      if (!lyt.getGaps(i, gpos, glen))
+        GError("Error: invalid gap data for %s in layout %s!\n", rname, lyt.name);
+      char reverse=(lyt.strand[i]=='-') ? 1 : 0;
+      int clip5=lyt.clipL[i];
+      int clip3=lyt.clipR[i];
+      if (reverse!=0) Gswap(clip5, clip3);
+      if (addComponent(refseq, rname, lyt.start[i]-1, lyt.len[i],
+                       clip5, clip3, reverse, gpos, glen) && debugMode) {
+        for (int a=0;a<alns.Count();a++)
+          printDebugAln(outf,alns.Get(a),a+1,cdbyank, refcdb);
+        }
+      rlineno++;
+      }
+    }
+}
+
 //-- prepareMerge checks clipping and even when no clipmax is given,
 //   adjusts clipping as appropriately
 
@@ -88,7 +342,7 @@ char* endSpToken(char* str) {
 //========================================================
 int main(int argc, char * const argv[]) {
  //GArgs args(argc, argv, "DGvd:o:c:");
- GArgs args(argc, argv, "DGvd:p:r:o:c:");
+ GArgs args(argc, argv, "DGIvd:p:r:o:b:c:m:S:X:");
  int e;
  if ((e=args.isError())>0)
     GError("%s\nInvalid argument: %s\n", USAGE, argv[e]);
@@ -104,14 +358,16 @@ int main(int argc, char * const argv[]) {
         //GMessage("Given file: %s\n",infile.chars());
         }
  //==
- FILE* inf;
+ FILE* inf=NULL;
+ GBinLayoutReader* blr=NULL;
  if (!infile.is_empty()) {
-    inf=fopen(infile, "r");
-    if (inf==NULL)
+    if (GBinLayoutReader::isBinary(infile.chars()))
+       blr=new GBinLayoutReader(infile.chars());
+    else if ((inf=zfopenRead(infile))==NULL)
        GError("Cannot open input file %s!\n",infile.chars());
     }
   else
-   inf=stdin;
+   inf=zfwrapRead(stdin);
   GStr s=args.getOpt('c');
   if (!s.is_empty()) {
       bool ispercent=(s[-1]=='%');
@@ -139,11 +395,25 @@ int main(int argc, char * const argv[]) {
   ref_prefix=args.getOpt('p');
   GStr outfile=args.getOpt('o');
   if (!outfile.is_empty()) {
-     outf=fopen(outfile, "w");
+     outf=zfopenWrite(outfile);
      if (outf==NULL)
         GError("Cannot open file %s for writing!\n",outfile.chars());
      }
    else outf=stdout;
+  GSamWriter* samwriter=NULL;
+  s=args.getOpt('b');
+  if (!s.is_empty()) samwriter=new GSamWriter(s.chars());
+  FILE* fidx=NULL;
+  if (args.getOpt('I')!=NULL) {
+    if (outfile.is_empty() || endsWith(outfile.chars(), ".gz") ||
+                endsWith(outfile.chars(), ".bgz"))
+      GError("Error: -I requires an uncompressed ACE output file (-o)!\n");
+    s=outfile;
+    s.append(".idx");
+    if ((fidx=fopen(s.chars(), "w"))==NULL)
+      GError("Cannot create file %s for writing!\n",s.chars());
+    }
+  GAceIndex aceidx(fidx);
   //************************************************
 
 
@@ -156,16 +426,35 @@ int main(int argc, char * const argv[]) {
   if (!dbidx.is_empty())
     refcdb=new GCdbYank(dbidx.chars());
 
-  GLineReader* linebuf=new GLineReader(inf);
-  char* line;
+  s=args.getOpt('m');
+  if (!s.is_empty()) {
+    maxDepth=s.asInt();
+    if (maxDepth<=0) GError("%sError: invalid -m value!\n", USAGE);
+    s=args.getOpt('S');
+    if (!s.is_empty()) depthSeed=(uint64)strtoull(s.chars(), NULL, 10);
+    GStr dropfile=args.getOpt('X');
+    if (dropfile.is_empty()) {
+      if (outfile.is_empty()) dropfile="mblaor.dropped";
+        else { dropfile=outfile; dropfile.append(".dropped"); }
+      }
+    dropf=fopen(dropfile.chars(), "w");
+    if (dropf==NULL)
+      GError("Cannot open file %s for writing!\n",dropfile.chars());
+    }
   alns.setSorted(compareOrdnum);
+  if (blr!=NULL) {
+    loadBinLayouts(*blr, cdbyank, refcdb);
+    delete blr;
+    }
+  LytDepthReader* linebuf=(inf!=NULL) ? new LytDepthReader(inf) : NULL;
+  char* line;
   GASeq* refseq=NULL; // current reference sequence
   int ref_numseqs=0;
-  int ref_len=0;
   int ref_lend=0, ref_rend=0;
-  int gaplen,gappos;
+  GVec<int> gpos[2]; //gaps in the read [0] and in the reference [1]
+  GVec<int> glen[2];
   bool skipRefContig=false;
-  while ((line=linebuf->getLine())!=NULL) {
+  while (linebuf!=NULL && (line=linebuf->getLine())!=NULL) {
    RefAlign* aln=NULL;
    if (line[0]=='>') {
      //establish current reference
@@ -182,9 +471,6 @@ int main(int argc, char * const argv[]) {
               }
           }
      *p=0;
-     if (seqs.Find(ref_name))
-        GError("Error (line %d): reference sequence %s is not unique in the input data\n",
-                             rlineno+1,ref_name);
      p++;
      if (!parseInt(p,ref_numseqs))
            GError("Error parsing the number of components for reference sequence %s\n",ref_name);
@@ -192,78 +478,20 @@ int main(int argc, char * const argv[]) {
            GError("Error parsing the left end of reference sequence %s\n",ref_name);
      if (!parseInt(p,ref_rend))
            GError("Error parsing the right end of reference sequence %s\n",ref_name);
-     ref_len=ref_rend;
-     refseq=new GASeq(ref_name, 0, ref_len,
-                       ref_lend-1, ref_len-ref_rend, 0);
-     refseq->setFlag(GA_flag_IS_REF);
-     seqs.Add(ref_name,refseq);
      //may be followed by actual nucleotide sequence of this reference
-     while (*p!=0 && *p!='\n') {
-       if (*p!='\t' && *p!=' ') refseq->extendSeq(*p);
-       p++;
-       }
-     if (refseq->len>0) {
-        refseq->endSeq();
-        if (refseq->len!=refseq->seqlen)
-          GError("Error: reference sequence %s length mismatch "
-                 "(declared %d, found %d)\n",
-                  refseq->id, refseq->seqlen, refseq->len);
-        }
+     refseq=addRefSeq(ref_name, ref_lend, ref_rend, p);
      goto NEXT_LINE_NOCHANGE;
      } //reference line
    //-- component/read line --
    if (skipRefContig) goto NEXT_LINE_NOCHANGE;
-     else {
-   //else:
-   //-------------------------------------------
    aln=new RefAlign(line, linebuf->tlength(), rlineno+1);
    if (strcmp(aln->seqname, refseq->id)==0)
      goto NEXT_LINE_NOCHANGE; //skip redundant inclusion of reference as its own child
-   if (seqs.Find(aln->seqname))
-      GError("Error (line %d): component sequence %s must be unique in the input data\n",
-                    rlineno+1,aln->seqname);
-   if (clipmax>0) {
-     //check if any of the clipping involved is larger than clipmax
-     int maxovh=(clipmax<1.00)?
-            iround(clipmax * (float)aln->seqlen) :
-            (int)clipmax;
-     if (aln->clip3>maxovh || aln->clip5>maxovh) {
-       if (verbose)
-         fprintf(stderr, LOG_MSG_CLIPMAX,
-                 aln->seqname, refseq->id, clipmax);
-       goto NEXT_LINE_NOCHANGE;
-       }// bad mismatching overhangs
-     }
-   GASeq* aseq=new GASeq(aln->seqname,aln->offset,aln->seqlen,
-                           aln->clip5,aln->clip3,aln->reverse);
-   GASeq* rseq;
-   if (refseq->msa==NULL) {
-     rseq=refseq;
-     }
-   else rseq=new GASeq(refseq->id,0,refseq->seqlen,
-                            refseq->clp5,refseq->clp3,0);
-   gappos=0;
-   while ((gaplen=aln->nextRefGap(gappos))>0)
-        rseq->setGap(gappos-1,gaplen);
-   gappos=0;
-   while ((gaplen=aln->nextSeqGap(gappos))>0)
-        aseq->setGap(gappos-1,gaplen);
-   //for mgblast alignment, only the query can be reversed
-   if (aseq->revcompl==1)
-         aseq->reverseGaps(); //don't update offset & reverse flags
-
-   GSeqAlign *newaln=new GSeqAlign(rseq, aseq);
-   if (rseq==refseq) {//first alignment with refseq
-     newaln->incOrd();
-     alns.Add(newaln);
-     goto NEXT_LINE;
-     }
-   refseq->msa->addAlign(refseq,newaln,rseq);
-   delete newaln;
-   seqs.Add(aseq->name(),aseq);
-   }// parsing new alignment
+   aln->getGaps(gpos, glen);
+   if (!addComponent(refseq, aln->seqname, aln->offset, aln->seqlen,
+                     aln->clip5, aln->clip3, aln->reverse, gpos, glen))
+     goto NEXT_LINE_NOCHANGE;
    //---------------------
- NEXT_LINE:
    /* debug print the progressive alignment */
    if (debugMode) {
     for (int a=0;a<alns.Count();a++) {
@@ -302,9 +530,20 @@ int main(int argc, char * const argv[]) {
      }
    else {//write a real ACE file
      //a->buildMSA(true);
+     //no gaps were inserted in the reference: try the pileup consensus
+     a->tryPileup=true;
+     for (int j=0;j<a->Count();j++) {
+       GASeq* s=a->Get(j);
+       if (s->hasFlag(GA_flag_IS_REF) && s->getNumGaps()!=0) {
+         a->tryPileup=false;
+         break;
+         }
+       }
      GStr ctgname;
      ctgname.format("AorContig%d",i+1);
-     a->writeACE(outf, ctgname.chars(), true); //weigh down refs to favor consensus from reads
+     //weigh down refs to favor consensus from reads
+     a->writeACE(outf, ctgname.chars(), true, fidx!=NULL ? &aceidx : NULL);
+     if (samwriter!=NULL) samwriter->write(a, ctgname.chars());
      a->freeMSA(); //free MSA and seq memory
      }
    } // for each PMSA cluster
@@ -312,8 +551,14 @@ int main(int argc, char * const argv[]) {
   alns.Clear();
   seqs.Clear();
   fflush(outf);
-  if (outf!=stdout) fclose(outf);
-  if (inf!=stdin) fclose(inf);
+  if (outf!=stdout) zfclose(outf);
+  if (fidx!=NULL) fclose(fidx);
+  if (samwriter!=NULL) {
+    samwriter->close();
+    delete samwriter;
+    }
+  if (inf!=NULL && inf!=stdin) zfclose(inf);
+  if (dropf!=NULL) fclose(dropf);
   delete cdbyank;
   delete refcdb;
   //GFREE(ref_prefix);
@@ -400,6 +645,23 @@ int RefAlign::nextSeqGap(int& pos) {
  return r;
 }
 
+void RefAlign::getGaps(GVec<int>* gpos, GVec<int>* glen) {
+ for (int k=0;k<2;k++) {
+   gpos[k].Clear();
+   glen[k].Clear();
+   }
+ int pos=0, len;
+ while ((len=nextSeqGap(pos))>0) {
+   gpos[0].Add(pos);
+   glen[0].Add(len);
+   }
+ pos=0;
+ while ((len=nextRefGap(pos))>0) {
+   gpos[1].Add(pos);
+   glen[1].Add(len);
+   }
+}
+
 int RefAlign::nextRefGap(int& pos) {
  int r=1;
  if (gpos_onref==NULL || *gpos_onref==0) return 0;
@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 //#define ALIGN_COVERAGE_DATA
 #include "GArgs.h"
 #include "GStr.h"
@@ -8,12 +11,22 @@
 #include "GList.hh"
 #include "GCdbYank.h"
 #include "GapAssem.h"
+#include "GBinHits.h"
+#include "GHitSort.h"
+#include "GCompress.h"
+#include "GSamWriter.h"
 #define USAGE "Usage:\n\
- mblasm <mgblast_sortedhits> -d <fastadb.cidx>\n\
-   [-c <clipmax>] [-o <outfile.ace>] [-l <dbload.ald>] [-G][-N][-v]\n\
-   [-r <restrict_list>] [-x <exclude_list>]\n\n\
+ mblasm <mgblast_sortedhits> [<mgblast_sortedhits2> ..] -d <fastadb.cidx>\n\
+   [-c <clipmax>] [-o <outfile.ace>] [-b <outfile.bam>] [-l <dbload.ald>]\n\
+   [-I][-G][-N][-v]\n\
+   [-r <restrict_list>] [-x <exclude_list>]\n\
+   [-k <checkpoint_file> [-K <N>]] [--resume <checkpoint_file>]\n\
+   [-u [-M <mem_MB>] [-p <threads>]]\n\n\
    <mgblast_sortedhits> is a mgblast tabulated data w/ gap info\n\
                         sorted by alignment score\n\
+                        (or the same hits converted by mgbconv);\n\
+                        multiple sorted files (e.g. from sharded mgblast\n\
+                        runs) are merged on the fly by score\n\
    -d multi-fasta database index (cdbfasta) for all the sequences\n\
       (required parameter)\n\n\
  Options:\n\
@@ -22,12 +35,28 @@
       if followed by % then maximum clipping is estimated for\n\
       each read as <clipmax> percent of its length\n\
    -o the output acefile is written to <outfile.ace> instead of stdout\n\
+   -b also write the contigs as SAM/BAM alignments (BAM if <outfile.bam>\n\
+      ends in .bam), with the consensus sequences written into <outfile>.fa\n\
+   -I also write an index of the contigs in <outfile.ace> into\n\
+      <outfile.ace>.idx, for random access with acefetch\n\
    -l write a data file <dbload.ald> with all indels and other MSA\n\
       information for each read, suitable for database loading\n\
    -x ignore any hits involving reads listed in file <exclude_list>\n\
    -r only consider hits between reads listed in file <restrict_list>\n\
    -G do not remove consensus gaps in the ACE output\n\
    -N do not refine clipping at the end of each read in the MSA\n\
+   -k save the whole assembly state into <checkpoint_file> every 1000000\n\
+      input lines (or every <N> lines if -K is given); the snapshot is\n\
+      written in the background, by a forked copy of the process\n\
+   --resume restore the assembly state saved in <checkpoint_file> and\n\
+      continue from that point in <mgblast_sortedhits> (which must be\n\
+      the same, regular file); checkpointing continues into the same\n\
+      file unless -k is also given\n\
+   -u the hits are not sorted yet: sort them by score first, using\n\
+      an external sort; multiple hit files can be given and they are\n\
+      all sorted together\n\
+   -M memory limit (in MB) for the -u sorting (default: 1024)\n\
+   -p number of threads used for the -u sorting (default: 1)\n\
    -v verbose mode (report some progress)\n"
 
 // -p a posteriori detection of chimeric reads and reporting
@@ -54,12 +83,21 @@ GList<GSeqAlign> alns(true, true, false);
                 // sorted, free element, not unique
 
 float clipmax=0;
+
+#define CHKPT_MAGIC "MBLCKPT"
+#define CHKPT_VERSION 1
+GStr chkfile; //checkpoint file (-k)
+int chkinterval=1000000; //checkpoint every this many input lines
+pid_t chkpid=0; //background checkpoint writer, if any
 //--------------------------------
 class MGPairwise {
   const char* linecpy;
   char* line; //local duplicate
   int lineno;
   char* gpos[2];
+  GBinHit* bhit; //binary input record, if any
+  int gidx[2]; //next gap in bhit's gap lists
+  void setup(char c);
  public:
   bool rejected;
   char* seqname[2];
@@ -85,6 +123,7 @@ class MGPairwise {
   char* gaps[2];
   void parseErr(int fldno);
   MGPairwise(const char* line_in, int len, int lno);
+  MGPairwise(GBinHit& hit, int lno);
   ~MGPairwise();
   int nextGap(int seqidx, int& pos);
  };
@@ -92,6 +131,9 @@ class MGPairwise {
 int readNames(FILE* f, GHash<int>& xhash);
 void loadAlnSeqs(GSeqAlign* aln, GCdbYank* cdbynk);
 void printDebugAln(FILE* f, GSeqAlign* aln, int num, GCdbYank* cdbynk);
+void saveCheckpoint(const char* fname, FILE* inf, FILE* fltout);
+void waitCheckpoint(const char* fname);
+void loadCheckpoint(const char* fname, off_t& inpos, off_t& fltpos);
 
 //-- prepareMerge checks clipping and even when no clipmax is given,
 //   adjusts clipping as appropriately
@@ -105,7 +147,7 @@ void prepareAlnMerge(GASeq& h, GASeq& q, AlnClipOps& qclipops);
 //====================     main      =====================
 //========================================================
 int main(int argc, char * const argv[]) {
- GArgs args(argc, argv, "ADGNvd:r:f:x:s:o:c:");
+ GArgs args(argc, argv, "ADGINuvd:r:f:x:s:o:b:c:k:K:M:p:resume=");
  int e;
  if ((e=args.isError())>0)
     GError("%s\nInvalid argument: %s\n", USAGE, argv[e]);
@@ -122,15 +164,47 @@ int main(int argc, char * const argv[]) {
         infile=args.nextNonOpt();
         //GMessage("Given file: %s\n",infile.chars());
         }
+ GHitSorter* hsort=NULL;
+ if (args.getOpt('u')!=NULL) {
+   if (infile.is_empty())
+     GError("Error: option -u requires the hits file(s) to be given!\n");
+   GStr s=args.getOpt('M');
+   int sortmem=s.is_empty() ? 1024 : s.asInt();
+   s=args.getOpt('p');
+   int sortthreads=s.is_empty() ? 1 : s.asInt();
+   if (sortmem<=0 || sortthreads<=0)
+     GError("Error: invalid -M or -p value (positive integers are expected)!\n");
+   hsort=new GHitSorter(sortthreads, sortmem);
+   hsort->addFile(infile.chars());
+   char* fname;
+   while ((fname=args.nextNonOpt())!=NULL)
+     hsort->addFile(fname);
+   }
+ GHitMerger* hmerge=NULL;
+ if (hsort==NULL) {
+   char* fname=args.nextNonOpt();
+   if (fname!=NULL) { //multiple sorted files: merge them by score
+     hmerge=new GHitMerger();
+     hmerge->addFile(infile.chars());
+     do {
+       hmerge->addFile(fname);
+       } while ((fname=args.nextNonOpt())!=NULL);
+     }
+   }
  //==
- FILE* inf;
- if (!infile.is_empty()) {
-    inf=fopen(infile, "r");
+ FILE* inf=NULL;
+ bool binhits=false;
+ if (hsort==NULL && hmerge==NULL) {
+  if (!infile.is_empty()) {
+    inf=zfopenRead(infile);
     if (inf==NULL)
        GError("Cannot open input file %s!\n",infile.chars());
     }
   else
-   inf=stdin;
+   inf=zfwrapRead(stdin);
+  //hits converted by mgbconv are recognized by their header
+  binhits=GBinHitReader::isBinary(inf);
+  }
   GStr s=args.getOpt('c');
   if (!s.is_empty()) {
       bool ispercent=(s[-1]=='%');
@@ -182,17 +256,65 @@ int main(int argc, char * const argv[]) {
    
   GStr outfile=args.getOpt('o');
   if (!outfile.is_empty()) {
-     outf=fopen(outfile, "w");
+     outf=zfopenWrite(outfile);
      if (outf==NULL)
         GError("Cannot open file %s for writing!\n",outfile.chars());
      }
    else outf=stdout;
+  GSamWriter* samwriter=NULL;
+  s=args.getOpt('b');
+  if (!s.is_empty()) samwriter=new GSamWriter(s.chars());
+  FILE* fidx=NULL;
+  if (args.getOpt('I')!=NULL) {
+    if (outfile.is_empty() || endsWith(outfile.chars(), ".gz") ||
+                endsWith(outfile.chars(), ".bgz"))
+      GError("Error: -I requires an uncompressed ACE output file (-o)!\n");
+    s=outfile;
+    s.append(".idx");
+    if ((fidx=fopen(s.chars(), "w"))==NULL)
+      GError("Cannot create file %s for writing!\n",s.chars());
+    }
+  GAceIndex aceidx(fidx);
   //************************************************
 
+  chkfile=args.getOpt('k');
+  s=args.getOpt('K');
+  if (!s.is_empty()) {
+    chkinterval=s.asInt();
+    if (chkinterval<=0) GError("Error: invalid -K value (%s), a positive "
+                               "number of lines is expected!\n", s.chars());
+    }
+  alns.setSorted(compareOrdnum);
+  off_t resume_inpos=0;
+  off_t resume_fltpos=0;
+  GStr resumefile=args.getOpt("resume");
+  if ((binhits || hsort!=NULL || hmerge!=NULL) && (!chkfile.is_empty() || !resumefile.is_empty()))
+    GError("Error: checkpointing is only supported for a single, already sorted\n"
+           " file of tabulated (text) hits!\n");
+  if (!resumefile.is_empty()) {
+    if (inf==stdin)
+      GError("Error: --resume requires the input file of the checkpointed run "
+             "(cannot seek into stdin)!\n");
+    loadCheckpoint(resumefile.chars(), resume_inpos, resume_fltpos);
+    if (fseeko(inf, resume_inpos, SEEK_SET)!=0)
+      GError("Error: cannot seek to offset %lld in %s!\n",
+                                 (long long)resume_inpos, infile.chars());
+    if (verbose) GMessage("Resuming from %s: %d alignments, %d lines processed.\n",
+                               resumefile.chars(), alns.Count(), rlineno);
+    if (chkfile.is_empty()) chkfile=resumefile;
+    }
+  if (!chkfile.is_empty() && (inf==stdin || ftello(inf)<0))
+    GError("Error: checkpointing requires the hits to be read from a regular file!\n");
+
   s=args.getOpt('f');
   FILE* fltout=NULL;
   if (!s.is_empty()) {
-    if ((fltout=fopen(s,"w"))==NULL) 
+    if (!resumefile.is_empty()) {
+      //drop whatever was written after the checkpoint was taken
+      if (truncate(s.chars(), resume_fltpos)!=0 || (fltout=fopen(s,"a"))==NULL)
+        GError("Cannot reopen file %s for appending!\n",s.chars());
+      }
+    else if ((fltout=fopen(s,"w"))==NULL) 
         GError("Cannot create file %s for writing!\n",s.chars());
     }
 
@@ -203,18 +325,41 @@ int main(int argc, char * const argv[]) {
   GCdbYank* cdbyank=new GCdbYank(dbidx.chars());
 
   //TESTING -- start reading and print every alignment found
-  GLineReader* linebuf=new GLineReader(inf);
-  char* line;
-  alns.setSorted(compareOrdnum);
+  GLineReader* linebuf=NULL;
+  GBinHitReader* hitrd=NULL;
+  GHitSource* hsrc=NULL; //score ordered lines from multiple files
+  if (hsort!=NULL) {
+    if (verbose) fprintf(stderr, "Sorting hits..\n");
+    hsort->sort();
+    if (verbose) fprintf(stderr, "%d hits sorted.\n", hsort->numLines);
+    hsrc=hsort;
+    }
+  else if (hmerge!=NULL) hsrc=hmerge;
+  else if (binhits) hitrd=new GBinHitReader(inf);
+  else linebuf=new GLineReader(inf);
+  char* line=NULL;
+  int linelen=0;
+  GStr hitline; //text form of a binary hit, for -f
   
   if (verbose) fprintf(stderr, "Processing hits..\n");
   //-==================== HITS PARSING =========================-
-  while ((line=linebuf->getLine())!=NULL) {
+  while (hitrd!=NULL ? hitrd->next() :
+           (hsrc!=NULL ? (line=hsrc->nextLine(linelen))!=NULL :
+                         (line=linebuf->getLine())!=NULL)) {
+   if (linebuf!=NULL) linelen=linebuf->tlength();
    //parse fields as needed
-   MGPairwise mgpw(line, linebuf->tlength(), rlineno+1);
-   if (mgpw.rejected) continue;
-   if (fltout!=NULL) 
-     fprintf(fltout, "%s\n",line); 
+   MGPairwise* pmgpw= (hitrd!=NULL) ? new MGPairwise(hitrd->hit, rlineno+1) :
+                      new MGPairwise(line, linelen, rlineno+1);
+   MGPairwise& mgpw=*pmgpw;
+   //rejected lines still count, so rlineno always matches the input offset
+   if (mgpw.rejected) goto NEXT_LINE_NOCHANGE;
+   if (fltout!=NULL) {
+     if (hitrd!=NULL) {
+       hitrd->hit.toLine(hitline);
+       fprintf(fltout, "%s\n", hitline.chars());
+       }
+     else fprintf(fltout, "%s\n",line); 
+     }
      
    GASeq* s[2];
    GSeqAlign *pwaln;
@@ -423,8 +568,11 @@ int main(int argc, char * const argv[]) {
     }
  NEXT_LINE_NOCHANGE:
     //------------
-   if (linebuf->isEof()) break;
+   delete pmgpw;
+   if (linebuf!=NULL && linebuf->isEof()) break;
    rlineno++;
+   if (!chkfile.is_empty() && rlineno%chkinterval==0)
+      saveCheckpoint(chkfile.chars(), inf, fltout);
    //-------------
    /*if (verbose) {
      if (rlineno%1000==0) {
@@ -435,6 +583,9 @@ int main(int argc, char * const argv[]) {
      }*/
    }  //-------- line parsing loop
   delete linebuf;
+  delete hitrd;
+  delete hsrc;
+  if (chkpid>0) waitCheckpoint(chkfile.chars());
   if (verbose) {
      fprintf(stderr, "%d input lines processed.\n",rlineno);
      fprintf(stderr, "Refining and printing %d MSA(s)..\n", alns.Count());
@@ -452,8 +603,9 @@ int main(int argc, char * const argv[]) {
    else {//write actual ACE file
      GStr ctgname;
      ctgname.format("MblContig%d",i+1);
-     a->writeACE(outf, ctgname.chars()); 
+     a->writeACE(outf, ctgname.chars(), false, fidx!=NULL ? &aceidx : NULL);
      //writeACE() also calls buildMSA() and so
+     if (samwriter!=NULL) samwriter->write(a, ctgname.chars());
      a->freeMSA(); //free MSA and seq memory
      }
    }
@@ -464,8 +616,13 @@ int main(int argc, char * const argv[]) {
   if (fltXclude) xcludeList.Clear();
   if (fltRestrict) seqonlyList.Clear();
   fflush(outf);
-  if (outf!=stdout) fclose(outf);
-  if (inf!=stdin) fclose(inf);
+  if (outf!=stdout) zfclose(outf);
+  if (fidx!=NULL) fclose(fidx);
+  if (samwriter!=NULL) {
+    samwriter->close();
+    delete samwriter;
+    }
+  if (inf!=NULL && inf!=stdin) zfclose(inf);
   delete cdbyank;
 
   //GMessage("*** all done ***\n");
@@ -477,7 +634,11 @@ int main(int argc, char * const argv[]) {
 
 //---------------------- MGPairwise class
 void MGPairwise::parseErr(int fldno) {
- fprintf(stderr, "Error parsing input line #%d (field %d):\n%s\n",
+ if (linecpy==NULL)
+   fprintf(stderr, "Error parsing binary hit record #%d (field %d)\n",
+         lineno, fldno);
+ else
+   fprintf(stderr, "Error parsing input line #%d (field %d):\n%s\n",
          lineno, fldno, linecpy);
  exit(3);
 }
@@ -490,6 +651,7 @@ MGPairwise::MGPairwise(const char* line_in, int len, int lno) {
   fields[13]=NULL;
   line=Gstrdup(line_in);
   linecpy=line_in;
+  bhit=NULL;
   
   for (int i=0;i<len;i++) {
      if (line[i]=='\t') {
@@ -527,6 +689,46 @@ MGPairwise::MGPairwise(const char* line_in, int len, int lno) {
    if (!parseNumber(fields[10], score2))   parseErr(10);
    char c=(fields[11][0]);
    if (c!='-' && c!='+') parseErr(11);
+   setup(c);
+   gaps[0]=fields[12];
+   gaps[1]=fields[13];
+   gpos[0]=gaps[0];
+   gpos[1]=gaps[1];
+   }
+
+MGPairwise::MGPairwise(GBinHit& hit, int lno) {
+  lineno=lno;
+  line=NULL;
+  linecpy=NULL;
+  bhit=&hit;
+  rejected=true;
+  if (fltXclude && (xcludeList.hasKey(hit.qname) ||
+                    xcludeList.hasKey(hit.hname))) return;
+  if (fltRestrict && !(seqonlyList.hasKey(hit.qname) &&
+                       seqonlyList.hasKey(hit.hname))) return;
+  rejected=false;
+  seqname[0]=hit.qname;
+  seqlen[0]=hit.qlen;
+  ovlStart[0]=hit.q5;
+  ovlEnd[0]=hit.q3;
+  seqname[1]=hit.hname;
+  seqlen[1]=hit.hlen;
+  ovlStart[1]=hit.h5;
+  ovlEnd[1]=hit.h3;
+  pid=hit.pid;
+  score1=hit.score;
+  score2=hit.score2;
+  setup(hit.strand);
+  gaps[0]=NULL;
+  gaps[1]=NULL;
+  gpos[0]=NULL;
+  gpos[1]=NULL;
+  gidx[0]=0;
+  gidx[1]=0;
+  }
+
+//overlap, offsets and clipping, once the fields were loaded
+void MGPairwise::setup(char c) {
    ovl[1]=ovlEnd[1]-ovlStart[1]+1;
    a5[1]=ovlStart[1];
    a3[1]=ovlEnd[1];
@@ -652,10 +854,6 @@ MGPairwise::MGPairwise(const char* line_in, int len, int lno) {
      if (clip3[0]>clip3[1]) clip3[0]=0;
                      else clip3[1]=0;
      }
-   gaps[0]=fields[12];
-   gaps[1]=fields[13];
-   gpos[0]=gaps[0];
-   gpos[1]=gaps[1];
    }
 
 MGPairwise::~MGPairwise() {
@@ -664,6 +862,14 @@ MGPairwise::~MGPairwise() {
 
 int MGPairwise::nextGap(int seqidx, int& pos) {
  int r=1;
+ if (bhit!=NULL) {
+   int i=gidx[seqidx];
+   if (i>=bhit->gpos[seqidx].Count()) return 0;
+   pos=bhit->gpos[seqidx][i];
+   if (pos<=0) parseErr(12+seqidx);
+   gidx[seqidx]++;
+   return bhit->glen[seqidx][i];
+   }
  if (gpos[seqidx]==NULL || *gpos[seqidx]==0) return 0;
  if (!parseInt(gpos[seqidx],pos)) parseErr(12+seqidx);
  if (pos<=0) parseErr(12+seqidx);
@@ -950,6 +1156,115 @@ char newqrev = qclipops.q_rev ^ q.revcompl; //XOR
   }
 }
 
+//-------------------- checkpointing
+// file layout: CHKPT_MAGIC, version, byte order tag, input offset,
+// filtered hits output offset, rlineno, GSeqAlign counter, alignment count,
+// then each GSeqAlign::writeState() dump; CHKPT_MAGIC again at the end
+bool writeCheckpoint(const char* fname, off_t inpos, off_t fltpos) {
+  GStr tmpfile(fname);
+  tmpfile+=".tmp";
+  FILE* f=fopen(tmpfile.chars(), "wb");
+  if (f==NULL) return false;
+  uint32_t hdr[2]={CHKPT_VERSION, 0x01020304};
+  int64_t fpos[2]={inpos, fltpos};
+  int32_t cdata[2]={rlineno, alns.Count()};
+  uint32_t counter=GSeqAlign::getCounter();
+  bool ok=(fwrite(CHKPT_MAGIC, 1, 8, f)==8 &&
+           fwrite(hdr, sizeof(hdr), 1, f)==1 &&
+           fwrite(fpos, sizeof(fpos), 1, f)==1 &&
+           fwrite(cdata, sizeof(cdata), 1, f)==1 &&
+           fwrite(&counter, sizeof(counter), 1, f)==1);
+  for (int i=0;ok && i<alns.Count();i++)
+     ok=alns.Get(i)->writeState(f);
+  ok = ok && fwrite(CHKPT_MAGIC, 1, 8, f)==8;
+  ok = ok && fflush(f)==0 && fsync(fileno(f))==0;
+  if (fclose(f)!=0) ok=false;
+  //only replace the previous checkpoint with a complete one
+  if (ok) ok=(rename(tmpfile.chars(), fname)==0);
+  if (!ok) remove(tmpfile.chars());
+  return ok;
+}
+
+void saveCheckpoint(const char* fname, FILE* inf, FILE* fltout) {
+  if (chkpid>0) { //previous snapshot still being written?
+    int status=0;
+    pid_t r=waitpid(chkpid, &status, WNOHANG);
+    if (r==0) {
+      if (verbose) GMessage("Checkpoint at line %d skipped (previous one not done yet)\n",
+                             rlineno);
+      return;
+      }
+    if (r<0 || !WIFEXITED(status) || WEXITSTATUS(status)!=0)
+      GMessage("Warning: failed to write checkpoint file %s!\n", fname);
+    chkpid=0;
+    }
+  off_t inpos=ftello(inf);
+  off_t fltpos=0;
+  if (fltout!=NULL) {
+    fflush(fltout);
+    fltpos=ftello(fltout);
+    }
+  //the forked child gets a copy-on-write snapshot of the whole layout
+  //and writes it out while the parent goes on with the merging
+  pid_t pid=fork();
+  if (pid==0) {
+     _exit(writeCheckpoint(fname, inpos, fltpos) ? 0 : 1);
+     }
+  if (pid<0) { //cannot fork, just write it here
+     if (!writeCheckpoint(fname, inpos, fltpos))
+        GMessage("Warning: failed to write checkpoint file %s!\n", fname);
+     return;
+     }
+  chkpid=pid;
+  if (verbose) GMessage("Checkpoint at line %d (input offset %lld)\n",
+                            rlineno, (long long)inpos);
+}
+
+void waitCheckpoint(const char* fname) {
+  int status=0;
+  if (waitpid(chkpid, &status, 0)<0 || !WIFEXITED(status) ||
+          WEXITSTATUS(status)!=0)
+     GMessage("Warning: failed to write checkpoint file %s!\n", fname);
+  chkpid=0;
+}
+
+void loadCheckpoint(const char* fname, off_t& inpos, off_t& fltpos) {
+  FILE* f=fopen(fname, "rb");
+  if (f==NULL) GError("Cannot open checkpoint file %s!\n", fname);
+  char magic[8];
+  uint32_t hdr[2];
+  int64_t fpos[2];
+  int32_t cdata[2];
+  uint32_t counter=0;
+  if (fread(magic, 1, 8, f)!=8 || memcmp(magic, CHKPT_MAGIC, 8)!=0)
+    GError("Error: %s is not a mblasm checkpoint file!\n", fname);
+  if (fread(hdr, sizeof(hdr), 1, f)!=1 || hdr[1]!=0x01020304)
+    GError("Error: checkpoint file %s was written on a different platform!\n", fname);
+  if (hdr[0]!=CHKPT_VERSION)
+    GError("Error: unsupported checkpoint version (%u) in %s!\n", hdr[0], fname);
+  if (fread(fpos, sizeof(fpos), 1, f)!=1 || fread(cdata, sizeof(cdata), 1, f)!=1 ||
+      fread(&counter, sizeof(counter), 1, f)!=1)
+    GError("Error: checkpoint file %s is truncated!\n", fname);
+  for (int i=0;i<cdata[1];i++) {
+    GSeqAlign* aln=GSeqAlign::readState(f);
+    if (aln==NULL)
+      GError("Error: checkpoint file %s is truncated or corrupt (alignment %d)!\n",
+                 fname, i+1);
+    alns.Add(aln);
+    for (int j=0;j<aln->Count();j++) {
+      GASeq* s=aln->Get(j);
+      seqs.Add(s->name(), s);
+      }
+    }
+  if (fread(magic, 1, 8, f)!=8 || memcmp(magic, CHKPT_MAGIC, 8)!=0)
+    GError("Error: checkpoint file %s is truncated or corrupt!\n", fname);
+  fclose(f);
+  inpos=fpos[0];
+  fltpos=fpos[1];
+  rlineno=cdata[0];
+  GSeqAlign::setCounter(counter);
+}
+
 int readNames(FILE* f, GHash<int>& xhash) {
   int c;
   int count=0;
@@ -0,0 +1,76 @@
+#include "GBase.h"
+#include "GArgs.h"
+#include "GStr.h"
+#include "GBinHits.h"
+#include "GCompress.h"
+
+#define USAGE "Usage:\n\
+ mgbconv [-d] [-o <outfile>] [<hits_file>]\n\
+ Converts mgblast tabulated hits (-D3..-D5 output) into the compact binary\n\
+ hits format accepted by mblasm, nrcl, tclust and sclust, so the text is\n\
+ only parsed once.\n\
+ <hits_file> is read from stdin if not given; it can be gzip compressed.\n\
+ Options:\n\
+ -d  decode: convert a binary hits file back to tabulated text\n\
+ -o  write the output into <outfile> instead of stdout\n\
+"
+
+int main(int argc, char * const argv[]) {
+ GArgs args(argc, argv, "hdo:");
+ int e;
+ if ((e=args.isError())>0)
+    GError("%s\nInvalid argument: %s\n", USAGE, argv[e]);
+ if (args.getOpt('h')!=NULL) GError("%s\n", USAGE);
+ bool decode=(args.getOpt('d')!=NULL);
+ GStr infile;
+ if (args.startNonOpt()) {
+   infile=args.nextNonOpt();
+   }
+ FILE* inf=NULL;
+ if (!infile.is_empty()) {
+   inf=zfopenRead(infile);
+   if (inf==NULL)
+     GError("Cannot open input file %s!\n",infile.chars());
+   }
+ else inf=zfwrapRead(stdin);
+ FILE* outf=stdout;
+ GStr outfile=args.getOpt('o');
+ if (!outfile.is_empty()) {
+   outf=zfopenWrite(outfile);
+   if (outf==NULL)
+     GError("Cannot open file %s for writing!\n",outfile.chars());
+   }
+ int numhits=0;
+ if (decode) {
+   GBinHitReader hitrd(inf);
+   GStr line;
+   while (hitrd.next()) {
+     hitrd.hit.toLine(line);
+     fprintf(outf, "%s\n", line.chars());
+     numhits++;
+     }
+   }
+ else {
+   if (GBinHitReader::isBinary(inf))
+     GError("Error: input is already in binary hits format (use -d to decode it)!\n");
+   GBinHitWriter hitwr(outf);
+   GBinHit hit;
+   char* line;
+   int lineno=0;
+   GLineReader lr(inf);
+   while ((line=lr.getLine())!=NULL) {
+     lineno++;
+     if (lr.length()<4 || line[0]=='#') continue;
+     GStr linecpy(line);
+     int errfld;
+     if (!hit.parseLine(line, errfld))
+       GError("Error parsing input line #%d (field %d):\n%s\n",
+                       lineno, errfld, linecpy.chars());
+     hitwr.write(hit);
+     numhits++;
+     }
+   }
+ GMessage("%d hits converted.\n", numhits);
+ if (outf!=stdout) zfclose(outf);
+ if (inf!=stdin) zfclose(inf);
+}
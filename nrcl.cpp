@@ -5,7 +5,11 @@
 #include "GArgs.h"
 #include "GStr.h"
 #include "GHash.hh"
-#include "GList.hh"
+#include "GVec.hh"
+#include "GBinHits.h"
+#include "GCompress.h"
+#include "GBinLayout.h"
+#include "GThreads.h"
 
 #define usage "Perform containment clustering by filtering tabulated hits.\n\
 The 'representative' (longest) sequences are listed first within each cluster.\n\
@@ -13,14 +17,17 @@ The 'representative' (longest) sequences are listed first within each cluster.\n
 Usage:\n\
  nrcl [<hits_file>] [-H] [-t] [-n] [-S] [-o <out_file>] [-y <layouts_file>]\n\
  [-L] [-l <parent_list>] [-p <parent_prefix] [SEQFLT={ET|EST|ET2EST}]\n\
- [-c <clsfile>] [-x <excludefile>] [-f <flthits_file>] [-d <debug_tree>]\n\
+ [-c <clsfile> [-T <threads>]] [-x <excludefile>] [-f <flthits_file>]\n\
+ [-d <debug_tree>]\n\
  [SCOV=xx] [OVHANG=xx] [SCORE=xx] [PID=xx]\n\
  Options:\n\
  -n  : non-unique sequence representation across clusters; allow clusters \n\
        to share sequences\n\
  -t  : assume containment transitivity (tree structure)\n\
  -o  : write output in <out_file> instead of stdout\n\
- -y  : write cluster layouts to file <layouts_file>\n\
+ -y  : write cluster layouts to file <layouts_file> (BGZF compressed\n\
+       if the file name ends in .gz, or in the binary layout format\n\
+       if it ends in .lytb)\n\
  -f  : write to <flthits_file> all the lines that passed the filters\n\
  -S  : write the 'singletons' to the result file too\n\
  -d  : write the containment tree into file <debug_tree>\n\
@@ -37,6 +44,10 @@ Filters:\n\
           the same cluster. This option causes the creation of two extra files:\n\
           a containment layout file <clsfile>.lyt and a container-formatted \n\
           cluster file (one container per line) <clsfile>.scls\n\
+     -T   with -c, process the loaded clusters in parallel, using <threads>\n\
+          threads; the clusters are then written in the order they were\n\
+          loaded (by size within each loaded cluster), and all the hits\n\
+          passing the filters are kept in memory until they are processed\n\
      -x   discard any pairs/hits related to sequences listed in <excludefile>\n\
 SEQFLT=   filter sequence names for specific sequence type clustering: \n\
           EST  - EST-only clustering (use only ESTvsEST hits) \n\
@@ -52,9 +63,11 @@ SCORE=xx  is the minimum score for a match to be considered\n\
 If <hits_file> is not given, hits are expected at stdin\n\
 Each input line must have these tabulated fields:\n\n\
 q_name q_len q_n5 q_n3 hit_name hit_len hit_n5 hit_n3 pid score xscore strand\n\
- [q_gapinfo hit_gapinfo]\n"
+ [q_gapinfo hit_gapinfo]\n\
+(binary hits files created by mgbconv are also accepted)\n"
 
 #define ERR_INVALID_PAIR "Invalid input line encountered:\n%s\n"
+#define ERR_INVALID_HIT "Invalid hit line at byte offset %lld of the input!\n"
 #define ERR_CL_PARSE "Error parsing cluster file at line:\n%s\n"
 
 
@@ -62,6 +75,7 @@ bool by_length=false;
 bool wclusters=false;
 bool npWeights=false;
 bool namesLoaded=false;
+bool storeGaps=false; //keep the gap lists of the overlaps, for the layouts
 int inbuf_len=1024; //starting inbuf capacity
 char* inbuf=NULL; // incoming buffer for sequence lines.
 const char* prefix="np|";
@@ -72,99 +86,116 @@ FILE* fscls=NULL;
 
 int readClusters(FILE* f);
 
-class GCluster;
-
-class CNode {
- public:
-   char* id; //actual node ID
-   bool isFull;
-   int pweight;
-   int ordnum; //creation order#
-   int len; //sequence length
-   char* gaps;  //list of gaps, as given by mgblast -D5
-   char* pgaps; //list of gaps on parent, ..
-   unsigned char lytminus;
-   int lytpos;
-   //=== if it's a master sequence:
-   int numseqs; //final number of sequences "swallowed" by this sequence
-                //(across the whole subtree, if transitivity is allowed)
-   //int l_start; // the leftmost coordinate of an overlap with a child
-   //int r_end;   // the rightmost coordinate of an overlap with a child
-   //=== if its a child sequence:  
-   int poffs; //offset relative to left end of the parent sequence
-   short pclipL, pclipR; // overhangs for the overlap of this with the parent
-   unsigned char pminus; //1 if complement overlap to parent sequence
-   //CNode* longest; //longest sequence found to include this one
-   CNode* parent; //best parent sequence for this sequence (best scoring overlap)
-   //====
-   //the relation is validated at the end only if parent is the same with cluster->master
-   int pscore; //current parent overlap score 
-   //
-   //unsigned char seqtype;
-   GCluster* kids; //list of all child nodes (seqs) found to be contained into this
-   GCluster* cluster; //for the wcluster option
-   GCluster* contained; //just at the end this will collect all contained sequences
-   CNode(char* name, int slen, int ordn=-1);
-
-   /*-- node creation when loading from cluster file --*/
-   CNode(char* name, GCluster*& cl, int ordn);
-
-   //directly set the parent as specified, with no other checking
-   void setParent(CNode* np, int offs, int clpL, int clpR,
-                    int score, bool minus, char* g=NULL, char* pg=NULL);
-
-   //check if a sequence np is to be assigned as "parent" to this
-   //returns true if parenting works according to the sequence AND/OR link weights
-   //or false if the parenting is reversed!
-   bool assignParent(CNode* np, int score, int offs, int clpL, int clpR,
-                                  bool minus, char* g=NULL, char* pg=NULL);
-   ~CNode();
-
-  //-- container comparison operators: just pointer based
-    bool operator==(CNode& d){
-     return (this==&d);
-     }
-    bool operator>(CNode& d){
-     return (this>&d);
-     }
-    bool operator<(CNode& d){
-     return (this<&d);
-     }
- };
-
-class GCluster :public GList<CNode> {
- public:
-  int total;
-  bool operator==(GCluster& d){
-     return (this==&d);
-     }
-  bool operator>(GCluster& d){
-     return (this>&d);
-     }
-  bool operator<(GCluster& d){
-     return (this<&d);
-     }
-  GCluster():GList<CNode>(true,false,false) {
-    //default is: sorted by Node pointer, don't free nodes, unique
-    //size=0;
-    total=0;
-    }
-  GCluster(bool sorted, bool free_elements=false, bool beUnique=false):
-     GList<CNode>(sorted,free_elements,beUnique) {
-    //size=0;
-    total=0;
-    }
-  void addNode(CNode* c) {
-    Add(c);
-    //size++;
-    total++;
-    }
-  };
-
-// when use clusters, keep them here:
-GList<GCluster> tclusters(false, false,false);
-                     //not sorted, not free, non-unique
-
+//======== node store
+//the nodes (sequences) are identified by their index (in creation order),
+//their data being kept in these parallel arrays
+GHash<int> nodeIds; //node name -> node index
+GVec<char*> nodeNames; //pointers into the string arena
+GVec<int> nodeLen; //sequence length
+GVec<int> nodeOrd; //creation order#
+GVec<int> nodeWeight; //parenting weight (-w)
+GVec<unsigned char> nodeFlags; //NODE_* bits
+//=== if it's a child sequence:
+GVec<int> nodeParent; //best parent sequence (best scoring overlap), -1 if none
+GVec<int> nodePOffs; //offset relative to left end of the parent sequence
+GVec<short> nodeClipL; //overhangs for the overlap of this with the parent
+GVec<short> nodeClipR;
+GVec<int> nodePScore; //current parent overlap score
+//the lists of gaps (as given by mgblast -D5) on this and on the parent
+//are only kept if storeGaps is set: the list of this node is at offset
+//nodeGapOfs (-1 if none) in gapArena, and the parent's list is at
+//nodePGapOfs from it (both '\0' terminated, and possibly empty)
+GVec<int64> nodeGapOfs;
+GVec<int> nodePGapOfs;
+//=== if it's a parent sequence:
+GVec<int> nodeNumKids; //number of child sequences assigned so far
+GVec<int> nodeCluster; //loaded cluster index (-c)
+
+#define NODE_FULL     0x01 //full length sequence (parenting priority)
+#define NODE_PMINUS   0x02 //complement overlap to parent sequence
+#define NODE_LYTMINUS 0x04 //reverse complemented in the cluster layout
+#define NODE_MEMBER   0x08 //written in the cluster of another sequence (-c)
+
+//the data used for parenting the nodes and collecting their clusters;
+//with -T each worker thread has its own, for the loaded clusters it takes
+struct CNrclData {
+  int idx; //index in nrclData
+  //with shared inclusions, a sequence remains a kid of all its previous
+  //parents, so all the (parent, kid) assignments are kept here
+  GVec<int> shareEdges;
+  //child lists (CSR) of the nodes from nbase, built once the parenting is
+  //final: the kids of node n are kidList[kidStart[n-nbase] .. kidStart[n-nbase+1]-1]
+  int nbase;
+  GVec<int> kidStart;
+  GVec<int> kidList;
+  //the members of each cluster are collected here (starting at
+  //the root's mStart, in pre-order of the containment tree)
+  GVec<int> clmembers;
+  GVec<int> clsubtree; //subtree size of each clmembers entry (transitive only)
+  unsigned char* visited; //bitmap of collected nodes (from nbase)
+  int visitedCap;
+  GVec<int> dfsPos; //traversal stack: clmembers position of each node..
+  GVec<int> dfsKid; //..and the kidList position of its next kid to visit
+  CNrclData():idx(0), shareEdges(), nbase(0), kidStart(), kidList(),
+      clmembers(), clsubtree(), visited(NULL), visitedCap(0), dfsPos(), dfsKid() { }
+  ~CNrclData() { GFREE(visited); }
+};
+
+CNrclData* nrclData=NULL; //one for each thread
+
+//the nodes of loaded cluster i (-c) are clStart[i] .. clStart[i+1]-1
+GVec<int> clStart;
+
+//-- cluster-parallel mode (-c with -T)
+int num_threads=1;
+bool clParallel=false;
+//a hit kept in memory until its loaded cluster is processed
+struct CHit {
+  int qn; //query node
+  int hn; //hit node
+  int qlen;
+  int hlen;
+  int q5; //overlap start coordinates (leftmost)
+  int h5;
+  int qovl; //overlap lengths
+  int hovl;
+  int score;
+  int pid;
+  bool minus;
+  int64 gofs; //the gap lists as "qgaps\0hgaps\0" in gapArena, -1 if none
+};
+GVec<CHit> clHits; //in input order
+//the hits of loaded cluster i are clHits[clHitIdx[clHitStart[i] .. clHitStart[i+1]-1]]
+int* clHitStart=NULL;
+int* clHitIdx=NULL;
+int* clWorker=NULL; //the nrclData index of the thread which processed each cluster
+int nextCluster=0; //next loaded cluster to be taken by a worker
+#define CL_TASK_SIZE 64 //clusters taken at once by a worker
+
+//-- set at output time, for each node:
+int* numSeqs=NULL; //final number of sequences "swallowed" by this sequence
+                   //(across the whole subtree, if transitivity is allowed)
+int* lytPos=NULL;  //position in the cluster layout
+int* mStart=NULL;  //start of this cluster's members in clmembers (roots only),
+                   //in the nrclData of the thread which collected it
+int* nContained=NULL; //number of sequences written for this cluster (-c)
+
+//string arena: node names are copied into large blocks,
+//which are only freed at the end
+#define STRBLOCK_SIZE 1048576
+GVec<char*> strBlocks;
+char* strPtr=NULL;
+int strLeft=0;
+//gap lists of the parent overlaps (if storeGaps is set)
+char* gapArena=NULL;
+int64 gapArenaLen=0;
+int64 gapArenaCap=0;
+
+//positions where the current input line was split in place, to be
+//restored when the line is written to the filtered hits file (-f)
+char* lineCuts[4];
+char lineCutChr[4];
+int numLineCuts=0;
 
 bool transitive=false;
 bool asfasta=true;
@@ -174,13 +205,6 @@ bool do_share=true; //allow clusters sharing sequences
 GHash<int> excludeList;
 GHash<int> fullGenes;
 
-//-- global hash containing all the nodes with structured links info
-// holds all the nodes
-//if cluster-targeted containment, 
-GHash<CNode> all;
-
-GList<CNode> seqs(false,false,false);
-
 #ifdef DBGTRACE
    GShMem mem("nrcl", 4096);
    GShMem memsum("nrclsum", 1024);
@@ -192,8 +216,8 @@ class COverlap {
  public:
  char* id1;
  char* id2;
- CNode* n1;
- CNode* n2;
+ int n1;
+ int n2;
  int len1;
  int len2;
  int o1start; //overlap start coordinate (leftmost) on n1
@@ -207,9 +231,7 @@ class COverlap {
  int pid;
  void Swap() {
   Gswap(id1, id2);
-  CNode* sw=n1;
-  n1=n2;n2=sw;
-  //swap(n1,  n2);
+  Gswap(n1, n2);
   Gswap(len1, len2);
   Gswap(o1start, o2start);
   Gswap(ovl1,ovl2);
@@ -224,7 +246,7 @@ class COverlap {
    ovl1=o1;ovl2=o2;score=sc; pid=p_id;
    gaps1=g1;
    gaps2=g2;
-   n1=NULL;n2=NULL;
+   n1=-1;n2=-1;
    minus=m;
    }
  };
@@ -243,31 +265,62 @@ FILE* outf=NULL;
 FILE* fTrees=NULL;
 
 
-
 //=========== functions used:
 
-CNode* addNode(char* id, int len, int ordn=-1);
-void addPair(COverlap& o);
-CNode* mergeLinks(CNode* n1, CNode* n2);
+int addNode(const char* id, int len, int ordn=-1);
+void addPair(CNrclData& d, COverlap& o);
+//directly set the parent as specified, with no other checking
+void setParent(CNrclData& d, int n, int np, int offs, int clpL, int clpR,
+                 int score, bool minus, char* g=NULL, char* pg=NULL);
+//check if a sequence np is to be assigned as "parent" to n
+bool assignParent(CNrclData& d, int n, int np, int score, int offs, int clpL, int clpR,
+                 bool minus, char* g=NULL, char* pg=NULL);
+char* storeStr(const char* s);
+int64 storeGapLists(const char* g, const char* pg, int& glen);
+void buildKids(CNrclData& d, int a, int b);
+void finishClusters(CNrclData& d, int a, int b);
+void parallelClusters();
 int getNextValue(char*& p, char* line);
-double getNextNumber(char*& p, char* line);
+int hitFields(char* line, char** fld, int maxf);
+int fieldValue(const char* fld, int64 lineofs);
 //bool seq_filter(char* s1, char* s2); //returns true if the pair can pass through the filter
 int readNames(FILE* f, GHash<int>& xhash);
 int readWeights(FILE* f, GHash<int>& xhash);
-void collectNodes(GCluster* C, CNode* n, bool dbg=false);
+int collectNodes(CNrclData& d, int n);
+void writeTree(FILE* f, int root);
 
-//============ comparison functions:
-int comparePtr(void* p1, void* p2);
+//============ comparison functions (qsort() style, on node indexes):
 //compare sequences by length
-int compareLen(void* p1, void* p2);
+int compareLen(const void* p1, const void* p2);
 //compare sequences by num of contained
-int compareContained(void* p1, void* p2);
+int compareContained(const void* p1, const void* p2);
 //=====
 //compare cluster sizes:
-int compareSize(void* p1, void* p2);
+int compareSize(const void* p1, const void* p2);
 
-//=====
-int compareID(void* p1, void* p2);
+inline void setNodeFlag(int n, unsigned char flag, bool v) {
+ if (v) nodeFlags[n]|=flag;
+   else nodeFlags[n]&=~flag;
+}
+
+//the data where the cluster of root n was collected
+inline CNrclData& nodeData(int n) {
+ return clParallel ? nrclData[clWorker[nodeCluster[n]]] : nrclData[0];
+}
+
+//the end of a tab delimited field (its tab, or the end of the line)
+inline char* fieldEnd(char* p) {
+ while (*p!='\t' && *p!='\0') p++;
+ return p;
+}
+
+//terminate the current input line's field at p, remembering the character
+inline void cutLine(char* p) {
+ lineCuts[numLineCuts]=p;
+ lineCutChr[numLineCuts]=*p;
+ numLineCuts++;
+ *p='\0';
+}
 
 
 //========================================================
@@ -278,7 +331,7 @@ int main(int argc, char* const argv[]) {
  for (int i=0;i<argc-1;i++) 
    GMessage("%s ", argv[i]);
  GMessage("%s\n", argv[argc-1]);
- GArgs args(argc, argv, "hntSFLl:p:c:f:o:y:x:d:w:SEQFLT=PID=SCOV=OVHANG=SCORE=");
+ GArgs args(argc, argv, "hntSFLl:p:c:f:o:y:x:d:w:T:SEQFLT=PID=SCOV=OVHANG=SCORE=");
  int e;
  
 
@@ -300,6 +353,8 @@ int main(int argc, char* const argv[]) {
  if (args.getOpt('p')!=NULL) prefix=(char*)args.getOpt('p');
                         //else prefix=NULL;
  transitive=(args.getOpt('t')!=NULL);
+ //the gap lists are only needed for the layouts (-y, or -c)
+ storeGaps=(!transitive && (args.getOpt('y')!=NULL || args.getOpt('c')!=NULL));
  wSinglets=(args.getOpt('S')!=NULL);
  GStr s=args.getOpt('x');
  FILE* fxclude=NULL;
@@ -320,20 +375,35 @@ int main(int argc, char* const argv[]) {
    int c=readClusters(fclusters);
    if (c<1) GError("Error: no clusters can be loaded from file '%s'!\n", clsfile.chars());
    wclusters=true;
-   GMessage("Loaded %d sequence within %d clusters\n", all.Count(), c);
+   GMessage("Loaded %d sequence within %d clusters\n", nodeNames.Count(), c);
    s=clsfile+".scls";
    if ((fscls=fopen(s, "w"))==NULL)
       GError("Cannot open seeded cluster file '%s' for writing!\n", s.chars());
    }
+ s=args.getOpt('T');
+ if (!s.is_empty()) {
+   num_threads=s.asInt();
+   if (num_threads<=0)
+      GError("Error: invalid -T <threads> value (%s)!\n", s.chars());
+   if (!wclusters)
+      GMessage("Warning: -T is only used with -c, running a single thread.\n");
+   }
+ clParallel=(wclusters && num_threads>1);
+ nrclData=new CNrclData[clParallel ? num_threads : 1];
+ for (int i=0;i<(clParallel ? num_threads : 1);i++) nrclData[i].idx=i;
  GStr lytfile=args.getOpt('y');
  if (lytfile.is_empty() && wclusters) {
    lytfile=clsfile+".lyt";
    }
  FILE* flyt=NULL;
+ GBinLayoutWriter* blyt=NULL;
  if (!lytfile.is_empty()) {
-   if ((flyt=fopen(lytfile, "w"))==NULL)
+   if (endsWith(lytfile.chars(), ".lytb"))
+      blyt=new GBinLayoutWriter(lytfile.chars());
+   else if ((flyt=zfopenWrite(lytfile))==NULL)
       GError("Cannot open layout file '%s' for writing!\n", lytfile.chars());
    }
+ bool wlayouts=(flyt!=NULL || blyt!=NULL);
    
  FILE* fgenes=NULL;
  s=args.getOpt('l');
@@ -413,12 +483,12 @@ int main(int argc, char* const argv[]) {
  //==
  FILE* inf;
  if (!infile.is_empty()) {
-    inf=fopen(infile, "r");
+    inf=zfopenRead(infile);
     if (inf==NULL)
        GError("Cannot open input file %s!\n",infile.chars());
     }
   else
-   inf=stdin;
+   inf=zfwrapRead(stdin);
    
  GStr pfile=args.getOpt('f'); //write filtered pairs here
  FILE* fpairs=NULL;
@@ -437,86 +507,115 @@ int main(int argc, char* const argv[]) {
   
  //======== main program loop
  char* line;
- long fpos;
- while ((line=fgetline(inbuf, inbuf_len, inf, &fpos))!=NULL) {
-        //GMessage("line is '#%s#'\n", line);        
-        GStr linecpy(line);
-        if (strlen(line)<4 || line[0]=='#') continue;
-        char* tabpos=line;
-        //find the 1st tab
-        while (*tabpos != '\t' && *tabpos!='\0') tabpos++;
-        if (*tabpos=='\0' || tabpos==line)
-            GError(ERR_INVALID_PAIR, line);
-        *tabpos='\0'; //so line would be the first node name
-        if (flt_Exclude && excludeList.hasKey(line)) continue;
-        tabpos++; //tabpos is now on the first char of the second field (q_len)
+ off_t fpos=0;
+ int64 lineofs=0; //byte offset of the current input line
+ int linelen=0;
+ GBinHitReader* hitrd=NULL; //hits converted by mgbconv
+ if (GBinHitReader::isBinary(inf)) hitrd=new GBinHitReader(inf);
+ GStr hitline; //binary hit, as a text line (for -f)
+ GStr qgapstr, hgapstr;
+ while (hitrd!=NULL ? hitrd->next() : 
+          ((lineofs=fpos),
+           (line=fgetline(inbuf, inbuf_len, inf, &fpos, &linelen))!=NULL)) {
+        char* tabpos;
+        int qlen, q5, q3, hitlen, h5, h3;
         int score, scov, ovhang, pid;
         double score2;
-        //skip 3 other tabs delimited
-        //read the query length:
-        int qlen=getNextValue(tabpos, line);
-        tabpos++;
-        int q5=getNextValue(tabpos,line);
-        tabpos++;
-        int q3=getNextValue(tabpos,line);
-        tabpos++;
-        if (q5==q3) GError(ERR_INVALID_PAIR, line);
         bool minus=false;
-        if (q5>q3) {
-          minus=true;          
-          Gswap(q5,q3);
-          }
-
-        //now we should be on the first char of the hitname field
-        while (isspace(*tabpos)) tabpos++; //skip any spaces in this second node name field
-        if (*tabpos=='\0') GError(ERR_INVALID_PAIR, line);
-        //add a string termination after this field
-        char* p=tabpos; while (!isspace(*p) && *p!='\0') p++;
-        *p='\0';
-        //now tabpos contains the exact second sequence string
-        if (strcmp(line, tabpos)==0) {
-          //GMessage("Warning: self pairing found for node %s\n",line);
-          continue;
-          }
-        if (flt_Exclude && excludeList.hasKey(tabpos)) continue;
-        //if (!seq_filter(line, tabpos)) continue;
-        p++; //move on the first char of the hitlen 
-        int hitlen=getNextValue(p,line);
-        p++;
-        int h5=getNextValue(p,line);
-        p++;
-        int h3=getNextValue(p,line);
-        p++;
-        if (h5==h3) GError(ERR_INVALID_PAIR, line);
-        if (h5>h3) {
-          minus = !minus;
-          Gswap(h5,h3);
-          }
         char* qgaps=NULL;
-        char* hgaps=NULL;  
-        pid=getNextValue(p,line); p++;
-        score=getNextValue(p,line);p++;
-        //parse the 2nd score, the orientation and the gapping info if any!
-        score2=getNextNumber(p,line);p++;
-        if (flyt!=NULL && !transitive) {        
-          char sense=*p;
-          if (sense!='+' && sense!='-')
-              GError("Error parsing hit orientation at (p='%s'): %s\n",sense, p, linecpy.chars());
-          p++;
-          if (*p=='\t') {//gapinfo present
-            p++;qgaps=p;
-            while (*p!='\t' && *p!='\n' && *p!=0) p++;
-            if (*p=='\t') {
-                if (qgaps==p) qgaps=NULL;
-                         else *p=0;
-                p++;
-                }
-            hgaps=p;
-            while (*p!='\t' && *p!='\n' && *p!=0) p++;
-            if (hgaps==p) hgaps=NULL;
-                     else *p=0;
+        char* hgaps=NULL;
+        if (hitrd!=NULL) {
+          GBinHit& hit=hitrd->hit;
+          line=hit.qname;
+          tabpos=hit.hname;
+          if (flt_Exclude && (excludeList.hasKey(line) || 
+                excludeList.hasKey(tabpos))) continue;
+          if (strcmp(line, tabpos)==0) continue;
+          qlen=hit.qlen; q5=hit.q5; q3=hit.q3;
+          hitlen=hit.hlen; h5=hit.h5; h3=hit.h3;
+          if (q5==q3 || h5==h3) 
+             GError("Invalid hit record #%d (%s vs %s)\n", hitrd->numHits, line, tabpos);
+          if (q5>q3) {
+            minus=true;
+            Gswap(q5,q3);
+            }
+          if (h5>h3) {
+            minus = !minus;
+            Gswap(h5,h3);
+            }
+          pid=(int)hit.pid;
+          score=hit.score;
+          score2=hit.score2;
+          if (wlayouts && !transitive && hit.hasGaps) {
+            hit.gapStr(0, qgapstr);
+            hit.gapStr(1, hgapstr);
+            if (!qgapstr.is_empty()) qgaps=(char*)qgapstr.chars();
+            if (!hgapstr.is_empty()) hgaps=(char*)hgapstr.chars();
+            }
+          }
+        else {
+          //the line is not copied: it is only split in place (lineCuts)
+          //where the sequence names and the gap lists end
+          if (linelen<4 || line[0]=='#') continue;
+          numLineCuts=0;
+          char* fld[14];
+          int nf=hitFields(line, fld, 14);
+          if (nf<11 || fld[1]==line+1)
+              GError(ERR_INVALID_HIT, (long long)lineofs);
+          cutLine(fld[1]-1); //so line would be the first node name
+          if (flt_Exclude && excludeList.hasKey(line)) continue;
+          qlen=fieldValue(fld[1], lineofs);
+          q5=fieldValue(fld[2], lineofs);
+          q3=fieldValue(fld[3], lineofs);
+          if (q5==q3) GError(ERR_INVALID_HIT, (long long)lineofs);
+          if (q5>q3) {
+            minus=true;          
+            Gswap(q5,q3);
+            }
+          tabpos=fld[4];
+          while (*tabpos==' ') tabpos++; //skip any spaces in this second node name field
+          if (*tabpos=='\t') GError(ERR_INVALID_HIT, (long long)lineofs);
+          //add a string termination after this field
+          char* p=tabpos; while (!isspace(*p)) p++;
+          cutLine(p);
+          //now tabpos contains the exact second sequence string
+          if (strcmp(line, tabpos)==0) {
+            //GMessage("Warning: self pairing found for node %s\n",line);
+            continue;
             }
-          }//gapinfo can be stored
+          if (flt_Exclude && excludeList.hasKey(tabpos)) continue;
+          //if (!seq_filter(line, tabpos)) continue;
+          hitlen=fieldValue(fld[5], lineofs);
+          h5=fieldValue(fld[6], lineofs);
+          h3=fieldValue(fld[7], lineofs);
+          if (h5==h3) GError(ERR_INVALID_HIT, (long long)lineofs);
+          if (h5>h3) {
+            minus = !minus;
+            Gswap(h5,h3);
+            }
+          pid=fieldValue(fld[8], lineofs);
+          score=fieldValue(fld[9], lineofs);
+          //parse the 2nd score, the orientation and the gapping info if any!
+          score2=strtod(fld[10], &p);
+          if (p==fld[10]) GError(ERR_INVALID_HIT, (long long)lineofs);
+          if (storeGaps) {
+            if (nf<12 || (*fld[11]!='+' && *fld[11]!='-'))
+                GError("Error parsing hit orientation at byte offset %lld!\n",
+                          (long long)lineofs);
+            if (nf>12) {//gapinfo present
+              qgaps=fld[12];
+              p=fieldEnd(qgaps);
+              if (p==qgaps) qgaps=NULL;
+                else if (*p=='\t') cutLine(p);
+              if (nf>13) {
+                hgaps=fld[13];
+                p=fieldEnd(hgaps);
+                if (p==hgaps) hgaps=NULL;
+                  else if (*p=='\t') cutLine(p);
+                }
+              }
+            }//gapinfo can be stored
+        } //text line
         
         //compute coverages:
         if (hitlen>qlen) { //query is shorter
@@ -529,51 +628,88 @@ int main(int argc, char* const argv[]) {
           ovhang=GMAX(h5-1, hitlen-h3);
           }
         //GMessage("scov=%d, pid=%d, score=%d, ovhank=%d\n", scov, pid, score, ovhang);
-        CNode* n1=NULL;
-        CNode* n2=NULL;
+        int* n1=NULL;
+        int* n2=NULL;
         if (wclusters){
-          if ((n1=all.Find(line))==NULL || (n2=all.Find(tabpos))==NULL) continue; //ignore pair!
-          if (n1->cluster!=n2->cluster) continue; //ignore pair, sequences not in the same cluster!
+          n1=nodeIds.Find(line);
+          n2=nodeIds.Find(tabpos);
+          if (n1==NULL || n2==NULL) continue; //ignore pair!
+          if (nodeCluster[*n1]!=nodeCluster[*n2]) continue; //ignore pair, sequences not in the same cluster!
           }
         if (scov>=minscov && pid>=minpid && score>=minscore && ovhang <= maxovhang) {
            //GMessage("%s(%d) %d-%d  | %s(%d) %d-%d, pid=%d%%, score=%d, scov=%d%%, ovhang=%d\n",
            //          line,qlen,q5,q3,tabpos,hitlen, h5,h3,pid, score, scov, ovhang);
-           if (fpairs!=NULL) fprintf(fpairs, "%s\n", linecpy.chars());
-           COverlap ovl(line, tabpos, qlen, hitlen, q5, h5, 
-              q3-q5+1, h3-h5+1, score, pid, minus, qgaps, hgaps);
-              
-           addPair(ovl);
+           if (clParallel) { //keep it for the worker processing its cluster
+             CHit h;
+             h.qn=*n1; h.hn=*n2;
+             h.qlen=qlen; h.hlen=hitlen;
+             h.q5=q5; h.h5=h5;
+             h.qovl=q3-q5+1; h.hovl=h3-h5+1;
+             h.score=score; h.pid=pid;
+             h.minus=minus;
+             int glen=0;
+             h.gofs=(qgaps==NULL && hgaps==NULL) ? -1 :
+                          storeGapLists(qgaps, hgaps, glen);
+             clHits.Add(h);
+             }
+           else {
+             COverlap ovl(line, tabpos, qlen, hitlen, q5, h5, 
+                q3-q5+1, h3-h5+1, score, pid, minus, qgaps, hgaps);
+             addPair(nrclData[0], ovl);
+             }
+           if (fpairs!=NULL) {
+             if (hitrd!=NULL) {
+               hitrd->hit.toLine(hitline);
+               fprintf(fpairs, "%s\n", hitline.chars());
+               }
+             else { //write the original line
+               for (int i=0;i<numLineCuts;i++) *lineCuts[i]=lineCutChr[i];
+               fwrite(line, 1, linelen, fpairs);
+               fputc('\n', fpairs);
+               }
+             }
            }
          /*else { //yet, if any of these are full genes, keep them here:
-           if (!all.hasKey(line) && (wSinglets || fullGenes.hasKey(line)))
+           if (!nodeIds.hasKey(line) && (wSinglets || fullGenes.hasKey(line)))
               addNode(line, qlen);
-           if (!all.hasKey(tabpos) && (wSinglets || fullGenes.hasKey(tabpos)))
+           if (!nodeIds.hasKey(tabpos) && (wSinglets || fullGenes.hasKey(tabpos)))
               addNode(tabpos, hitlen);
            }*/
     } //while lines are coming
     
-  if (inf!=stdin) fclose(inf);
+  delete hitrd;
+  if (inf!=stdin) zfclose(inf);
   if (fpairs!=NULL && fpairs!=stdout) fclose(fpairs);
   //==========
   //   
- GMessage("Total sequences analyzed: %d\n", seqs.Count());
+ int numNodes=nodeNames.Count();
+ GMessage("Total sequences analyzed: %d\n", numNodes);
+ GCALLOC(numSeqs, (numNodes+1)*sizeof(int));
+ GCALLOC(lytPos, (numNodes+1)*sizeof(int));
+ GCALLOC(mStart, (numNodes+1)*sizeof(int));
+ GCALLOC(nContained, (numNodes+1)*sizeof(int));
  GMessage("Sorting clusters by size..\n");
- //sort by cluster size (largest first)
- //if no transitivity is assumed, parent will be set to NULL
- //for any grand-child 
- for (int i=0; i<seqs.Count(); i++) {
-    //if (seqs[i]->links.size<=1) break; //the rest are already included in other clusters 
-    CNode* seq=seqs[i];
-    if (!transitive && seq->parent!=NULL  && seq->parent->parent!=NULL)
-        seq->parent=NULL; //set free if it's a second generation
-    if (seq->parent!=NULL)
-      continue; //only process sequences with no parent at this stage
-    GCluster* C = new GCluster(true,false,false);
-    collectNodes(C, seqs[i]);
-    seqs[i]->numseqs=C->Count();
-    delete C;
-    }
- seqs.setSorted(&compareSize);
+ GVec<int> roots;
+ if (clParallel) {
+   parallelClusters();
+   //the clusters are written in the order of the loaded clusters,
+   //sorted by size (largest first) within each of them
+   for (int c=0;c<clStart.Count()-1;c++) {
+     int r0=roots.Count();
+     for (int i=clStart[c]; i<clStart[c+1]; i++)
+       if (nodeParent[i]<0) roots.Add(i);
+     if (roots.Count()-r0>1)
+       qsort(&(roots[r0]), roots.Count()-r0, sizeof(int), compareSize);
+     }
+   }
+ else {
+   finishClusters(nrclData[0], 0, numNodes);
+   for (int i=0; i<numNodes; i++)
+     if (nodeParent[i]<0) roots.Add(i);
+   //sort by cluster size (largest first)
+   if (roots.Count()>1)
+     qsort(&(roots[0]), roots.Count(), sizeof(int), compareSize);
+   }
  if (wSinglets) 
    GMessage("Writing clusters (and singletons)..\n");
   else  
@@ -582,92 +718,78 @@ int main(int argc, char* const argv[]) {
   //<flags> can be: c (possibly chimeric parent), F (contains full NPs) | G (contains non-full NPs)
   int sngnum=0;
   int clnum=0;
-  for (int i=0; i<seqs.Count(); i++) {
-    CNode* seq=seqs[i];
-    //GMessage("Collecting all children for '%s'\n", seq->id);
-    if (seq->parent!=NULL) //sequence was in a cluster, skip it
-                   continue; 
-    if (seq->numseqs==1 && !wSinglets)
-        break; //don't write "singletons"
-    GCluster* C=new GCluster(true,false,false); //sorted by pointer
-    //descend the full children tree, if containment is transitive
-    collectNodes(C, seq, true);
+  for (int i=0; i<roots.Count(); i++) {
+    int seq=roots[i];
+    //GMessage("Collecting all children for '%s'\n", nodeNames[seq]);
+    if (numSeqs[seq]==1 && !wSinglets)
+        continue; //don't write "singletons"
+    int* C=&(nodeData(seq).clmembers[mStart[seq]]); //collected by collectNodes()
+    int ccount=numSeqs[seq];
+    if (fTrees!=NULL && transitive) writeTree(fTrees, seq);
     //----
     //GStr flags;
-    if (C->Count()>=1) {
-      GStr refSeq(seq->id);
-      int refLen=seq->len;
-      C->setSorted(&compareLen);//sort by sequence length (largest first)
-      //decide what is the refseq to use
-      /*bool isEST=(seq->seqtype==0);
-      //scan all sequences for NPs/ETs
-      bool hasFull=false;
-      bool hasET=false;
-      //scan to see if there are any NPs/ETs here
-      for (int k=0; k<C->Count(); k++) {
-        CNode* n=C->Get(k);
-        if (n->seqtype>0) { //NP or ET!
-          hasET=true;
-          }
-        if (!hasFull && fullGenes.hasKey(n->id)) hasFull=true;
-        if (hasFull && hasET) break; //no need to check further
-        }
-      //set the flags accordingly
-      if (C->Count()>1 && isEST && refLen - C->Get(1)->len > 50 &&
-              (C->Count()>=20 || hasET))
-                 flags="C"; //EST much longer than the rest of the herd
-      if (hasFull) flags+="F";
-              else if (hasET) flags+="G";*/
+    if (ccount>=1) {
+      GStr refSeq(nodeNames[seq]);
+      int refLen=nodeLen[seq];
+      //sort by sequence length (largest first)
+      qsort(C, ccount, sizeof(int), compareLen);
       if (asfasta) {
-         if (seq->numseqs>1) {
+         if (ccount>1) {
              clnum++;
              if (outf!=NULL) fprintf(outf,">NRCL%d %d %s %d\n", clnum,
-                                seq->numseqs, refSeq.chars(), refLen);
+                                ccount, refSeq.chars(), refLen);
              }
            else {
              sngnum++;
              if (outf!=NULL) fprintf(outf,">SNGT%d %d %s %d\n", sngnum,
-                           seq->numseqs, refSeq.chars(), refLen);
+                           ccount, refSeq.chars(), refLen);
              }
          }
-         /*if (outf!=NULL)  {
-            if (flags.length()>0) fprintf(outf, " %s\n", flags.chars());
-                             else fprintf(outf, "\n");
-             }*/
-      if (flyt!=NULL && C->Count()>1)
-        fprintf(flyt, ">%s %d 1 %d\n", seq->id, C->Count(), seq->len);
+      if (flyt!=NULL && ccount>1)
+        fprintf(flyt, ">%s %d 1 %d\n", nodeNames[seq], ccount, nodeLen[seq]);
+      if (blyt!=NULL && ccount>1)
+        blyt->beginLayout(nodeNames[seq], 1, nodeLen[seq]);
       
-      for (int j=0; j<C->Count();j++) {
-          CNode* c=C->Get(j);
+      for (int j=0; j<ccount;j++) {
+          int c=C[j];
           if (wclusters && seq!=c)
-               seq->cluster->Remove(c);
+               nodeFlags[c]|=NODE_MEMBER;
            if (outf!=NULL) {    
              if (j==0) 
-               fprintf(outf,"%s",c->id);
+               fprintf(outf,"%s",nodeNames[c]);
              else 
-               fprintf(outf," %s",c->id);
+               fprintf(outf," %s",nodeNames[c]);
              }
-          if (flyt!=NULL && C->Count()>1) {
+          if (ccount==1) continue;
+          char lstrand=(nodeFlags[c] & NODE_LYTMINUS) ? '-' : '+';
+          char* gaps=NULL;
+          char* pgaps=NULL;
+          if (storeGaps && nodeGapOfs[c]>=0) {
+            gaps=gapArena+nodeGapOfs[c];
+            pgaps=gaps+nodePGapOfs[c];
+            if (*gaps=='\0') gaps=NULL;
+            if (*pgaps=='\0') pgaps=NULL;
+            }
+          if (flyt!=NULL) {
             fprintf(flyt, "%s %c %d %d %d %d",
-               c->id, c->lytminus?'-':'+',
-               c->len, c->lytpos+1, c->pclipL, c->pclipR);
-            if (c->gaps!=NULL || c->pgaps!=NULL) {
+               nodeNames[c], lstrand, nodeLen[c], lytPos[c]+1,
+               nodeClipL[c], nodeClipR[c]);
+            if (gaps!=NULL || pgaps!=NULL) {
               fprintf(flyt," R:");
-              if (c->gaps!=NULL) fprintf(flyt,"%s",c->gaps);
-              if (c->pgaps!=NULL) fprintf(flyt,"/%s",c->pgaps);
+              if (gaps!=NULL) fprintf(flyt,"%s",gaps);
+              if (pgaps!=NULL) fprintf(flyt,"/%s",pgaps);
               }
             fprintf(flyt,"\n"); 
             }
+          if (blyt!=NULL)
+            blyt->addRead(nodeNames[c], lstrand, nodeLen[c], lytPos[c]+1,
+                          nodeClipL[c], nodeClipR[c], gaps, pgaps);
           } //for each component sequence
+      if (blyt!=NULL) blyt->endLayout();
       if (outf!=NULL) fprintf(outf,"\n");
       }
-    if (wclusters) {
-             //C->setSorted(&comparePtr);
-             //C->RemovePtr(seq);
-             seq->contained=C;
-             //seq->contained->setSorted(&compareSize);
-             }
-        else delete C;
+    if (wclusters)
+             nContained[seq]=ccount;
     } //for each sequence
  if (wSinglets)
    GMessage("%d clusters written (and %d singletons).\n", clnum, sngnum);
@@ -675,24 +797,29 @@ int main(int argc, char* const argv[]) {
    GMessage("%d clusters written.\n", clnum);
   //---
   if (wclusters) { //write the clusters into scls file
-    for (int i=0;i<tclusters.Count();i++) {
-      GCluster* c=tclusters[i];
-      c->setSorted(&compareContained);
-      fprintf(fscls,">SCL%d\t%d\t%d\n", i+1, c->total, c->Count());
-      for (int j=0; j<c->Count(); j++) {
-         CNode* n=c->Get(j);
-         if (n->contained!=NULL) {
-           //fprintf(fscls, "%s :%d:", n->id, n->contained->Count());
-           fprintf(fscls, "%s", n->id);
-           for (int k=0;k<n->contained->Count();k++) {
-              CNode* cn=n->contained->Get(k);
+    GVec<int> cl; //the sequences of a cluster not written in another's cluster
+    for (int i=0;i<clStart.Count()-1;i++) {
+      cl.Clear();
+      for (int n=clStart[i];n<clStart[i+1];n++)
+        if ((nodeFlags[n] & NODE_MEMBER)==0) cl.Add(n);
+      if (cl.Count()>1)
+        qsort(&(cl[0]), cl.Count(), sizeof(int), compareContained);
+      fprintf(fscls,">SCL%d\t%d\t%d\n", i+1, clStart[i+1]-clStart[i], cl.Count());
+      for (int j=0; j<cl.Count(); j++) {
+         int n=cl[j];
+         if (nContained[n]>0) {
+           //fprintf(fscls, "%s :%d:", nodeNames[n], nContained[n]);
+           fprintf(fscls, "%s", nodeNames[n]);
+           GVec<int>& clmembers=nodeData(n).clmembers;
+           for (int k=0;k<nContained[n];k++) {
+              int cn=clmembers[mStart[n]+k];
               if (cn!=n)
-                fprintf(fscls, " %s", cn->id);
+                fprintf(fscls, " %s", nodeNames[cn]);
               }
            fprintf(fscls, "\n");
            }
           else
-           fprintf(fscls, "%s\n", n->id);
+           fprintf(fscls, "%s\n", nodeNames[n]);
          }
       }
    fflush(fscls);
@@ -701,11 +828,21 @@ int main(int argc, char* const argv[]) {
   if (outf!=NULL) fflush(outf);
   if (flyt!=NULL) {
    fflush(flyt);
-   fclose(flyt);
+   zfclose(flyt);
    }
-  seqs.Clear();
-  tclusters.Clear();
-  all.Clear(); //this frees the nodes
+  if (blyt!=NULL) {
+   blyt->close();
+   delete blyt;
+   }
+  nodeIds.Clear();
+  for (int i=0;i<strBlocks.Count();i++) GFREE(strBlocks[i]);
+  GFREE(gapArena);
+  GFREE(numSeqs);
+  GFREE(lytPos);
+  GFREE(mStart);
+  GFREE(nContained);
+  GFREE(clWorker);
+  delete[] nrclData;
   //GMessage("the nrcls list was cleared!\n");
   if (outf!=stdout && outf!=NULL) fclose(outf);
   GFREE(inbuf);
@@ -713,154 +850,272 @@ int main(int argc, char* const argv[]) {
   //getc(stdin);
 }
 
-// ====================================== CNODE methods
-
-CNode::CNode(char* name, int slen, int ordn) {
-    kids=new GCluster(true,false,false);
-    id=Gstrdup(name);
-    //seqtype=(isET(id) ? 1 : 0);; //1=ET 0=EST
-    pweight=0;
-    isFull=startsWith(name, prefix);
-    if (namesLoaded && fullGenes.hasKey(name)) isFull=true;
-    int *pw=NULL;
-    if (npWeights && (pw=fullGenes.Find(name))!=NULL) {
-      isFull=true;
-      pweight=*pw;
-      }
-    numseqs=1; //self, by default being a singleton
-    ordnum = (ordn>=0)? ordn : base_ordnum++;
-    len=slen;
-    parent=NULL;
-    cluster=NULL;
-    gaps=NULL;
-    pgaps=NULL;
-    poffs=0;
-    lytminus=0;
-    lytpos=0;
-    pclipL=0;pclipR=0;
-    pscore=0;
-    contained=NULL;
- }
-/*-- node creation when loading from cluster file --*/
-
-CNode::CNode(char* name, GCluster*& cl, int ordn) {
-    kids=new GCluster(true, false, false);
-    id=Gstrdup(name);
-    pweight=0;
-    //seqtype=(isET(id) ? 1 : 0);; //1=ET 0=EST
-    isFull=startsWith(name, prefix);
-    if (namesLoaded && fullGenes.hasKey(name)) isFull=true;
-    int *pw=NULL;
-    if (npWeights && (pw=fullGenes.Find(name))!=NULL) {
-      isFull=true;
-      pweight=*pw;
-      }
-    numseqs=1; //self, by default being a singleton
-    len=0; /* not initialized yet! */
-    parent=NULL;
-    gaps=NULL;
-    pgaps=NULL;
-    poffs=0;
-    lytminus=0;
-    lytpos=0;
-    pclipL=0;pclipR=0;
-    ordnum=ordn;
-    pscore=0;
-    if (cl==NULL) {
-       cl=new GCluster(true,false,false);
-       tclusters.Add(cl);
-       cluster=cl;
-       }
-    cluster=cl;
-    cluster->addNode(this);
-    contained=NULL;
-    }
-     
-   //directly set the parent as specified, with no other checking
+// ====================================== node store
 
-void CNode::setParent(CNode* np, int offs, int clpL, int clpR,
+//copy a string into the string arena
+char* storeStr(const char* s) {
+ int len=strlen(s)+1;
+ if (len>strLeft) {
+   strLeft=GMAX(len, STRBLOCK_SIZE);
+   GMALLOC(strPtr, strLeft);
+   strBlocks.Add(strPtr);
+   }
+ char* r=strPtr;
+ memcpy(r, s, len);
+ strPtr+=len;
+ strLeft-=len;
+ return r;
+}
+
+//append the gap lists of a parent overlap to gapArena, returning their offset
+int64 storeGapLists(const char* g, const char* pg, int& glen) {
+ glen=(g==NULL) ? 0 : strlen(g);
+ int pglen=(pg==NULL) ? 0 : strlen(pg);
+ int64 ofs=gapArenaLen;
+ if (ofs+glen+pglen+2>gapArenaCap) {
+   gapArenaCap=GMAX(gapArenaCap*2, ofs+glen+pglen+2+STRBLOCK_SIZE);
+   GREALLOC(gapArena, gapArenaCap);
+   }
+ char* p=gapArena+ofs;
+ if (glen>0) memcpy(p, g, glen);
+ p[glen]='\0';
+ p+=glen+1;
+ if (pglen>0) memcpy(p, pg, pglen);
+ p[pglen]='\0';
+ gapArenaLen+=glen+pglen+2;
+ return ofs;
+}
+
+//add a new node with name id1, with length len1 
+int addNode(const char* id1, int len1, int ordn) {
+ int n=nodeNames.Count();
+ char* name=storeStr(id1);
+ nodeNames.Add(name);
+ nodeIds.shkAdd(name, new int(n));
+ unsigned char flags=0;
+ int pweight=0;
+ if (startsWith(name, prefix)) flags|=NODE_FULL;
+ if (namesLoaded && fullGenes.hasKey(name)) flags|=NODE_FULL;
+ int *pw=NULL;
+ if (npWeights && (pw=fullGenes.Find(name))!=NULL) {
+   flags|=NODE_FULL;
+   pweight=*pw;
+   }
+ nodeFlags.Add(flags);
+ nodeWeight.Add(pweight);
+ int ordnum = (ordn>=0)? ordn : base_ordnum++;
+ nodeOrd.Add(ordnum);
+ nodeLen.Add(len1);
+ int v=-1;
+ nodeParent.Add(v);
+ v=0;
+ nodePOffs.Add(v);
+ nodePScore.Add(v);
+ nodeNumKids.Add(v);
+ short clip=0;
+ nodeClipL.Add(clip);
+ nodeClipR.Add(clip);
+ if (storeGaps) {
+   int64 gofs=-1;
+   nodeGapOfs.Add(gofs);
+   v=0;
+   nodePGapOfs.Add(v);
+   }
+ return n;
+}
+
+void setParent(CNrclData& d, int n, int np, int offs, int clpL, int clpR,
                     int score, bool minus, char* g, char* pg) {
-   if (parent!=NULL) {
-         if (!do_share) //the previous parent should ditch this child
-            parent->kids->Remove(this);
-         /* if transitivity is not
-         if (parent->parent!=NULL && !transitivity)
-            return; //will not set the parent */
-         } //switch parent
-   parent=np;
-   poffs=offs;
-   pclipL=clpL;
-   pclipR=clpR;
-   pscore=score;
-   replaceStr(gaps, g);
-   replaceStr(pgaps, pg);
-   pminus=minus?1:0;
-   parent->kids->Add(this);
-   /* when no transitivity is allowed,
-      any immediate kids should be let go */
-   /*
-   if (!transitive)
-     for (int i=0;i<kids.Count();i++)
-       kids[i]->parent=NULL;
-   */
+   int p=nodeParent[n];
+   if (p>=0 && !do_share) //the previous parent should ditch this child
+      nodeNumKids[p]--;
+   nodeParent[n]=np;
+   nodePOffs[n]=offs;
+   nodeClipL[n]=clpL;
+   nodeClipR[n]=clpR;
+   nodePScore[n]=score;
+   if (storeGaps) {
+     if (g==NULL && pg==NULL) nodeGapOfs[n]=-1;
+     else if (clParallel) { //the buffered hits have their gap lists in gapArena
+       nodeGapOfs[n]=g-gapArena;
+       nodePGapOfs[n]=pg-g;
+       }
+     else {
+       int glen=0;
+       nodeGapOfs[n]=storeGapLists(g, pg, glen);
+       nodePGapOfs[n]=glen+1;
+       }
+     }
+   setNodeFlag(n, NODE_PMINUS, minus);
+   nodeNumKids[np]++;
+   if (do_share) { //n stays a kid of np even if it gets another parent
+     d.shareEdges.Add(np);
+     d.shareEdges.Add(n);
+     }
    }
 
-//check if a sequence np is to be assigned as "parent" to this
+//check if a sequence np is to be assigned as "parent" to n
 //returns true if parenting works according to the sequence AND/OR link weights
 //or false if the parenting is reversed!
-bool CNode::assignParent(CNode* np, int score, int offs, int clpL, int clpR,
+bool assignParent(CNrclData& d, int n, int np, int score, int offs, int clpL, int clpR,
                           bool minus, char* g, char* pg) {
    //returns true if the parent was set to the new node np
-    if (np->parent==this || parent==np) return false; //avoid circular or double relations
-    //GMessage(" assign '%s' as parent for '%s'\n", np->id, id);
-    
-    //do not allow an ET to be parented by an EST - only the other way around!
-    //if (np->seqtype < seqtype) return false;
-    if (parent==NULL || do_share) {
-      setParent(np, offs, clpL, clpR, score, minus, g, pg);
+    int p=nodeParent[n];
+    if (nodeParent[np]==n || p==np) return false; //avoid circular or double relations
+    if (p<0 || do_share) {
+      setParent(d, n, np, offs, clpL, clpR, score, minus, g, pg);
       return true;
       }
     //switch to a better scoring parent link
     bool switchParent=false;
-    //int *pw=NULL, *npw=NULL;
-    
-    //bool isFullparent=startsWith(parent->id, "np|");
-    //bool isFullnp=startsWith(np->id, "np|");
-    
-    if (parent->pweight>0 || np->pweight>0) {
-     switchParent= (np->pweight>parent->pweight);
+    bool pFull=(nodeFlags[p] & NODE_FULL)!=0;
+    bool npFull=(nodeFlags[np] & NODE_FULL)!=0;
+    if (nodeWeight[p]>0 || nodeWeight[np]>0) {
+     switchParent= (nodeWeight[np]>nodeWeight[p]);
      }
-    else if (parent->isFull ^ np->isFull) {
-      switchParent= (np->isFull && !parent->isFull);
+    else if (pFull ^ npFull) {
+      switchParent= (npFull && !pFull);
       }
-    else if (by_length && np->len!=parent->len) { // the length of the parent take precendence!
-       switchParent = (np->len>parent->len);
+    else if (by_length && nodeLen[np]!=nodeLen[p]) { // the length of the parent take precendence!
+       switchParent = (nodeLen[np]>nodeLen[p]);
        }
      else { // the higher similarity
-      if (score == pscore) {
-       switchParent = np->kids->Count()==parent->kids->Count() ?
-           (np->len > parent->len) : (np->kids->Count()>parent->kids->Count());
+      if (score == nodePScore[n]) {
+       switchParent = nodeNumKids[np]==nodeNumKids[p] ?
+           (nodeLen[np] > nodeLen[p]) : (nodeNumKids[np]>nodeNumKids[p]);
        }
-      else switchParent = score>pscore;
+      else switchParent = score>nodePScore[n];
       }
        
     if (switchParent) { //better parent found:
-      setParent(np, offs, clpL, clpR, score, minus, g, pg);
+      setParent(d, n, np, offs, clpL, clpR, score, minus, g, pg);
       return true;
       }
     return false;   //no reason to change the parent!
     }
-    
-CNode::~CNode() {
-    if (gaps!=NULL) GFREE(gaps);
-    if (pgaps!=NULL) GFREE(pgaps);
-    if (contained!=NULL)
-       delete contained;
-    delete kids;   
-    GFREE(id);
+
+//build the child lists of nodes a..b-1 from their final parenting
+//(all the parenting edges in d must be between these nodes)
+void buildKids(CNrclData& d, int a, int b) {
+ int numNodes=b-a;
+ int z=0;
+ d.nbase=a;
+ d.kidStart.Clear();
+ for (int i=0;i<=numNodes;i++) d.kidStart.Add(z);
+ int numEdges=(do_share) ? d.shareEdges.Count()/2 : numNodes;
+ for (int e=0;e<numEdges;e++) {
+   int p=(do_share) ? d.shareEdges[e*2] : nodeParent[a+e];
+   if (p>=0) d.kidStart[p-a+1]++;
+   }
+ for (int i=0;i<numNodes;i++) d.kidStart[i+1]+=d.kidStart[i];
+ int* kpos=NULL;
+ GMALLOC(kpos, (numNodes+1)*sizeof(int));
+ memcpy(kpos, &(d.kidStart[0]), (numNodes+1)*sizeof(int));
+ d.kidList.setCount(d.kidStart[numNodes]);
+ for (int e=0;e<numEdges;e++) {
+   int p=(do_share) ? d.shareEdges[e*2] : nodeParent[a+e];
+   if (p<0) continue;
+   d.kidList[kpos[p-a]]=(do_share) ? d.shareEdges[e*2+1] : a+e;
+   kpos[p-a]++;
+   }
+ GFREE(kpos);
+ d.shareEdges.Clear();
+}
+
+//once their parenting is final, collect the clusters of nodes a..b-1
+//(setting numSeqs, and the members and layout positions of the roots)
+void finishClusters(CNrclData& d, int a, int b) {
+ //if no transitivity is assumed, parent will be set to NULL
+ //for any grand-child 
+ if (!transitive)
+   for (int i=a; i<b; i++) {
+     int p=nodeParent[i];
+     if (p>=0 && nodeParent[p]>=0)
+        nodeParent[i]=-1; //set free if it's a second generation
+     }
+ buildKids(d, a, b);
+ if (transitive) {
+   int vlen=((b-a)>>3)+1;
+   if (vlen>d.visitedCap) {
+     GREALLOC(d.visited, vlen);
+     d.visitedCap=vlen;
+     }
+   memset(d.visited, 0, vlen);
+   }
+ for (int i=a; i<b; i++) {
+    numSeqs[i]=1; //self, by default being a singleton
+    if (nodeParent[i]>=0)
+      continue; //only process sequences with no parent at this stage
+    numSeqs[i]=collectNodes(d, i);
     }
+}
 
+//-------- cluster-parallel mode (-c with -T)
+// pairs are only considered within the same loaded cluster, so each loaded
+// cluster is parented and collected independently by one of the worker
+// threads, from the hits buffered for it; the data of its nodes is only
+// changed by that thread
+
+//parent the nodes of loaded cluster c with its hits, then collect its clusters
+void processCluster(CNrclData& d, int c) {
+ for (int i=clHitStart[c]; i<clHitStart[c+1]; i++) {
+   CHit& h=clHits[clHitIdx[i]];
+   char* qgaps=NULL;
+   char* hgaps=NULL;
+   if (h.gofs>=0) {
+     qgaps=gapArena+h.gofs;
+     hgaps=qgaps+strlen(qgaps)+1;
+     }
+   COverlap ovl(nodeNames[h.qn], nodeNames[h.hn], h.qlen, h.hlen, h.q5, h.h5,
+        h.qovl, h.hovl, h.score, h.pid, h.minus, qgaps, hgaps);
+   ovl.n1=h.hn;
+   ovl.n2=h.qn;
+   addPair(d, ovl);
+   }
+ finishClusters(d, clStart[c], clStart[c+1]);
+ clWorker[c]=d.idx;
+}
+
+void clusterWorker(void* p) {
+ CNrclData& d=*(CNrclData*)p;
+ int numClusters=clStart.Count()-1;
+ while (true) {
+   int c=__atomic_fetch_add(&nextCluster, CL_TASK_SIZE, __ATOMIC_RELAXED);
+   if (c>=numClusters) break;
+   int cend=GMIN(c+CL_TASK_SIZE, numClusters);
+   for (;c<cend;c++) processCluster(d, c);
+   }
+}
 
+void parallelClusters() {
+ //bucket the buffered hits by cluster, keeping their input order
+ int numClusters=clStart.Count()-1;
+ int numHits=clHits.Count();
+ GCALLOC(clHitStart, (numClusters+1)*sizeof(int));
+ for (int i=0;i<numHits;i++) clHitStart[nodeCluster[clHits[i].qn]+1]++;
+ for (int c=0;c<numClusters;c++) clHitStart[c+1]+=clHitStart[c];
+ int* hpos=NULL;
+ GMALLOC(hpos, (numClusters+1)*sizeof(int));
+ memcpy(hpos, clHitStart, (numClusters+1)*sizeof(int));
+ GMALLOC(clHitIdx, (numHits+1)*sizeof(int));
+ for (int i=0;i<numHits;i++) clHitIdx[hpos[nodeCluster[clHits[i].qn]]++]=i;
+ GFREE(hpos);
+ GCALLOC(clWorker, (numClusters+1)*sizeof(int));
+ GMessage("Processing %d clusters (%d hits) with %d threads..\n",
+               numClusters, numHits, num_threads);
+ GThread** workers=NULL;
+ GMALLOC(workers, num_threads*sizeof(GThread*));
+ for (int i=0;i<num_threads;i++)
+   workers[i]=new GThread(clusterWorker, &(nrclData[i]));
+ for (int i=0;i<num_threads;i++) {
+   workers[i]->join();
+   delete workers[i];
+   }
+ GFREE(workers);
+ GFREE(clHitStart);
+ GFREE(clHitIdx);
+ clHits.Clear();
+}
 
 //
 int getNextValue(char*& p, char* line) {
@@ -880,81 +1135,129 @@ int getNextValue(char*& p, char* line) {
  //backup
  }
 
-double getNextNumber(char*& p, char* line) {
- //expects p to be on the first char of a numeric field
- while (isspace(*p) && *p!='\0') p++; //skip any spaces;
- if (*p=='\0') GError(ERR_INVALID_PAIR, line);
- char* endptr;
- double d=strtod(p, &endptr);
- if (endptr==p) GError(ERR_INVALID_PAIR, line);
- while (isspace(*endptr)) endptr--;
- //char c=*(end+1);
- p=endptr+1;
- *p='\0'; //destructive ending
- return d;
- //backup
- }
+//find the start of the (up to maxf) tab delimited fields of a line,
+//without altering it; returns the number of fields found
+int hitFields(char* line, char** fld, int maxf) {
+ int nf=0;
+ char* p=line;
+ while (nf<maxf) {
+   fld[nf++]=p;
+   p=fieldEnd(p);
+   if (*p=='\0') break;
+   p++;
+   }
+ return nf;
+}
+
+//parse a numeric field in place (lineofs is only used for the error message)
+int fieldValue(const char* fld, int64 lineofs) {
+ const char* p=fld;
+ while (*p==' ') p++;
+ bool neg=(*p=='-');
+ if (neg) p++;
+ if (!isdigit(*p)) GError(ERR_INVALID_HIT, (long long)lineofs);
+ int v=0;
+ while (isdigit(*p)) { v=v*10+(*p-'0'); p++; }
+ if (*p=='.' || *p=='e' || *p=='E') return (int)atof(fld);
+ return neg ? -v : v;
+}
 
 
-void showCl(GCluster* C) {
- GMessage("{%s",C->Get(0)->id);
-  for (int i=1;i<C->Count();i++) 
-     GMessage(" %s",C->Get(i)->id);
+void showCl(int* C, int count) {
+ GMessage("{%s",nodeNames[C[0]]);
+  for (int i=1;i<count;i++) 
+     GMessage(" %s",nodeNames[C[i]]);
  GMessage("}\n");
 }
 
 
-void collectNodes(GCluster* C, CNode* n, bool dbg) {
+//collect the members of the cluster of root n into d.clmembers (starting at
+//mStart[n]), setting their layout positions; returns the number of members
+int collectNodes(CNrclData& d, int n) {
+ GVec<int>& clmembers=d.clmembers;
+ int nb=d.nbase;
+ mStart[n]=clmembers.Count();
  if (transitive) {
-   // recursively descend to all links and add all the nodes to C
-   if (C->IndexOf(n)<0) C->Add(n); 
-                   else return; 
-   if (dbg && fTrees!=NULL)
-       if (n->kids->Count()>0) 
-               fprintf(fTrees, "%s:%d{", n->id, n->kids->Count());
-          else fprintf(fTrees, "%s ", n->id);
-     //do not traversed a branch already traversed
-   for (int i=0;i<n->kids->Count(); i++) { 
-       CNode* k=n->kids->Get(i);
-       if (k->parent!=n)
+   // descend the whole containment tree (iteratively, in pre-order);
+   // a node's subtree size is known when all its kids were visited
+   int z=0;
+   d.visited[(n-nb)>>3]|=(1<<((n-nb) & 7));
+   clmembers.Add(n);
+   d.clsubtree.Add(z);
+   d.dfsPos.Add(mStart[n]);
+   d.dfsKid.Add(d.kidStart[n-nb]);
+   while (d.dfsPos.Count()>0) {
+     int i=d.dfsPos.Count()-1;
+     int p=clmembers[d.dfsPos[i]];
+     if (d.dfsKid[i]<d.kidStart[p-nb+1]) {
+       int k=d.kidList[d.dfsKid[i]];
+       d.dfsKid[i]++;
+       if (nodeParent[k]!=p)
          GError("Error: kid '%s' should have '%s' as parent!\n",
-             k->id, n->id);
-       k->lytminus=(n->lytminus ^ k->pminus);
-       k->lytpos=n->lytpos + 
-             ((n->lytminus) ? n->len-k->len-k->poffs : k->poffs );
-       if (n!=k) collectNodes(C, k,dbg);
+             nodeNames[k], nodeNames[p]);
+       bool pminus=(nodeFlags[p] & NODE_LYTMINUS)!=0;
+       setNodeFlag(k, NODE_LYTMINUS, pminus ^ ((nodeFlags[k] & NODE_PMINUS)!=0));
+       lytPos[k]=lytPos[p] + 
+             ((pminus) ? nodeLen[p]-nodeLen[k]-nodePOffs[k] : nodePOffs[k] );
+       //do not traverse a branch already traversed
+       if (d.visited[(k-nb)>>3] & (1<<((k-nb) & 7))) continue;
+       d.visited[(k-nb)>>3]|=(1<<((k-nb) & 7));
+       int kpos=clmembers.Count();
+       clmembers.Add(k);
+       d.clsubtree.Add(z);
+       d.dfsPos.Add(kpos);
+       d.dfsKid.Add(d.kidStart[k-nb]);
+       }
+     else { //all the subtree of p was collected
+       d.clsubtree[d.dfsPos[i]]=clmembers.Count()-d.dfsPos[i];
+       d.dfsPos.setCount(i);
+       d.dfsKid.setCount(i);
        }
-   if (dbg && fTrees!=NULL) {
-     if (n->kids->Count()>0) fprintf(fTrees, "}");
-     if (n->parent==NULL) fprintf(fTrees, "\n");
      }
    } //transitive case
   else {//not transitive, collect only n and its immediate children
-   C->Add(n);
-   for (int i=0;i<n->kids->Count(); i++) {
-       CNode* k=n->kids->Get(i);
-       if (k->parent!=n && k->parent!=NULL) {
+   clmembers.Add(n);
+   for (int i=d.kidStart[n-nb];i<d.kidStart[n-nb+1]; i++) {
+       int k=d.kidList[i];
+       int kp=nodeParent[k];
+       if (kp!=n && kp>=0) {
            if (!do_share) GMessage(" Error: kid '%s' should have '%s' as parent!\n"
-                "(but the parent is set to '%s')\n", k->id, n->id, k->parent->id);
+                "(but the parent is set to '%s')\n", nodeNames[k], nodeNames[n], nodeNames[kp]);
          }
-       if (k->parent==NULL) continue;
-       k->lytpos=k->poffs;
-       k->lytminus=k->pminus;
-       if (n!=k) C->Add(k);
+       if (kp<0) continue;
+       lytPos[k]=nodePOffs[k];
+       setNodeFlag(k, NODE_LYTMINUS, (nodeFlags[k] & NODE_PMINUS)!=0);
+       if (n!=k) clmembers.Add(k);
        }
    
    }
+ return clmembers.Count()-mStart[n];
 }
 
-
-//add a new node with name id1, with length len1 
-CNode* addNode(char* id1, int len1, int ordn) {
- //use the same cluster
- CNode* n1=new CNode(id1,len1, ordn); //this automatically adds n1 to the shared t-cluster 
- all.shkAdd(n1->id,n1);
- seqs.Add(n1);
- return n1;
+//write the containment tree of a cluster (-d), from the pre-order
+//of its collected members and their subtree sizes
+//(no parent link is dropped in the transitive case, so nodeNumKids
+//is the number of kids)
+void writeTree(FILE* f, int root) {
+ CNrclData& d=nodeData(root);
+ GVec<int> ends; //end positions of the open subtrees
+ for (int j=mStart[root];j<mStart[root]+numSeqs[root];j++) {
+   int n=d.clmembers[j];
+   int nkids=nodeNumKids[n];
+   if (nkids>0) {
+     fprintf(f, "%s:%d{", nodeNames[n], nkids);
+     int e=j+d.clsubtree[j];
+     ends.Add(e);
+     }
+   else fprintf(f, "%s ", nodeNames[n]);
+   while (ends.Count()>0 && ends.Last()==j+1) {
+     fprintf(f, "}");
+     ends.setCount(ends.Count()-1);
+     }
+   }
+ fprintf(f, "\n");
 }
+
 /*
 //merge the links for two existing sequences, a longer one against a shorter one
 CNode* mergeLinks(CNode* nshort, CNode* nlong) {
@@ -982,26 +1285,30 @@ return ((C==&nshort->links) ? nshort : nlong);
  return true; //passed
  }*/
  
-void addPair(COverlap& o) {
- o.n1=all.Find(o.id1);
- o.n2=all.Find(o.id2);
+void addPair(CNrclData& d, COverlap& o) {
+ if (o.n1<0) { //the buffered hits (-T) have their nodes set already
+   int* id=nodeIds.Find(o.id1);
+   o.n1=(id==NULL) ? -1 : *id;
+   id=nodeIds.Find(o.id2);
+   o.n2=(id==NULL) ? -1 : *id;
+   }
  if (wclusters) {
-   if (o.n1->len==0 && o.n1!=NULL) o.n1->len=o.len1;
-   if (o.n2->len==0 && o.n2!=NULL) o.n2->len=o.len2;
+   if (o.n1>=0 && nodeLen[o.n1]==0) nodeLen[o.n1]=o.len1;
+   if (o.n2>=0 && nodeLen[o.n2]==0) nodeLen[o.n2]=o.len2;
    }
  bool new_n1=false;  
- if (o.n1==NULL) {
+ if (o.n1<0) {
         o.n1 = addNode(o.id1, o.len1);
         new_n1=true;
         }
     else 
-        if (o.n1->len!=o.len1) GError("Length mismatch for '%s'\n", o.id1);
+        if (nodeLen[o.n1]!=o.len1) GError("Length mismatch for '%s'\n", o.id1);
 
- if (o.n2==NULL) {
-       o.n2 = new_n1 ? addNode(o.id2, o.len2, o.n1->ordnum): addNode(o.id2, o.len2);
+ if (o.n2<0) {
+       o.n2 = new_n1 ? addNode(o.id2, o.len2, nodeOrd[o.n1]): addNode(o.id2, o.len2);
        }
     else 
-       if (o.n2->len!=o.len2) GError("Length mismatch for '%s'\n", o.id2);
+       if (nodeLen[o.n2]!=o.len2) GError("Length mismatch for '%s'\n", o.id2);
 
  if (o.n1==o.n2) return;
  // Now the big parenting decision:
@@ -1014,15 +1321,15 @@ void addPair(COverlap& o) {
  //decide who's the boss (parent), and clip as needed
  //int *w1=NULL, *w2=NULL; //weights
  bool nswap=false; //swap such that n1 is the "parent"
- //bool isFull1=startsWith(o.n1->id, "np|");
- //bool isFull2=startsWith(o.n2->id, "np|");
- int n1kids = o.n1->kids->Count();
- int n2kids = o.n2->kids->Count();
- if (o.n1->pweight>0 || o.n2->pweight>0) {
-    nswap=(o.n1->pweight<o.n2->pweight);
+ bool isFull1=(nodeFlags[o.n1] & NODE_FULL)!=0;
+ bool isFull2=(nodeFlags[o.n2] & NODE_FULL)!=0;
+ int n1kids = nodeNumKids[o.n1];
+ int n2kids = nodeNumKids[o.n2];
+ if (nodeWeight[o.n1]>0 || nodeWeight[o.n2]>0) {
+    nswap=(nodeWeight[o.n1]<nodeWeight[o.n2]);
     }
-   else if (o.n2->isFull ^ o.n1->isFull) {
-    nswap=(o.n2->isFull && !o.n1->isFull);
+   else if (isFull2 ^ isFull1) {
+    nswap=(isFull2 && !isFull1);
     }
    else if (by_length) { //pick by length
     nswap=(o.len1<o.len2);
@@ -1031,8 +1338,8 @@ void addPair(COverlap& o) {
     nswap=(n2kids>n1kids);
     }
    else {
-    nswap=(o.n1->ordnum==o.n2->ordnum) ? (o.len1>o.len2) :
-                               (o.n1->ordnum>o.n2->ordnum);
+    nswap=(nodeOrd[o.n1]==nodeOrd[o.n2]) ? (o.len1>o.len2) :
+                               (nodeOrd[o.n1]>nodeOrd[o.n2]);
      //the earliest encountered node should parent
     }
  if (nswap) o.Swap();
@@ -1041,26 +1348,26 @@ void addPair(COverlap& o) {
    ovl1=o.ovl2;ovl2=o.ovl1; }*/
    
   //clipping -- always clip the child, not the parent 
- //GMessage("Add %s[%d] to %s[%d] (gaps: %s/%s)\n", o.n2->id, o.n2->len, o.n1->id, o.n1->len, o.gaps2,o.gaps1);
+ //GMessage("Add %s[%d] to %s[%d] (gaps: %s/%s)\n", o.id2, o.len2, o.id1, o.len1, o.gaps2,o.gaps1);
  if (o.minus) {
-   clpL=o.n2->len-(o.o2start-1+o.ovl2);
+   clpL=o.len2-(o.o2start-1+o.ovl2);
    offs=o.o1start-1-clpL;
    clpR=o.o2start-1;
    }
   else {
    clpL=o.o2start-1;
-   clpR=o.n2->len-(o.o2start-1+o.ovl2);
+   clpR=o.len2-(o.o2start-1+o.ovl2);
    offs=o.o1start-o.o2start;
    }
  if (((o.len2-clpL-clpR)*100)/o.len2 >= minscov)
-   o.n2->assignParent(o.n1, o.score, offs, clpL, clpR, o.minus, o.gaps2, o.gaps1);
+   assignParent(d, o.n2, o.n1, o.score, offs, clpL, clpR, o.minus, o.gaps2, o.gaps1);
  //TRY to set n1 as the parent of n2, but with the provision for the EXISTING parent of n2!
  //(if decided, the previous parent of n2, if any, should abandon n2
  }
 
 #ifdef DBGTRACE
 void memlog(int level, const char* msg1,
-         GCluster* C=NULL,
+         GVec<int>* C=NULL,
          const char* msg2=NULL) {
  GStr s;
  if (level>0) {
@@ -1070,10 +1377,10 @@ void memlog(int level, const char* msg1,
  if (msg1!=NULL) s+=msg1;
  if (C!=NULL) {
      GStr s2;
-     s2.format("(%d){%s",C->Count(), C->Get(0)->id);
+     s2.format("(%d){%s",C->Count(), nodeNames[C->Get(0)]);
      s+=s2;
      for (int i=1;i<C->Count();i++)  {
-        s2.format(" %s",C->Get(i)->id);
+        s2.format(" %s",nodeNames[C->Get(i)]);
         s+=s2;
         }
      s+="}";
@@ -1133,34 +1440,27 @@ int readWeights(FILE* f, GHash<int>& xhash) {
 
 
 //============ comparison functions:
-int comparePtr(void* p1, void* p2) {
-  return (p1>p2) ? -1 : ((p1<p2)?1:0);
-  }
-//compare sequences by length
-
-int compareSize(void* p1, void* p2) { //by valid cluster size (all nodes)
- int c1=((CNode*)p1)->numseqs;
- int c2=((CNode*)p2)->numseqs;
- return (c1>c2)?-1:((c1<c2)?1:0);
+//(ties are broken by the node index, i.e. the creation order)
+int compareSize(const void* p1, const void* p2) { //by valid cluster size (all nodes)
+ int n1=*(const int*)p1;
+ int n2=*(const int*)p2;
+ if (numSeqs[n1]!=numSeqs[n2]) return (numSeqs[n1]>numSeqs[n2]) ? -1 : 1;
+ return (n1<n2) ? -1 : ((n1>n2) ? 1 : 0);
 }
 
-int compareLen(void* p1, void* p2) { //by sequence length (links)
- int c1=((CNode*)p1)->len;
- int c2=((CNode*)p2)->len;
- return (c1 > c2) ? -1 : ((c1<c2)? 1:0);
-}
-
-//=====
-int compareID(void* p1, void* p2) {
- return strcmp(((CNode*)p1)->id,((CNode*)p2)->id);
+//compare sequences by length
+int compareLen(const void* p1, const void* p2) { //by sequence length (links)
+ int n1=*(const int*)p1;
+ int n2=*(const int*)p2;
+ if (nodeLen[n1]!=nodeLen[n2]) return (nodeLen[n1]>nodeLen[n2]) ? -1 : 1;
+ return (n1<n2) ? -1 : ((n1>n2) ? 1 : 0);
 }
 
-int compareContained(void* p1, void* p2) { //by number of contained seqs
- GCluster* c1=((CNode*)p1)->contained;
- GCluster* c2=((CNode*)p2)->contained;
- int v1=(c1==NULL) ? 0: c1->Count();
- int v2=(c2==NULL) ? 0: c2->Count();
- return (v1 > v2) ? -1 : ((v1<v2)? 1:0);
+int compareContained(const void* p1, const void* p2) { //by number of contained seqs
+ int n1=*(const int*)p1;
+ int n2=*(const int*)p2;
+ if (nContained[n1]!=nContained[n2]) return (nContained[n1]>nContained[n2]) ? -1 : 1;
+ return (n1<n2) ? -1 : ((n1>n2) ? 1 : 0);
 }
 
 int readClusters(FILE* f) {
@@ -1172,7 +1472,7 @@ int readClusters(FILE* f) {
   //assumes: first line is always a defline 
   //         deflines are always shorter than 255
   //         sequence names are always shorter than 255 chars
-  CNode* seq=NULL;
+  int seq=-1;
   while (!feof(f)) {
    if (fgets(buf,255,f)==NULL) break;
    len=strlen(buf);
@@ -1192,15 +1492,15 @@ int readClusters(FILE* f) {
    //--now read all component sequences for this cluster
    len=0;
    scount=0;
-   GCluster* curcl=NULL;
+   int clidx=clStart.Count();
+   clStart.Add(nodeNames.Count());
    while ((c=getc(f))!=EOF) {
     if (isspace(c)) { //word separator found
       if (len>0) { //token found: it must be a sequence name
         buf[len]='\0';
         scount++;
-        seq=new CNode(buf, curcl, base_ordnum);
-        all.shkAdd(seq->id, seq); //add it to the global hash too
-        seqs.Add(seq);
+        seq=addNode(buf, 0, base_ordnum); /* length not known yet! */
+        nodeCluster.Add(clidx);
 
         len=0;
         }
@@ -1224,8 +1524,10 @@ int readClusters(FILE* f) {
     } //while getc
    base_ordnum++; 
    //GMessage("numseqs=%d, scount=%d\n", numseqs, scount);
-   if (scount!=numseqs) GError(ERR_CL_PARSE, seq->id);
+   if (scount!=numseqs) GError(ERR_CL_PARSE, (seq<0) ? buf : nodeNames[seq]);
    } //while
+ int z=nodeNames.Count();
+ clStart.Add(z); //end of the last cluster
  fclose(f);
  return count;
 }
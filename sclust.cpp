@@ -7,6 +7,9 @@
 #include "GStr.h"
 #include "GHash.hh"
 #include "GList.hh"
+#include "GBinHits.h"
+#include "GCompress.h"
+#include "GHitSort.h"
 
 #ifdef DBGTRACE
 #include <gcl/GShMem.h>
@@ -23,6 +26,7 @@ Usage:\n\
  sclust [<hits_file>] [-H] [-o <out_file>] [-L] [-C] [-x <excludefile>]\n\
  [-s <only_these>] [SEQFLT={ET|EST|ET2EST}] [HEAVY=xxxx] [ETBONUS=xxxx]\n\
  [SCOV=xx] [SCORE=xx] [PID=xx] [MAXCL=nnnnn]\n\
+ [-u [-M <mem_MB>] [-p <threads>]]\n\
 Parameters:\n\
 HEAVY=XXXX mininum score of a seed to be considered \"heavy\" so its \n\
           cluster be not allowed to merge with other \"heavy\" clusters. \n\
@@ -32,6 +36,10 @@ ETBONUS=XXXX default: 3000\n\
  -o  : write output in <out_file> instead of stdout\n\
  -L  : redirect stderr to file log_<outfile>\n\
  -C  : do not compact/adopt clusters before displaying results \n\
+ -u  : the hits are not sorted yet: sort them by score first, using an\n\
+       external sort; multiple hit files can be given (sorted together)\n\
+ -M  : memory limit (in MB) for the -u sorting (default: 1024)\n\
+ -p  : number of threads used for the -u sorting (default: 1)\n\
 \n\
 Optional pairing filters: \n\
  -s     :  only consider pairs/hits between sequences in <only_these>\n\
@@ -54,6 +62,7 @@ MAXCL=xxxxx do not allow clusters to grow past this number of sequences\n\
 If <hits_file> is not given, hits are expected at stdin\n\
 Each input line must have these tabulated fields:\n\n\
 q_name q_len q_n5 q_n3 hit_name hit_len hit_n5 hit_n3 pid score score2 strand\n\
+(binary hits files created by mgbconv are also accepted)\n\
 "
 
 int maxcl=60000;
@@ -286,7 +295,7 @@ void showCl(GCluster* C) {
 int main(int argc, char * const argv[]) {
  char inbuf[BUF_LEN]; // incoming buffer for sequence lines.
  GArgs args(argc, argv, 
-     "htHLCSs:o:l:x:w:HEAVY=ETBONUS=SEQFLT=PID=SCOV=LCOV=OVHANG=SCORE=MAXCL=");
+     "htHLCSus:o:l:x:w:M:p:HEAVY=ETBONUS=SEQFLT=PID=SCOV=LCOV=OVHANG=SCORE=MAXCL=");
  int e;
  if ((e=args.isError())>0)
     GError("%s\nInvalid argument: %s\n", usage, argv[e]);
@@ -425,85 +434,143 @@ int main(int argc, char * const argv[]) {
    }
  
  //==
- FILE* inf;
- if (!infile.is_empty()) {
-    inf=fopen(infile, "r");
+ FILE* inf=NULL;
+ GHitSorter* hsort=NULL;
+ if (args.getOpt('u')!=NULL) {
+    if (infile.is_empty())
+       GError("Error: option -u requires the hits file(s) to be given!\n");
+    s=args.getOpt('M');
+    int sortmem=s.is_empty() ? 1024 : s.asInt();
+    s=args.getOpt('p');
+    int sortthreads=s.is_empty() ? 1 : s.asInt();
+    if (sortmem<=0 || sortthreads<=0)
+       GError("Error: invalid -M or -p value (positive integers are expected)!\n");
+    hsort=new GHitSorter(sortthreads, sortmem);
+    hsort->addFile(infile.chars());
+    char* fname;
+    while ((fname=args.nextNonOpt())!=NULL)
+       hsort->addFile(fname);
+    GMessage("Sorting hits..\n");
+    hsort->sort();
+    GMessage("%d hits sorted.\n", hsort->numLines);
+    }
+ else if (!infile.is_empty()) {
+    inf=zfopenRead(infile);
     if (inf==NULL)
        GError("Cannot open input file %s!\n",infile.chars());
     }
   else
-   inf=stdin;
+   inf=zfwrapRead(stdin);
    
  //======== main program loop
  char* line;
+ GBinHitReader* hitrd=NULL; //hits converted by mgbconv
+ if (inf!=NULL && GBinHitReader::isBinary(inf)) hitrd=new GBinHitReader(inf);
+ GHitSource* hsrc=hsort;
+ int linelen;
+ GStr linecpy;
  //if (tabflt) 
    {
-    while ((line=fgets(inbuf, BUF_LEN-1,inf))!=NULL) {
-        int l=strlen(line);
-        if (line[l-1]=='\n') line[l-1]='\0';
-        GStr linecpy(line);
-        if (strlen(line)<=1) continue;
-        char* tabpos=line;
-        //find the 1st tab
-        tabpos=strchr(line, '\t');
-        if (tabpos==NULL || tabpos==line)
-            GError(ERR_INVALID_PAIR, line);
-        *tabpos='\0'; //so line would be the first node name
-
-        if (xcludeList.hasKey(line)) continue;
-        tabpos++; //tabpos is now on the first char of the second field (q_len)
+    while (hitrd!=NULL ? hitrd->next() : 
+             (hsrc!=NULL ? (line=hsrc->nextLine(linelen))!=NULL :
+                           (line=fgets(inbuf, BUF_LEN-1,inf))!=NULL)) {
+        char* tabpos;
         int score, score2, scov, lcov, ovh_l, ovh_r, pid;
-        //skip 3 other tabs delimited
-        //read the query length:
-        int qlen=getNextValue(tabpos, line);
-        tabpos++;
-        int q5=getNextValue(tabpos,line);
-        tabpos++;
-        int q3=getNextValue(tabpos,line);
-        tabpos++;
-        if (q5==q3) GError(ERR_INVALID_PAIR, line);
+        int qlen, q5, q3, hitlen, h5, h3;
         bool minus=false;
-        if (q5>q3) {
-          minus=true;
-          Gswap(q5,q3);
-          }
-        //now we should be on the first char of the hitname field
-        /*
-        while (isspace(*tabpos)) tabpos++; //skip any spaces in this second node name field
-        if (*tabpos=='\0') GError(ERR_INVALID_PAIR, line);
-        //add a string termination after this field
-        char* p=tabpos; while (!isspace(*p) && *p!='\0') p++;
-        *p='\0';
-        */
-        char* p=tabpos;
-        tabpos=getNextWord(p,(char*)linecpy.chars());
-        //now tabpos contains the exact second sequence string
-        //if (strstr(line, TRACESEQ)!=NULL || strstr(tabpos, TRACESEQ)!=NULL) {
-
-        if (strcmp(line, tabpos)==0) {
-          GMessage("Warning: self pairing found for node %s\n",line);
-          continue;
+        if (hitrd!=NULL) {
+          GBinHit& hit=hitrd->hit;
+          line=hit.qname;
+          tabpos=hit.hname;
+          if (xcludeList.hasKey(line)) continue;
+          if (strcmp(line, tabpos)==0) {
+            GMessage("Warning: self pairing found for node %s\n",line);
+            continue;
+            }
+          if (xcludeList.hasKey(tabpos)) continue;
+          if (!seq_filter(line, tabpos)) continue;
+          qlen=hit.qlen; q5=hit.q5; q3=hit.q3;
+          hitlen=hit.hlen; h5=hit.h5; h3=hit.h3;
+          if (q5==q3 || h5==h3) 
+             GError("Invalid hit record #%d (%s vs %s)\n", hitrd->numHits, line, tabpos);
+          if (q5>q3) {
+            minus=true;
+            Gswap(q5,q3);
+            }
+          if (h5>h3) {
+            Gswap(h5,h3);
+            minus=!minus;
+            }
+          pid=(int)hit.pid;
+          score=hit.score;
+          score2=(int)hit.score2;
+          if (flinks!=NULL) hit.toLine(linecpy);
           }
-         
-        if (xcludeList.hasKey(tabpos)) continue;        
-
-        if (!seq_filter(line, tabpos)) continue;
-
-        p++; //move on the first char of the hitlen 
-        int hitlen=getNextValue(p,line);
-        p++;
-        int h5=getNextValue(p,line);
-        p++;
-        int h3=getNextValue(p,line);
-        p++;
-        if (h5==h3) GError(ERR_INVALID_PAIR, line);
-        if (h5>h3) {
-           Gswap(h5,h3);
-           minus=!minus;
-           }
-        pid = getNextValue(p,line); p++;
-        score = getNextValue(p,line);p++;
-        score2 = getNextValue(p,line);
+        else {
+          int l=strlen(line);
+          if (line[l-1]=='\n') line[l-1]='\0';
+          linecpy=line;
+          if (strlen(line)<=1) continue;
+          tabpos=line;
+          //find the 1st tab
+          tabpos=strchr(line, '\t');
+          if (tabpos==NULL || tabpos==line)
+              GError(ERR_INVALID_PAIR, line);
+          *tabpos='\0'; //so line would be the first node name
+
+          if (xcludeList.hasKey(line)) continue;
+          tabpos++; //tabpos is now on the first char of the second field (q_len)
+          //skip 3 other tabs delimited
+          //read the query length:
+          qlen=getNextValue(tabpos, line);
+          tabpos++;
+          q5=getNextValue(tabpos,line);
+          tabpos++;
+          q3=getNextValue(tabpos,line);
+          tabpos++;
+          if (q5==q3) GError(ERR_INVALID_PAIR, line);
+          if (q5>q3) {
+            minus=true;
+            Gswap(q5,q3);
+            }
+          //now we should be on the first char of the hitname field
+          /*
+          while (isspace(*tabpos)) tabpos++; //skip any spaces in this second node name field
+          if (*tabpos=='\0') GError(ERR_INVALID_PAIR, line);
+          //add a string termination after this field
+          char* p=tabpos; while (!isspace(*p) && *p!='\0') p++;
+          *p='\0';
+          */
+          char* p=tabpos;
+          tabpos=getNextWord(p,(char*)linecpy.chars());
+          //now tabpos contains the exact second sequence string
+          //if (strstr(line, TRACESEQ)!=NULL || strstr(tabpos, TRACESEQ)!=NULL) {
+
+          if (strcmp(line, tabpos)==0) {
+            GMessage("Warning: self pairing found for node %s\n",line);
+            continue;
+            }
+           
+          if (xcludeList.hasKey(tabpos)) continue;        
+
+          if (!seq_filter(line, tabpos)) continue;
+
+          p++; //move on the first char of the hitlen 
+          hitlen=getNextValue(p,line);
+          p++;
+          h5=getNextValue(p,line);
+          p++;
+          h3=getNextValue(p,line);
+          p++;
+          if (h5==h3) GError(ERR_INVALID_PAIR, line);
+          if (h5>h3) {
+             Gswap(h5,h3);
+             minus=!minus;
+             }
+          pid = getNextValue(p,line); p++;
+          score = getNextValue(p,line);p++;
+          score2 = getNextValue(p,line);
+          } //text line
         //compute coverages:
         char q_ext=0;
         char h_ext=0;        
@@ -569,7 +636,9 @@ int main(int argc, char * const argv[]) {
            }
       } //while
      } //tabulated hits case
-  if (inf!=stdin) fclose(inf);
+  delete hitrd;
+  delete hsrc;
+  if (inf!=NULL && inf!=stdin) zfclose(inf);
   //if (fpairs!=NULL && fpairs!=stdout) fclose(fpairs);
   //fclose(fwarng);
   //==========
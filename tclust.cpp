@@ -7,7 +7,10 @@
 #include "GArgs.h"
 #include "GStr.h"
 #include "GHash.hh"
-#include "GList.hh"
+#include "GVec.hh"
+#include "GBinHits.h"
+#include "GCompress.h"
+#include "GThreads.h"
 
 #ifdef DBGTRACE
 #include <gcl/GShMem.h>
@@ -15,15 +18,32 @@
 
 #define usage "Perform transitive-closure clustering by filtering tabulated hits. Usage:\n\
  tclust [<hits_file>] [-H] [-f <flthits_file>] [-o <out_file>] [-x <xcludelist>]\n\
- [-s <seqlist>] [-r <restrictlst>] [-c <clone_lines>]\n\
+ [-s <seqlist>] [-r <restrictlst>] [-c <clone_lines>] [-p <threads>]\n\
+ [--update <state_file> [-d <diff_file>]] [-k <state_file>]\n\
  [SEQFLT={ET|EST|ET2EST}] [-x <excludefile>] [SCOV=xx] [LCOV=xx] [SCORE=xx] \n\
  [OVHANG=xx] [OVL=xx] [PID=xx]\n\
+ tclust --merge [-H] [-o <out_file>] [-k <state_file>] <cls_file>..\n\
  Options:\n\
  -H  : disable the fasta-style header (with node count info) for output clusters\n\
  -o  : write output in <out_file> instead of stdout\n\
  -t  : expects the tabulated hit data format, using only the \n\
        first and fifth fields (when no hit filter is used)\n\
  -f  : write to <flthits_file> all the lines that passed the filters\n\
+ -p  : use <threads> threads to parse, filter and link the text hits;\n\
+       the clusters are the same, but the -f output is no longer\n\
+       in the input order\n\
+ -k  : save the final clustering state (sequence names and t-cluster links)\n\
+       into <state_file>, so new hits can be added to it later (--update)\n\
+ --update load the clustering state saved by a previous run (-k) from\n\
+       <state_file> and add the new hits (and -c clones) to it\n\
+ -d  : with --update, write into <diff_file> the t-clusters changed by the\n\
+       new hits, one per line: the cluster ID (as in the output), its size,\n\
+       the first sequence of each previous t-cluster merged into it and the\n\
+       new sequences (comma delimited lists, '-' if empty)\n\
+ --merge  combine the t-clusters from multiple tclust output files (with\n\
+       or without -H) or state files (-k), e.g. from runs on separate\n\
+       hit shards: t-clusters sharing any sequence are merged, so the\n\
+       output is the same as for a single run on all the hits\n\
  \n\
  Filters (optional, can be combined):\n\
  -s use only pairs involving at least one sequence from <seqlist> \n\
@@ -48,88 +68,27 @@
  If no filters are used and -t option is not used, the program expects just \n\
  space delimited pairs; otherwise each line must have these tabulated fields:\n\n\
  q_name q_len q_n5 q_n3 hit_name hit_len hit_n5 hit_n3 pid score p-value strand\n\
+ Binary hits files created by mgbconv are also accepted (as if -t was given).\n\
 "
-#define BUF_LEN 4096 //maximum input line length 
+#define HBLOCK_SIZE 4194304 //input read size
 #define ERR_INVALID_PAIR "Invalid input line encountered:\n%s\n"
 //============ structures:
-//define a cluster object as a list of node names (GStrs)
-int comparePtr(void* p1, void* p2) {
-  return (p1>p2) ? -1 : ((p1<p2)?1:0);
-  }
+//the nodes (sequences) are identified by their index in nodeNames,
+//and the t-clusters are the sets of a disjoint-set forest over them
+//(union by size, with path compression); the node lists of the
+//t-clusters are only built at the end, for output
+GHash<int> nodeIds; //node name -> node index
+GVec<char*> nodeNames;
+GVec<int> dsParent; //parent of each node (roots are their own parent)
+GVec<int> dsSize; //number of nodes in the set of each root
+int numClusters=0;
+int stateNodes=0; //number of nodes loaded from a state file (--update)
+int* stateRoots=NULL; //their t-cluster roots in that state
 
-class CNode;
-
-class GCluster :public GList<CNode> {
- public:
-  bool operator==(GCluster& d){
-     return (this==&d);
-     }
-  bool operator>(GCluster& d){
-     return (this>&d);
-     }
-  bool operator<(GCluster& d){
-     return (this<&d);
-     }
-  GCluster():GList<CNode>(true,false,true) {
-   //default is: sorted by Node pointer, don't free nodes, unique
-    }
-  GCluster(bool sorted, bool free_elements=true, bool beUnique=false):
-     GList<CNode>(sorted,free_elements,beUnique) {
-       }
-  };
-
-class CNode {
- public:
-   char* id; //actual node ID
-   GCluster* cluster; /* pointer to a list of nodes (the t-cluster
-                         containing this sequence) */
-   //GCluster links; //list of all nodes linked to this node
-   CNode(char* name) {
-    //links are sorted, not free, unique
-    id=Gstrdup(name);    
-    cluster=new GCluster;
-    cluster->Add(this);
-    }
-   CNode(char* name, CNode* pairnode) {
-    id=Gstrdup(name);
-    cluster=pairnode->cluster; //same cluster
-    cluster->Add(this); //add self to the cluster
-    }
-   /* no need for these for basic transitive closure:
-   CNode(char* name):links(true,false,true) {
-    //links are sorted, not free, unique
-    id=Gstrdup(name);    
-    cluster=new GCluster;
-    cluster->Add(this);
-    }
-   CNode(char* name, CNode* pairnode):links(true,false,true) {
-    id=Gstrdup(name);
-    cluster=pairnode->cluster; //same cluster
-    cluster->Add(this); //add self to the cluster
-    }
-   // links management:
-   int linksCount(GCluster* C) {
-    // returns the number of links that this node  has within cluster C    
-    int cnt=0;
-    for (int i=0;i<links.Count();i++) 
-       if (C->IndexOf(links[i])>=0) cnt++;
-    return cnt;
-    }
-   */ 
-  //comparison: just pointer based:
-    bool operator==(CNode& d){
-     return (this==&d);
-     }
-    bool operator>(CNode& d){
-     return (this>&d);
-     }
-    bool operator<(CNode& d){
-     return (this<&d);
-     }
- };
-
-//-- global hash containing all the nodes
-GHash<CNode> all;
+struct TCluster {
+  int start; //first node in the members array
+  int count;
+};
 
 #ifdef DBGTRACE
    GShMem mem("tclust", 4096);
@@ -140,6 +99,7 @@ GHash<CNode> all;
 
 bool asfasta;
 bool tabflt; //flag indicating that tabulated hit lines are expected
+bool hitflt=false; //hit filters were given, not just -t
 bool flt_ET_only=false;
 bool flt_EST_only=false;
 bool flt_EST2ET=false;
@@ -148,44 +108,65 @@ bool flt_seqOnly=false;
 bool flt_seqRestrict=false;
 bool ETcheck=false;
 bool do_debug=false;
-
-static char inbuf[BUF_LEN]; // incoming buffer for sequence lines.
+int minpid=0, minscov=0, minlcov=0, minovl=20, maxovhang=1000, minscore=0;
+int num_threads=1;
 
 FILE* outf;
+FILE* fpairs=NULL; //-f output
+FILE* hitsf=NULL; //text hits input
 
-//all clusters are stored in a unique sorted list
 GHash<int> excludeList;
 GHash<int> seqonlyList;
-GList<GCluster> tclusters(true,true,true);
 
 //=========== functions used:
 void addPair(char* n1, char* n2);
-int compareCounts(void* p1, void* p2);
-int compareID(void* p1, void* p2); //compare node IDs
-int getNextValue(char*& p, char* line);
+int linkNameList(char* line, GVec<int>& group, bool restrict=false);
+void writeClusters(FILE* f, FILE* fdiff=NULL);
+void writeState(const char* fname);
+void loadState(const char* fname, bool update=false);
+void loadBinHits(FILE* inf);
+void mergeInput(const char* fname);
+void writeDiff(FILE* f, TCluster* cls);
 bool seq_filter(char* s1, char* s2); //returns true if the pair can pass through the filter
 int readNames(FILE* f, GHash<int>& xhash);
 int readClones(FILE* f);
+bool tabHitPasses(char* line, char*& hname);
+bool pairPasses(char* line, char*& hname);
+void loadHits(bool concurrent);
+int pNodeId(const char* name);
+void pLinkNodes(int n1, int n2);
+void parallelLoad();
 
 //========================================================
 //====================     main      =====================
 //========================================================
 int main(int argc, char * const argv[]) {
- GArgs args(argc, argv, "htHf:c:o:s:r:x:SEQFLT=PID=SCOV=OVHANG=LCOV=OVL=SCORE=DEBUG=");
+ GArgs args(argc, argv, "htHf:c:d:k:o:p:s:r:x:SEQFLT=PID=SCOV=OVHANG=LCOV=OVL=SCORE=DEBUG=update=merge;");
  int e;
  if ((e=args.isError())>0)
     GError("%s\nInvalid argument: %s\n", usage, argv[e]);
  if (args.getOpt('h')!=NULL) GError("%s\n", usage);
 
  GStr infile;
+ GVec<GStr> mergefiles;
+ bool mergemode=(args.getOpt("merge")!=NULL);
  if (args.startNonOpt()) {
         infile=args.nextNonOpt();
         GMessage("Given file: %s\n",infile.chars());
+        if (mergemode) {
+          mergefiles.Add(infile);
+          char* a;
+          while ((a=args.nextNonOpt())!=NULL) {
+            GStr mfile(a);
+            mergefiles.Add(mfile);
+            }
+          }
         }
+ if (mergemode && mergefiles.Count()==0)
+   GError("%s\nError: --merge requires input files!\n", usage);
  asfasta=(args.getOpt('H')==NULL);
  tabflt=(args.getOpt('t')!=NULL);
  do_debug=(args.getOpt("DEBUG")!=NULL);
- int minpid=0, minscov=0, minlcov=0, minovl=20, maxovhang=1000, minscore=0;
  GStr s=args.getOpt('x');
  FILE* fxclude=NULL;
  if (!s.is_empty()) {
@@ -220,6 +201,14 @@ int main(int argc, char * const argv[]) {
    fclose(fseqonly);
    }
 
+ GStr statefile=args.getOpt("update");
+ if (!statefile.is_empty()) {
+   if (mergemode) GError("%s\nError: --update cannot be used with --merge!\n", usage);
+   loadState(statefile.chars(), true);
+   }
+ GStr difffile=args.getOpt('d');
+ if (!difffile.is_empty() && statefile.is_empty())
+   GError("%s\nError: option -d requires --update <state_file>!\n", usage);
  s=args.getOpt('c');
  if (!s.is_empty()) {
    if ((fxclude=fopen(s, "r"))==NULL)
@@ -250,12 +239,14 @@ int main(int argc, char * const argv[]) {
  s=args.getOpt("PID");
  if (!s.is_empty()) {
     tabflt=true;
+    hitflt=true;
     minpid = s.asInt();
     if (minpid>0) GMessage("PID=%d\n",  minpid);
    }
  s=args.getOpt("SCOV");   
  if (!s.is_empty()) {
     tabflt=true;
+    hitflt=true;
     minscov = s.asInt();
     if (minscov>0) GMessage("SCOV=%d\n",  minscov);
    }
@@ -263,6 +254,7 @@ int main(int argc, char * const argv[]) {
  s=args.getOpt("OVHANG");
  if (!s.is_empty()) {
     tabflt=true;
+    hitflt=true;
     maxovhang = s.asInt();
    }
  if (maxovhang<1000) GMessage("OVHANG=%d\n",  maxovhang);   
@@ -270,6 +262,7 @@ int main(int argc, char * const argv[]) {
  s=args.getOpt("OVL");
  if (!s.is_empty()) {
     tabflt=true;
+    hitflt=true;
     minovl = s.asInt();
    }
  if (minovl>0) GMessage("OVL=%d\n",  minovl);   
@@ -277,161 +270,55 @@ int main(int argc, char * const argv[]) {
  s=args.getOpt("LCOV");
  if (!s.is_empty()) {
     tabflt=true;
+    hitflt=true;
     minlcov = s.asInt();
     if (minlcov>0) GMessage("LCOV=%d\n",  minlcov);
    }
  s=args.getOpt("SCORE");   
  if (!s.is_empty()) {
     tabflt=true;
+    hitflt=true;
     minscore = s.asInt();
     if (minscore>0) GMessage("SCORE=%d\n",  minscore);
    }
  
- //==
- FILE* inf;
- if (!infile.is_empty()) {
-    inf=fopen(infile, "r");
-    if (inf==NULL)
-       GError("Cannot open input file %s!\n",infile.chars());
-    }
-  else
-   inf=stdin;
-   
- GStr pfile=args.getOpt('f'); //write filtered pairs here
- FILE* fpairs=NULL;
- if (!pfile.is_empty()) {
-   if (pfile == "-") 
-      fpairs=stdout;
-    else 
-     if ((fpairs=fopen(pfile, "w"))==NULL)
-      GError("Cannot write filtered hits file '%s'!", pfile.chars());
-   }
-  
+ s=args.getOpt('p');
+ if (!s.is_empty()) {
+   num_threads=s.asInt();
+   if (num_threads<=0)
+      GError("Error: invalid -p <threads> value (%s)!\n", s.chars());
+   }
  //======== main program loop
- char* line;
- if (tabflt) {
-    while ((line=fgets(inbuf, BUF_LEN-1,inf))!=NULL) {
-        int l=strlen(line);
-        if (line[l-1]=='\n') line[l-1]='\0';
-        GStr linecpy(line);
-        if (strlen(line)<=1) continue;
-        char* tabpos=line;
-        //find the 1st tab
-        while (*tabpos != '\t' && *tabpos!='\0') tabpos++;
-        if (*tabpos=='\0' || tabpos==line)
-            GError(ERR_INVALID_PAIR, line);
-        *tabpos='\0'; //so line would be the first node name
-        if (flt_Exclude && excludeList.hasKey(line)) continue;
-        tabpos++; //tabpos is now on the first char of the second field (q_len)
-        int score, scov, ovh_r, ovh_l, lcov, pid;
-        //skip 3 other tabs delimited
-        //read the query length:
-        int qlen=getNextValue(tabpos, line);
-        tabpos++;
-        int q5=getNextValue(tabpos,line);
-        tabpos++;
-        int q3=getNextValue(tabpos,line);
-        tabpos++;
-        if (q5==q3) GError(ERR_INVALID_PAIR, line);
-        bool minus=false;
-        if (q5>q3) {
-          Gswap(q5,q3);
-          minus=true;
-          }
-
-        //now we should be on the first char of the hitname field
-        while (isspace(*tabpos)) tabpos++; //skip any spaces in this second node name field
-        if (*tabpos=='\0') GError(ERR_INVALID_PAIR, line);
-        //add a string termination after this field
-        char* p=tabpos; while (!isspace(*p) && *p!='\0') p++;
-        *p='\0';
-        //now tabpos contains the exact second sequence string
-        if (flt_seqOnly && seqonlyList.Find(line)==NULL && seqonlyList.Find(tabpos)==NULL)
-             continue;
-        if (flt_seqRestrict && (seqonlyList.Find(line)==NULL || seqonlyList.Find(tabpos)==NULL))
-             continue;
-             
-        if (strcmp(line, tabpos)==0) {
-          GMessage("Warning: self pairing found for node %s\n",line);
-          continue;
-          }
-        if (flt_Exclude && excludeList.hasKey(tabpos)) continue;
-        if (!seq_filter(line, tabpos)) continue;
-        p++; //move on the first char of the hitlen 
-        int hitlen=getNextValue(p,line);
-        p++;
-        int h5=getNextValue(p,line);
-        p++;
-        int h3=getNextValue(p,line);
-        p++;
-        if (h5==h3) GError(ERR_INVALID_PAIR, line);
-        if (h5>h3) {
-          Gswap(h5,h3);
-          minus=!minus;
-          }
-        pid=getNextValue(p,line); p++;
-        score=getNextValue(p,line);
-        //compute coverages:
-        ovh_r=minus ?(GMIN(q5-1, hitlen-h3)) :(GMIN(hitlen-h3, qlen-q3));
-        ovh_l=minus ?(GMIN(h5-1, qlen-q3)) :(GMIN(h5-1, q5-1));
-        int overlap = GMAX(q3-q5+1, h3-h5+1);
-        if (hitlen>qlen) { //query is shorter
-          scov = (int) rint(((double)(q3-q5)*100)/qlen);
-          lcov = (int) rint(((double)(h3-h5)*100)/hitlen);
-          }
-        else {
-          lcov = (int) rint(((double)(q3-q5)*100)/qlen);
-          scov = (int) rint(((double)(h3-h5)*100)/hitlen);
-          }
-          
-        if (scov>=minscov && lcov>=minlcov && pid>=minpid && overlap>=minovl
-            && score>=minscore && ovh_r <= maxovhang && ovh_l <= maxovhang) {
-           //GMessage("%s(%d) %d-%d  | %s(%d) %d-%d, pid=%d%%, score=%d, scov=%d%%, lcov=%d%%\n",
-           //          line,qlen,q5,q3,tabpos,hitlen, h5,h3,pid, score, scov, lcov);
-           if (fpairs!=NULL) fprintf(fpairs, "%s\n", linecpy.chars());
-           //if (fpairs!=NULL) 
-           //   fprintf(fpairs, "%s\t%s\t%d\t%d\n",line, tabpos, ovh_l, ovh_r);
-           addPair(line, tabpos);
-           }
-      } //while
-     } //tabulated hits case
-  else {//pairs only:  
-     while ((line=fgets(inbuf, BUF_LEN-1,inf))!=NULL) {
-      line[BUF_LEN-1]='\0';
-      int l=strlen(line);
-      if (line[l-1]=='\n') line[l-1]='\0';
-      GStr linecpy(line);
-      if (strlen(line)<=1) continue;
-      char* tabpos=line;
-      while (!isspace(*tabpos) && *tabpos!='\0') tabpos++; 
-      if (*tabpos=='\0' || tabpos==line)
-          GError(ERR_INVALID_PAIR, line);
-      *tabpos='\0';
-      if (flt_Exclude && excludeList.hasKey(line)) continue;
-      tabpos++;
-      while (isspace(*tabpos)) tabpos++;
-      if (*tabpos=='\0') GError(ERR_INVALID_PAIR, line);
-      char *c; //extra check here, to avoid stupid mistakes..
-      if ((c=strchr(tabpos, '\t'))!=NULL && strchr(c+1, '\t')!=NULL)
-         GError("The incoming stream seem to not be just pairs: \n%s\t%s\n", 
-             line, tabpos);
-      if (strcmp(line, tabpos)==0) {
-        GMessage("Warning: self pairing found for node %s\n",line);
-        continue;
-        }
-      if (flt_seqOnly && seqonlyList.Find(line)==NULL && seqonlyList.Find(tabpos)==NULL)
-             continue;
-      if (flt_seqRestrict && (seqonlyList.Find(line)==NULL || seqonlyList.Find(tabpos)==NULL))
-             continue;
-      if (flt_Exclude && excludeList.hasKey(tabpos)) continue;
-      if (!seq_filter(line, tabpos)) continue;
-      addPair(line, tabpos);
-      if (fpairs!=NULL) fprintf(fpairs, "%s\n", linecpy.chars());
+ if (mergemode) {
+   for (int i=0;i<mergefiles.Count();i++)
+     mergeInput(mergefiles[i].chars());
+   }
+ else {
+   FILE* inf;
+   if (!infile.is_empty()) {
+      inf=zfopenRead(infile);
+      if (inf==NULL)
+         GError("Cannot open input file %s!\n",infile.chars());
       }
-    }
-    
-  if (inf!=stdin) fclose(inf);
-  if (fpairs!=NULL && fpairs!=stdout) fclose(fpairs);
+    else
+     inf=zfwrapRead(stdin);
+   GStr pfile=args.getOpt('f'); //write filtered pairs here
+   if (!pfile.is_empty()) {
+     if (pfile == "-") 
+        fpairs=stdout;
+      else 
+       if ((fpairs=fopen(pfile, "w"))==NULL)
+        GError("Cannot write filtered hits file '%s'!", pfile.chars());
+     }
+   if (GBinHitReader::isBinary(inf)) loadBinHits(inf); //hits converted by mgbconv
+   else {
+     hitsf=inf;
+     if (num_threads>1) parallelLoad();
+       else loadHits(false);
+     }
+   if (inf!=stdin) zfclose(inf);
+   if (fpairs!=NULL && fpairs!=stdout) fclose(fpairs);
+   }
   //==========
   //
   GStr outfile=args.getOpt('o');
@@ -441,111 +328,421 @@ int main(int argc, char * const argv[]) {
         GError("Cannot open file %s for writing!\n",outfile.chars());
      }
    else outf=stdout;
-  GMessage("Total t-clusters: %d \n", tclusters.Count());
-  tclusters.setSorted(&compareCounts);
-  if (tclusters.Count()>0) {
-     GMessage("Largest cluster has %d nodes\n", tclusters[0]->Count());
-     for (int i=0; i<tclusters.Count(); i++) {
-        GCluster* c=tclusters[i];
-        c->setSorted(&compareID);
-        if (asfasta) fprintf(outf,">CL%d\t%d\n", i+1, c->Count());
-        CNode* n=c->Get(0);fprintf(outf,"%s",n->id);
-        for (int j=1; j<c->Count();j++)
-          fprintf(outf,"\t%s",c->Get(j)->id);
-        fprintf(outf,"\n");
-        }
-     fflush(outf);
+  FILE* fdiff=NULL;
+  if (!difffile.is_empty()) {
+     fdiff=fopen(difffile, "w");
+     if (fdiff==NULL)
+        GError("Cannot open file %s for writing!\n",difffile.chars());
      }
-  all.Clear(); //this frees the nodes
-  tclusters.Clear(); /* this frees the clusters, 
-     but should not try to free the nodes inside */
-  //GMessage("the tclusters list was cleared!\n");
+  writeClusters(outf, fdiff);
+  if (fdiff!=NULL) fclose(fdiff);
+  statefile=args.getOpt('k');
+  if (!statefile.is_empty()) writeState(statefile.chars());
+  nodeIds.Clear();
+  GFREE(stateRoots);
+  for (int i=0;i<nodeNames.Count();i++) GFREE(nodeNames[i]);
   if (outf!=stdout) fclose(outf);
   GMessage("*** all done ***\n");
   //getc(stdin);
 }
 
-//
-int getNextValue(char*& p, char* line) {
- //expects p to be on the first char of a numeric field
- char* start, *end;
- while (isspace(*p) && *p!='\0') p++; //skip any spaces;
+//decode a numeric field; decimal values are rounded
+int fieldValue(const char* fld, char* line) {
+ const char* p=fld;
+ while (*p==' ') p++;
+ bool neg=(*p=='-');
+ if (neg) p++;
+ if (!isdigit(*p)) GError(ERR_INVALID_PAIR, line);
+ int v=0;
+ while (isdigit(*p)) { v=v*10+(*p-'0'); p++; }
+ if (*p=='.' || *p=='e' || *p=='E') return (int)rint(atof(fld));
+ return neg ? -v : v;
+}
+
+//parse a tabulated hit line in place and apply the filters;
+//line becomes the query name and hname is set to the hit name.
+//The line is split only up to the last field needed by the filters:
+//q_name q_len q_n5 q_n3 hit_name hit_len hit_n5 hit_n3 pid score
+bool tabHitPasses(char* line, char*& hname) {
+ char* fld[10];
+ int lastf=4; //just the names
+ if (hitflt) lastf=(minscore>0) ? 9 : ((minpid>0) ? 8 : 7);
+ fld[0]=line;
+ char* p=line;
+ for (int f=1;f<=lastf;f++) {
+   while (*p!='\t' && *p!='\0') p++;
+   if (*p=='\0' || (f==1 && p==line))
+     GError(ERR_INVALID_PAIR, line);
+   *p++='\0';
+   fld[f]=p;
+   }
+ if (flt_Exclude && excludeList.hasKey(line)) return false;
+ //the hit name field
+ p=fld[4];
+ while (isspace(*p)) p++; //skip any spaces in this second node name field
  if (*p=='\0') GError(ERR_INVALID_PAIR, line);
- start=p;
- while (*p!='\t' && *p!='\0') p++;
- //now p should be on the next tab or eos;
- end=p-1;
- while (isspace(*end)) end--;
- //char c=*(end+1);
- *(end+1)='\0';
- double d=atof(start);
- return (int)rint(d);
- //backup
- }
-//=====
-int compareCounts(void* p1, void* p2) {
- int c1=((GCluster*)p1)->Count();
- int c2=((GCluster*)p2)->Count();
- return (c1>c2)?-1:((c1<c2)?1:0);
+ hname=p;
+ while (!isspace(*p) && *p!='\0') p++; //the name ends at the first space
+ *p='\0';
+ if (flt_seqOnly && seqonlyList.Find(line)==NULL && seqonlyList.Find(hname)==NULL)
+      return false;
+ if (flt_seqRestrict && (seqonlyList.Find(line)==NULL || seqonlyList.Find(hname)==NULL))
+      return false;
+ if (strcmp(line, hname)==0) {
+   GMessage("Warning: self pairing found for node %s\n",line);
+   return false;
+   }
+ if (flt_Exclude && excludeList.hasKey(hname)) return false;
+ if (!seq_filter(line, hname)) return false;
+ if (!hitflt) return true;
+ int qlen=fieldValue(fld[1], line);
+ int q5=fieldValue(fld[2], line);
+ int q3=fieldValue(fld[3], line);
+ int hitlen=fieldValue(fld[5], line);
+ int h5=fieldValue(fld[6], line);
+ int h3=fieldValue(fld[7], line);
+ if (q5==q3 || h5==h3) GError(ERR_INVALID_PAIR, line);
+ bool minus=false;
+ if (q5>q3) {
+   Gswap(q5,q3);
+   minus=true;
+   }
+ if (h5>h3) {
+   Gswap(h5,h3);
+   minus=!minus;
+   }
+ if (minpid>0 && fieldValue(fld[8], line)<minpid) return false;
+ if (minscore>0 && fieldValue(fld[9], line)<minscore) return false;
+ //compute coverages:
+ int scov, lcov;
+ int ovh_r=minus ?(GMIN(q5-1, hitlen-h3)) :(GMIN(hitlen-h3, qlen-q3));
+ int ovh_l=minus ?(GMIN(h5-1, qlen-q3)) :(GMIN(h5-1, q5-1));
+ int overlap = GMAX(q3-q5+1, h3-h5+1);
+ if (hitlen>qlen) { //query is shorter
+   scov = (int) rint(((double)(q3-q5)*100)/qlen);
+   lcov = (int) rint(((double)(h3-h5)*100)/hitlen);
+   }
+ else {
+   lcov = (int) rint(((double)(q3-q5)*100)/qlen);
+   scov = (int) rint(((double)(h3-h5)*100)/hitlen);
+   }
+ return (scov>=minscov && lcov>=minlcov && overlap>=minovl
+     && ovh_r <= maxovhang && ovh_l <= maxovhang);
 }
 
+//same for a line with just a pair of names
+bool pairPasses(char* line, char*& hname) {
+ char* tabpos=line;
+ while (!isspace(*tabpos) && *tabpos!='\0') tabpos++; 
+ if (*tabpos=='\0' || tabpos==line)
+     GError(ERR_INVALID_PAIR, line);
+ *tabpos='\0';
+ if (flt_Exclude && excludeList.hasKey(line)) return false;
+ tabpos++;
+ while (isspace(*tabpos)) tabpos++;
+ if (*tabpos=='\0') GError(ERR_INVALID_PAIR, line);
+ char *c; //extra check here, to avoid stupid mistakes..
+ if ((c=strchr(tabpos, '\t'))!=NULL && strchr(c+1, '\t')!=NULL)
+    GError("The incoming stream seem to not be just pairs: \n%s\t%s\n", 
+        line, tabpos);
+ if (strcmp(line, tabpos)==0) {
+   GMessage("Warning: self pairing found for node %s\n",line);
+   return false;
+   }
+ if (flt_seqOnly && seqonlyList.Find(line)==NULL && seqonlyList.Find(tabpos)==NULL)
+        return false;
+ if (flt_seqRestrict && (seqonlyList.Find(line)==NULL || seqonlyList.Find(tabpos)==NULL))
+        return false;
+ if (flt_Exclude && excludeList.hasKey(tabpos)) return false;
+ if (!seq_filter(line, tabpos)) return false;
+ hname=tabpos;
+ return true;
+}
 //=====
-int compareID(void* p1, void* p2) {
- return strcmp(((CNode*)p1)->id,((CNode*)p2)->id);
+int compareNodes(const void* p1, const void* p2) { //by node name
+ return strcmp(nodeNames[*(const int*)p1], nodeNames[*(const int*)p2]);
 }
 
+int* clMembers=NULL; //node indexes, grouped by t-cluster
+
+//by size (largest first), then by the name of the first node
+int compareClusters(const void* p1, const void* p2) {
+ const TCluster* c1=(const TCluster*)p1;
+ const TCluster* c2=(const TCluster*)p2;
+ if (c1->count!=c2->count) return (c1->count>c2->count)?-1:1;
+ return compareNodes(&clMembers[c1->start], &clMembers[c2->start]);
+}
 
 //-----
-//both nodes are new - create global entries for them
-// and a new shared t-cluster containing them 
-void newPair(char* id1, char* id2, CNode*& n1, CNode*& n2) {
- n1=new CNode(id1); /* this creates a new cluster with only self in it */
- n2=new CNode(id2, n1); //d2->cluster set to d1->cluster
- //d1->cluster->Add(d2); //second CNode added to the cluster
- all.shkAdd(n1->id,n1);
- all.shkAdd(n2->id,n2);
- //one cluster created: add it to the global list of t-clusters:
- tclusters.Add(n1->cluster);
+//get the index of node name, adding it as a new single node t-cluster
+//if it was not seen before
+int nodeId(const char* name) {
+ int* id=nodeIds.Find(name);
+ if (id!=NULL) return *id;
+ int n=nodeNames.Count();
+ char* s=Gstrdup(name);
+ nodeNames.Add(s);
+ dsParent.Add(n);
+ int sz=1;
+ dsSize.Add(sz);
+ nodeIds.shkAdd(s, new int(n));
+ numClusters++;
+ return n;
+}
+
+int findRoot(int n) {
+ int r=n;
+ while (dsParent[r]!=r) r=dsParent[r];
+ while (dsParent[n]!=r) { //path compression
+   int p=dsParent[n];
+   dsParent[n]=r;
+   n=p;
+   }
+ return r;
+}
+
+//create a link between two nodes, merging their t-clusters
+void linkNodes(int n1, int n2) {
+ int r1=findRoot(n1);
+ int r2=findRoot(n2);
+ if (r1==r2) return;
+ //the smaller set is attached to the root of the bigger one
+ if (dsSize[r1]<dsSize[r2]) Gswap(r1, r2);
+ dsParent[r2]=r1;
+ dsSize[r1]+=dsSize[r2];
+ numClusters--;
 }
 
-//add a new node with name id1, paired with an existing node n2
-CNode* addNode(char* id1, CNode* n2) {
- //use the same cluster
- CNode* n1=new CNode(id1,n2); //this automatically adds n1 to the shared t-cluster
- all.shkAdd(n1->id,n1);
- return n1;
+//link a group of nodes (e.g. a clone) in a single step: the roots of all
+//their t-clusters are attached to the root of the largest one
+void linkGroup(GVec<int>& group) {
+ int top=-1;
+ for (int i=0;i<group.Count();i++) {
+   int r=findRoot(group[i]);
+   group[i]=r;
+   if (top<0 || dsSize[r]>dsSize[top]) top=r;
+   }
+ for (int i=0;i<group.Count();i++) {
+   int r=group[i];
+   if (r==top || dsParent[r]!=r) continue; //already attached
+   dsParent[r]=top;
+   dsSize[top]+=dsSize[r];
+   numClusters--;
+   }
+}
+
+//split a line of space or tab delimited names in place and link them all
+//together; with restrict=true, only names in the -r list are used
+int linkNameList(char* line, GVec<int>& group, bool restrict) {
+ group.Clear();
+ char* p=line;
+ while (true) {
+   while (isspace(*p)) p++;
+   if (*p=='\0') break;
+   char* name=p;
+   while (*p!='\0' && !isspace(*p)) p++;
+   if (*p!='\0') *p++='\0';
+   if (restrict && seqonlyList.Find(name)==NULL) continue;
+   int n=nodeId(name);
+   group.Add(n);
+   }
+ if (group.Count()>1) linkGroup(group);
+ return group.Count();
+}
+
+//build the node lists of all the t-clusters and write them, largest first;
+//the output only depends on the pairs, not on their input order
+void writeClusters(FILE* f, FILE* fdiff) {
+ GMessage("Total t-clusters: %d \n", numClusters);
+ if (numClusters==0) return;
+ int numNodes=nodeNames.Count();
+ TCluster* cls=NULL;
+ GMALLOC(cls, numClusters*sizeof(TCluster));
+ int* clidx=NULL; //t-cluster index of each root
+ GMALLOC(clidx, numNodes*sizeof(int));
+ int c=0, start=0;
+ for (int i=0;i<numNodes;i++) {
+   if (findRoot(i)!=i) continue;
+   cls[c].start=start;
+   cls[c].count=0;
+   start+=dsSize[i];
+   clidx[i]=c++;
+   }
+ GMALLOC(clMembers, numNodes*sizeof(int));
+ for (int i=0;i<numNodes;i++) {
+   TCluster& cl=cls[clidx[dsParent[i]]]; //paths were compressed above
+   clMembers[cl.start+cl.count]=i;
+   cl.count++;
+   }
+ GFREE(clidx);
+ for (int i=0;i<numClusters;i++)
+   qsort(&clMembers[cls[i].start], cls[i].count, sizeof(int), compareNodes);
+ qsort(cls, numClusters, sizeof(TCluster), compareClusters);
+ GMessage("Largest cluster has %d nodes\n", cls[0].count);
+ for (int i=0; i<numClusters; i++) {
+   int* m=&clMembers[cls[i].start];
+   if (asfasta) fprintf(f,">CL%d\t%d\n", i+1, cls[i].count);
+   fprintf(f,"%s",nodeNames[m[0]]);
+   for (int j=1; j<cls[i].count;j++)
+     fprintf(f,"\t%s",nodeNames[m[j]]);
+   fprintf(f,"\n");
+   }
+ fflush(f);
+ if (fdiff!=NULL) writeDiff(fdiff, cls);
+ GFREE(clMembers);
+ GFREE(cls);
 }
 
-//create a link between two existing nodes
-void linkNodes(CNode* n1, CNode* n2) {
-if (n1->cluster==n2->cluster) return;
-//we have to merge the two clusters
-//add to the bigger cluster the sequences from the smaller one
-//(big fish swallows the smaller one)
-GCluster* src, *dest;
-if (n1->cluster->Count()>n2->cluster->Count()) {
-  // n1 is the bigger fish
-  dest = n1->cluster;
-  src  = n2->cluster;
-  }
-else {
-  dest = n2->cluster;
-  src  = n1->cluster;
-  }
-//merge the clusters (in the bigger one)
-//and remove the smaller cluster  
-for (register int i=0; i<src->Count(); i++) {
-     CNode* n= src->Get(i);
-     dest->Add(n);  /* check duplicates? they should never be there!
-          if (dest->Add(n)<0)  {
-                   delete n;
-                   src->Put(i,NULL);
-                   } */
-     //each node from smaller cluster should now point to the bigger (current)cluster
-     n->cluster=dest;
+//write the t-clusters which are not the same as in the loaded state: with
+//new nodes, or merging previous t-clusters (each shown by its first node,
+//as the members are sorted by name)
+void writeDiff(FILE* f, TCluster* cls) {
+ int* seen=NULL; //the last t-cluster a previous root was seen in
+ GMALLOC(seen, (stateNodes+1)*sizeof(int));
+ for (int i=0;i<stateNodes;i++) seen[i]=-1;
+ int numChanged=0;
+ GStr oldcls, newseqs;
+ for (int i=0;i<numClusters;i++) {
+   int* m=&clMembers[cls[i].start];
+   int numOld=0;
+   oldcls="";
+   newseqs="";
+   for (int j=0;j<cls[i].count;j++) {
+     GStr& s=(m[j]<stateNodes) ? oldcls : newseqs;
+     if (m[j]<stateNodes) {
+       int r=stateRoots[m[j]];
+       if (seen[r]==i) continue;
+       seen[r]=i;
+       numOld++;
+       }
+     if (!s.is_empty()) s+=',';
+     s+=nodeNames[m[j]];
      }
-  src->setFreeItem(false);
-  tclusters.Remove(src);
+   if (numOld==1 && newseqs.is_empty()) continue; //unchanged
+   numChanged++;
+   fprintf(f, "CL%d\t%d\t%s\t%s\n", i+1, cls[i].count,
+       oldcls.is_empty() ? "-" : oldcls.chars(),
+       newseqs.is_empty() ? "-" : newseqs.chars());
+   }
+ GFREE(seen);
+ GMessage("%d t-clusters changed or added.\n", numChanged);
+}
+
+/* Clustering state file (-k, --update): TCLST_MAGIC, uint32 version,
+   uint32 byte order tag, int32 node count, int64 size of the name pool,
+   the names ('\0' terminated, in node index order), the int32 t-cluster
+   root of each node, then TCLST_MAGIC again.
+*/
+#define TCLST_MAGIC "TCLSTATE"
+#define TCLST_VERSION 1
+
+void writeState(const char* fname) {
+ GStr tmpfile(fname);
+ tmpfile+=".tmp";
+ FILE* f=fopen(tmpfile.chars(), "wb");
+ if (f==NULL) GError("Error creating state file %s!\n", tmpfile.chars());
+ int32_t numNodes=nodeNames.Count();
+ uint32_t hdr[2]={TCLST_VERSION, 0x01020304};
+ int64_t poolLen=0;
+ for (int i=0;i<numNodes;i++) poolLen+=strlen(nodeNames[i])+1;
+ bool ok=(fwrite(TCLST_MAGIC, 1, 8, f)==8 &&
+          fwrite(hdr, sizeof(hdr), 1, f)==1 &&
+          fwrite(&numNodes, sizeof(numNodes), 1, f)==1 &&
+          fwrite(&poolLen, sizeof(poolLen), 1, f)==1);
+ for (int i=0;ok && i<numNodes;i++) {
+   size_t l=strlen(nodeNames[i])+1;
+   ok=(fwrite(nodeNames[i], 1, l, f)==l);
+   }
+ for (int i=0;ok && i<numNodes;i++) {
+   int32_t r=findRoot(i);
+   ok=(fwrite(&r, sizeof(r), 1, f)==1);
+   }
+ ok = ok && fwrite(TCLST_MAGIC, 1, 8, f)==8;
+ if (fclose(f)!=0) ok=false;
+ if (ok) ok=(rename(tmpfile.chars(), fname)==0);
+ if (!ok) {
+   remove(tmpfile.chars());
+   GError("Error writing state file %s!\n", fname);
+   }
+ GMessage("Clustering state saved for %d sequences.\n", numNodes);
+}
+
+//load a state file written by writeState(), adding its nodes and linking
+//them as in its t-clusters; with update=true this must be the first set
+//of nodes loaded, and the previous t-clusters are kept for writeDiff()
+void loadState(const char* fname, bool update) {
+ FILE* f=fopen(fname, "rb");
+ if (f==NULL) GError("Error: cannot open state file %s!\n", fname);
+ char magic[8];
+ uint32_t hdr[2];
+ int32_t numNodes=0;
+ int64_t poolLen=0;
+ if (fread(magic, 1, 8, f)!=8 || memcmp(magic, TCLST_MAGIC, 8)!=0)
+   GError("Error: %s is not a tclust state file!\n", fname);
+ if (fread(hdr, sizeof(hdr), 1, f)!=1 || hdr[0]!=TCLST_VERSION || hdr[1]!=0x01020304)
+   GError("Error: unsupported state file version or byte order (%s)!\n", fname);
+ if (fread(&numNodes, sizeof(numNodes), 1, f)!=1 || numNodes<0 ||
+     fread(&poolLen, sizeof(poolLen), 1, f)!=1 || poolLen<numNodes)
+   GError("Error reading state file header (%s)!\n", fname);
+ char* pool=NULL;
+ GMALLOC(pool, poolLen+1);
+ if (fread(pool, 1, poolLen, f)!=(size_t)poolLen || (poolLen>0 && pool[poolLen-1]!=0))
+   GError("Error reading sequence names from state file %s!\n", fname);
+ pool[poolLen]=0;
+ int* ids=NULL; //node index of each state node
+ GMALLOC(ids, (numNodes+1)*sizeof(int));
+ char* p=pool;
+ for (int i=0;i<numNodes;i++) {
+   if (p>=pool+poolLen) GError("Error: invalid state file %s!\n", fname);
+   ids[i]=nodeId(p);
+   if (update && ids[i]!=i)
+     GError("Error: duplicate name %s in state file %s!\n", p, fname);
+   p+=strlen(p)+1;
+   }
+ GFREE(pool);
+ int* roots=NULL;
+ GMALLOC(roots, (numNodes+1)*sizeof(int));
+ if ((int)fread(roots, sizeof(int32_t), numNodes, f)!=numNodes ||
+     fread(magic, 1, 8, f)!=8 || memcmp(magic, TCLST_MAGIC, 8)!=0)
+   GError("Error: state file %s is truncated!\n", fname);
+ fclose(f);
+ for (int i=0;i<numNodes;i++) {
+   int r=roots[i];
+   if (r<0 || r>=numNodes || roots[r]!=r)
+     GError("Error: invalid t-cluster data in state file %s!\n", fname);
+   if (r!=i) linkNodes(ids[i], ids[r]);
+   }
+ GFREE(ids);
+ if (update) {
+   stateRoots=roots;
+   stateNodes=numNodes;
+   GMessage("Loaded clustering state: %d sequences in %d t-clusters.\n",
+        numNodes, numClusters);
+   }
+ else GFREE(roots);
+}
+
+//--merge: add the t-clusters from a tclust output or state file
+void mergeInput(const char* fname) {
+ FILE* f=fopen(fname, "rb");
+ if (f==NULL) GError("Error: cannot open file %s!\n", fname);
+ char magic[8];
+ bool isState=(fread(magic, 1, 8, f)==8 && memcmp(magic, TCLST_MAGIC, 8)==0);
+ fclose(f);
+ if (isState) {
+   loadState(fname);
+   return;
+   }
+ f=zfopenRead(fname);
+ if (f==NULL) GError("Error: cannot open file %s!\n", fname);
+ GLineReader lr(f);
+ char* line;
+ GVec<int> group;
+ while ((line=lr.getLine())!=NULL) {
+   if (line[0]=='>') continue; //cluster header
+   linkNameList(line, group);
+   }
+ zfclose(f);
 }
 
 
@@ -573,41 +770,318 @@ bool seq_filter(char* s1, char* s2) {
  }
  
  
-/* addPair() should slowly build the t-clusters and update
-   the links for both n1 and n2
+/* addPair() should slowly build the t-clusters,
+   by merging the t-clusters of the two nodes
 */
 void addPair(char* s1, char* s2) {
- CNode* n1=all.Find(s1);
- CNode* n2=all.Find(s2); 
- //GMessage("Add pair %s %s\n",n1,n2);
- if (n1==NULL) {
-   //###### n1 is new
-   if (n2==NULL) //n2 is also new 
-        newPair(s1,s2, n1, n2);
-          //this should set d1 and d2 to the each new CNode*
-      else //n1 is new, but n2 already has a t-cluster
-        n1 = addNode(s1,n2);
-   }
-  else {
-   //###### n1 has a t-cluster
-   if (n2==NULL) //n2 is new
-        n2=addNode(s2,n1);
-      else //n2 also has a t-cluster, merge them
-        linkNodes(n1,n2);
+ linkNodes(nodeId(s1), nodeId(s2));
+}
+
+
+//======== text hits input
+/* The hits are read in large blocks of whole lines (of any length), which
+   are then split into lines and fields in place. The blocks are taken
+   under a lock, so multiple threads can load them (-p).
+*/
+bool hitsEOF=false;
+char* hitsCarry=NULL; //the incomplete line at the end of the last block
+int hitsCarryLen=0;
+int hitsCarryCap=0;
+GFastMutex hitsMutex; //for hitsf and hitsCarry
+GFastMutex fpairsMutex;
+
+//read the next block of whole lines into buf, returning its length
+//(0 at the end of the input); the block always ends with a '\n'
+int readLineBlock(char*& buf, int& bufcap) {
+ GLockGuard<GFastMutex> lock(hitsMutex);
+ int len=0;
+ if (hitsCarryLen>0) {
+   if (bufcap<hitsCarryLen+HBLOCK_SIZE+1) {
+     bufcap=hitsCarryLen+HBLOCK_SIZE+1;
+     GREALLOC(buf, bufcap);
+     }
+   memcpy(buf, hitsCarry, hitsCarryLen);
+   len=hitsCarryLen;
+   hitsCarryLen=0;
    }
+ while (!hitsEOF) {
+   if (bufcap<len+HBLOCK_SIZE+1) {
+     bufcap=len+HBLOCK_SIZE+1;
+     GREALLOC(buf, bufcap);
+     }
+   int r=fread(buf+len, 1, HBLOCK_SIZE, hitsf);
+   if (r<=0) {
+     hitsEOF=true;
+     GFREE(hitsCarry);
+     hitsCarryCap=0;
+     break;
+     }
+   int nl=len+r-1;
+   while (nl>=len && buf[nl]!='\n') nl--;
+   len+=r;
+   if (nl<len-r) continue; //no line end yet, a very long line
+   hitsCarryLen=len-nl-1;
+   if (hitsCarryLen>0) {
+     if (hitsCarryCap<hitsCarryLen) {
+       hitsCarryCap=hitsCarryLen;
+       GREALLOC(hitsCarry, hitsCarryCap);
+       }
+     memcpy(hitsCarry, buf+nl+1, hitsCarryLen);
+     }
+   len=nl+1;
+   break;
+   }
+ if (len>0 && buf[len-1]!='\n') buf[len++]='\n'; //last line, at EOF
+ return len;
 }
 
-void showCl(GCluster* C) {
-  GMessage("{%s",C->Get(0)->id);
-  for (int i=1;i<C->Count();i++) 
-     GMessage(" %s",C->Get(i)->id);
-  GMessage("}");
+//load the hits from a binary hits file (mgbconv)
+void loadBinHits(FILE* inf) {
+ GBinHitReader* hitrd=new GBinHitReader(inf);
+ if (num_threads>1) GMessage("Note: binary hits are loaded by a single thread.\n");
+ GStr hitline;
+ while (hitrd->next()) {
+   GBinHit& hit=hitrd->hit;
+   char* qname=hit.qname;
+   char* hname=hit.hname;
+   if (flt_Exclude && (excludeList.hasKey(qname) || excludeList.hasKey(hname)))
+        continue;
+   if (flt_seqOnly && seqonlyList.Find(qname)==NULL && seqonlyList.Find(hname)==NULL)
+        continue;
+   if (flt_seqRestrict && (seqonlyList.Find(qname)==NULL || seqonlyList.Find(hname)==NULL))
+        continue;
+   if (strcmp(qname, hname)==0) {
+     GMessage("Warning: self pairing found for node %s\n",qname);
+     continue;
+     }
+   if (!seq_filter(qname, hname)) continue;
+   if (hitflt) {
+     int q5=hit.q5, q3=hit.q3, h5=hit.h5, h3=hit.h3;
+     int qlen=hit.qlen, hitlen=hit.hlen;
+     int pid=(int)rint(hit.pid);
+     if (q5==q3 || h5==h3) 
+        GError("Invalid hit record #%d (%s vs %s)\n", hitrd->numHits, qname, hname);
+     bool minus=false;
+     if (q5>q3) {
+       Gswap(q5,q3);
+       minus=true;
+       }
+     if (h5>h3) {
+       Gswap(h5,h3);
+       minus=!minus;
+       }
+     int ovh_r=minus ?(GMIN(q5-1, hitlen-h3)) :(GMIN(hitlen-h3, qlen-q3));
+     int ovh_l=minus ?(GMIN(h5-1, qlen-q3)) :(GMIN(h5-1, q5-1));
+     int overlap = GMAX(q3-q5+1, h3-h5+1);
+     int scov, lcov;
+     if (hitlen>qlen) { //query is shorter
+       scov = (int) rint(((double)(q3-q5)*100)/qlen);
+       lcov = (int) rint(((double)(h3-h5)*100)/hitlen);
+       }
+     else {
+       lcov = (int) rint(((double)(q3-q5)*100)/qlen);
+       scov = (int) rint(((double)(h3-h5)*100)/hitlen);
+       }
+     if (scov<minscov || lcov<minlcov || pid<minpid || overlap<minovl
+         || hit.score<minscore || ovh_r > maxovhang || ovh_l > maxovhang) continue;
+     }
+   if (fpairs!=NULL) {
+     hit.toLine(hitline);
+     fprintf(fpairs, "%s\n", hitline.chars());
+     }
+   addPair(qname, hname);
+   }
+ delete hitrd;
+}
+
+//load the hits from hitsf, block by block; with concurrent=true this
+//is run by multiple threads (-p), using the concurrent node functions
+void loadHits(bool concurrent) {
+ char* buf=NULL;
+ int bufcap=0;
+ char* fbuf=NULL; //the lines passing the filters, for -f
+ int flen=0, fcap=0;
+ int len;
+ while ((len=readLineBlock(buf, bufcap))>0) {
+   char* line=buf;
+   char* bend=buf+len;
+   while (line<bend) {
+     char* eol=(char*)memchr(line, '\n', bend-line);
+     *eol='\0';
+     int l=eol-line;
+     if (fpairs!=NULL) { //keep a copy, as the parsing alters the line
+       if (fcap<flen+l+1) {
+         fcap=flen+l+1+HBLOCK_SIZE;
+         GREALLOC(fbuf, fcap);
+         }
+       memcpy(fbuf+flen, line, l);
+       }
+     char* hname=NULL;
+     if (l>1 && (tabflt ? tabHitPasses(line, hname) : pairPasses(line, hname))) {
+       if (concurrent) pLinkNodes(pNodeId(line), pNodeId(hname));
+         else addPair(line, hname);
+       if (fpairs!=NULL) {
+         flen+=l;
+         fbuf[flen++]='\n';
+         }
+       }
+     line=eol+1;
+     }
+   if (flen>0) {
+     GLockGuard<GFastMutex> lock(fpairsMutex);
+     fwrite(fbuf, 1, flen, fpairs);
+     flen=0;
+     }
+   }
+ GFREE(fbuf);
+ GFREE(buf);
+}
+
+//======== -p: multi-threaded loading of text hits
+/* Each block of input lines is parsed and filtered by one of the worker
+   threads (see loadHits()). The nodes are interned in a sharded name hash
+   (one lock for each shard) and linked in a shared disjoint-set array,
+   without locking: a root is only ever attached (by CAS) to a root with a
+   lower index, so no cycles can form, and paths are shortened by halving.
+   At the end the nodes are moved into the regular structures above.
+   The node arrays are allocated in segments, so they never move.
+*/
+#define PNODE_SEGBITS 16
+#define PNODE_SEGSIZE (1<<PNODE_SEGBITS)
+#define PNODE_SEGMASK (PNODE_SEGSIZE-1)
+#define PNODE_MAXSEGS 32768
+#define PNAME_SHARDS 256
+
+struct PNameShard {
+  GFastMutex mutex;
+  GHash<int> ids;
+  PNameShard():mutex(), ids(true) { }
+};
+
+PNameShard* pShards=NULL;
+int* pParentSegs[PNODE_MAXSEGS];
+char** pNameSegs[PNODE_MAXSEGS];
+int pNumNodes=0;
+GFastMutex pSegMutex; //for allocating new segments
+
+
+static inline int* pParent(int n) {
+ return &(pParentSegs[n>>PNODE_SEGBITS][n & PNODE_SEGMASK]);
+}
+
+static inline int pShard(const char* name) { //FNV-1a
+ unsigned int h=2166136261U;
+ for (const unsigned char* p=(const unsigned char*)name;*p!=0;p++) {
+   h^=*p;
+   h*=16777619U;
+   }
+ return (int)(h % PNAME_SHARDS);
+}
+
+//concurrent version of nodeId()
+int pNodeId(const char* name) {
+ PNameShard& sh=pShards[pShard(name)];
+ GLockGuard<GFastMutex> lock(sh.mutex);
+ int* id=sh.ids.Find(name);
+ if (id!=NULL) return *id;
+ int n=__atomic_fetch_add(&pNumNodes, 1, __ATOMIC_RELAXED);
+ int seg=n>>PNODE_SEGBITS;
+ if (n<0 || seg>=PNODE_MAXSEGS) GError("Error: too many sequence names!\n");
+ if (__atomic_load_n(&pParentSegs[seg], __ATOMIC_ACQUIRE)==NULL) {
+   GLockGuard<GFastMutex> slock(pSegMutex);
+   if (pParentSegs[seg]==NULL) {
+     char** nseg=NULL;
+     GMALLOC(nseg, PNODE_SEGSIZE*sizeof(char*));
+     int* aseg=NULL;
+     GMALLOC(aseg, PNODE_SEGSIZE*sizeof(int));
+     pNameSegs[seg]=nseg;
+     __atomic_store_n(&pParentSegs[seg], aseg, __ATOMIC_RELEASE);
+     }
+   }
+ char* s=Gstrdup(name);
+ pNameSegs[seg][n & PNODE_SEGMASK]=s;
+ __atomic_store_n(pParent(n), n, __ATOMIC_RELEASE);
+ sh.ids.shkAdd(s, new int(n));
+ return n;
+}
+
+//concurrent version of findRoot(), with path halving
+int pFindRoot(int n) {
+ while (true) {
+   int p=__atomic_load_n(pParent(n), __ATOMIC_ACQUIRE);
+   if (p==n) return n;
+   int gp=__atomic_load_n(pParent(p), __ATOMIC_ACQUIRE);
+   if (gp!=p)
+     __atomic_compare_exchange_n(pParent(n), &p, gp, false,
+                 __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+   n=gp;
+   }
+}
+
+//concurrent version of linkNodes()
+void pLinkNodes(int n1, int n2) {
+ while (true) {
+   n1=pFindRoot(n1);
+   n2=pFindRoot(n2);
+   if (n1==n2) return;
+   if (n1<n2) Gswap(n1, n2);
+   int r=n1;
+   if (__atomic_compare_exchange_n(pParent(n1), &r, n2, false,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED)) return;
+   //n1 was just attached somewhere else, try again
+   }
+}
+
+void hitsWorker(void*) {
+ loadHits(true);
+}
+
+void parallelLoad() {
+ pShards=new PNameShard[PNAME_SHARDS];
+ //start from the nodes already loaded (-c)
+ int numNodes=nodeNames.Count();
+ for (int i=0;i<numNodes;i++) pNodeId(nodeNames[i]);
+ for (int i=0;i<numNodes;i++) *pParent(i)=findRoot(i);
+ GThread** workers=NULL;
+ GMALLOC(workers, num_threads*sizeof(GThread*));
+ for (int i=0;i<num_threads;i++)
+   workers[i]=new GThread(hitsWorker, NULL);
+ for (int i=0;i<num_threads;i++) {
+   workers[i]->join();
+   delete workers[i];
+   }
+ GFREE(workers);
+ delete[] pShards; //the names are kept
+ pShards=NULL;
+ //move the nodes into the regular structures
+ int sz=0;
+ for (int i=0;i<pNumNodes;i++) {
+   char* s=pNameSegs[i>>PNODE_SEGBITS][i & PNODE_SEGMASK];
+   if (i<numNodes) { GFREE(s); continue; }
+   nodeNames.Add(s);
+   dsParent.Add(i);
+   dsSize.Add(sz);
+   nodeIds.shkAdd(s, new int(i));
+   }
+ numClusters=0;
+ for (int i=0;i<pNumNodes;i++) dsSize[i]=0;
+ for (int i=0;i<pNumNodes;i++) {
+   int r=pFindRoot(i);
+   dsParent[i]=r;
+   dsSize[r]++;
+   if (r==i) numClusters++;
+   }
+ for (int s=0;s<PNODE_MAXSEGS && pParentSegs[s]!=NULL;s++) {
+   GFREE(pParentSegs[s]);
+   GFREE(pNameSegs[s]);
+   }
+ pNumNodes=0;
 }
 
 
 #ifdef DBGTRACE
 void memlog(int level, const char* msg1, 
-         GCluster* C=NULL, 
+         int node=-1, 
          const char* msg2=NULL) {
  GStr s;
  if (level>0) {
@@ -615,15 +1089,11 @@ void memlog(int level, const char* msg1,
    s.padR(level+2);
    }
  if (msg1!=NULL) s+=msg1;
- if (C!=NULL) {
+ if (node>=0) { //the node and its t-cluster (root and size)
+     int r=findRoot(node);
      GStr s2;
-     s2.format("(%d){%s",C->Count(), C->Get(0)->id);
+     s2.format("%s(%d){%s}",nodeNames[node], dsSize[r], nodeNames[r]);
      s+=s2;
-     for (int i=1;i<C->Count();i++)  {
-        s2.format(" %s",C->Get(i)->id);
-        s+=s2;
-        }
-     s+="}";
      }
  if (msg2!=NULL) s+=msg2;
  mem.log(s.chars()); 
@@ -661,27 +1131,11 @@ int readClones(FILE* f) {
 //expects space delimited reads, one clone per line
   char* line;
   int count=0;
-  while ((line=fgets(inbuf, BUF_LEN-1,f))!=NULL) {
-   int l=strlen(line);
+  GLineReader lr(f);
+  GVec<int> group;
+  while ((line=lr.getLine())!=NULL) {
    count++;
-   if (line[l-1]=='\n') line[l-1]='\0';
-   GStr linestr(line);
-   linestr.startTokenize("\t ");
-   GStr token;
-   CNode* head=NULL;
-   while (linestr.nextToken(token)) {
-       if (flt_seqRestrict && !seqonlyList.Find(token.chars()))
-          continue;
-       if (head==NULL) {
-         head=new CNode((char *)token.chars());
-         tclusters.Add(head->cluster); 
-         all.shkAdd(head->id,head);
-         /*if (do_debug)
-           GMessage("Added head node '%s'\n",head->id);*/
-         }
-        else 
-         addNode((char *)token.chars(), head);      
-     }
+   linkNameList(line, group, flt_seqRestrict);
    }
  return count;
 }